@@ -0,0 +1,154 @@
+/*
+  字符串hash的基准测试：比较原来的FNV-1a和现在的hashString(带种子的wyhash)
+    1. 不同长度的字符串的hash吞吐量
+    2. 与table.c相同的线性探测哈希表(容量为2的幂，负载不超过75%)中，查找每个键平均和最多需要探测的位置数，
+       键分别为常见的标识符、随机字符串以及针对FNV-1a构造的低位相同的字符串
+
+  在仓库根目录下编译运行：
+    gcc -O2 -I. bench/hash.c $(ls *.c | grep -v main.c) -o hashbench && ./hashbench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "object.h"
+
+// 原来的hash函数
+static uint32_t hashFnv(const char* key, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= key[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+typedef uint32_t (*HashFn)(const char* key, int length);
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// 对同一批字符串反复计算hash，返回每秒处理的MB数
+static double throughput(HashFn hash, int length) {
+  enum { STRINGS = 64 };
+  static char data[STRINGS][4096];
+  for (int i = 0; i < STRINGS; i++) {
+    for (int j = 0; j < length; j++) data[i][j] = (char)('a' + (i * 7 + j * 13) % 26);
+  }
+
+  long long total = 128ll * 1024 * 1024;
+  long long rounds = total / length;
+  uint32_t sink = 0;
+  double start = now();
+  for (long long i = 0; i < rounds; i++) {
+    sink += hash(data[i & (STRINGS - 1)], length);
+  }
+  double elapsed = now() - start;
+  // 防止整个循环被优化掉
+  if (sink == 1) printf(" ");
+  return total / elapsed / (1024 * 1024);
+}
+
+typedef struct {
+  char** keys;
+  int* lengths;
+  int count;
+} KeySet;
+
+static void addKey(KeySet* set, const char* chars, int length) {
+  set->keys[set->count] = (char*)malloc(length);
+  memcpy(set->keys[set->count], chars, length);
+  set->lengths[set->count] = length;
+  set->count++;
+}
+
+static void initKeySet(KeySet* set, int capacity) {
+  set->keys = (char**)malloc(sizeof(char*) * capacity);
+  set->lengths = (int*)malloc(sizeof(int) * capacity);
+  set->count = 0;
+}
+
+// 依次插入所有的键，然后统计查找每个键时探测的位置数
+static void probeLengths(HashFn hash, KeySet* set, double* average, int* longest) {
+  int capacity = 8;
+  while (set->count > capacity * 0.75) capacity *= 2;
+  int* slots = (int*)malloc(sizeof(int) * capacity);
+  for (int i = 0; i < capacity; i++) slots[i] = -1;
+
+  long long total = 0;
+  *longest = 0;
+  for (int i = 0; i < set->count; i++) {
+    uint32_t index = hash(set->keys[i], set->lengths[i]) & (capacity - 1);
+    int probes = 1;
+    while (slots[index] != -1) {
+      index = (index + 1) & (capacity - 1);
+      probes++;
+    }
+    slots[index] = i;
+    // 线性探测中，查找一个键的探测次数等于插入它时的探测次数
+    total += probes;
+    if (probes > *longest) *longest = probes;
+  }
+
+  *average = (double)total / set->count;
+  free(slots);
+}
+
+static void reportProbes(const char* name, KeySet* set) {
+  double fnvAverage, newAverage;
+  int fnvLongest, newLongest;
+  probeLengths(hashFnv, set, &fnvAverage, &fnvLongest);
+  probeLengths(hashString, set, &newAverage, &newLongest);
+  printf("%-12s %6d keys   fnv-1a avg %8.2f max %6d   wyhash avg %5.2f max %4d\n",
+         name, set->count, fnvAverage, fnvLongest, newAverage, newLongest);
+}
+
+int main() {
+  initHashSeed();
+
+  printf("throughput (MB/s)\n");
+  int lengths[] = {3, 8, 16, 32, 64, 256, 4096};
+  for (int i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); i++) {
+    printf("  %5d bytes   fnv-1a %8.0f   wyhash %8.0f\n",
+           lengths[i], throughput(hashFnv, lengths[i]), throughput(hashString, lengths[i]));
+  }
+
+  printf("\nprobe lengths (linear probing, load <= 75%%)\n");
+  char buffer[64];
+
+  // 类似程序中的变量名和属性名
+  KeySet identifiers;
+  initKeySet(&identifiers, 50000);
+  for (int i = 0; i < 50000; i++) {
+    addKey(&identifiers, buffer, sprintf(buffer, "%s%d", i % 2 ? "field" : "var_", i));
+  }
+  reportProbes("identifiers", &identifiers);
+
+  KeySet random;
+  initKeySet(&random, 50000);
+  srand(1);
+  for (int i = 0; i < 50000; i++) {
+    int length = 4 + rand() % 20;
+    for (int j = 0; j < length; j++) buffer[j] = (char)('a' + rand() % 26);
+    addKey(&random, buffer, length);
+  }
+  reportProbes("random", &random);
+
+  // 攻击者不知道种子时只能针对固定的hash函数构造：FNV-1a的低16位全部相同的键，
+  // 它们在容量不超过65536的表中全部落在同一个位置
+  KeySet crafted;
+  initKeySet(&crafted, 2000);
+  uint64_t counter = 0;
+  while (crafted.count < 2000) {
+    int length = sprintf(buffer, "k%llx", (unsigned long long)counter++);
+    if ((hashFnv(buffer, length) & 0xffff) == 0x1234) addKey(&crafted, buffer, length);
+  }
+  reportProbes("crafted", &crafted);
+
+  return 0;
+}
@@ -5,11 +5,27 @@
 #include "vm.h"
 #include "value.h"
 
+const Superinstruction superinstructions[] = {
+  #define SUPERINSTRUCTION_PATTERN(name, length, op1, op2, op3) \
+    { name, length, { op1, op2, op3 } },
+  SUPERINSTRUCTIONS(SUPERINSTRUCTION_PATTERN)
+  #undef SUPERINSTRUCTION_PATTERN
+  // 保证数组不为空
+  { OP_COUNT, 0, { 0, 0, 0 } }
+};
+
+const int superinstructionCount =
+  sizeof(superinstructions) / sizeof(superinstructions[0]) - 1;
+
 void initChunk(Chunk* chunk) {
   chunk->count = 0;   
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
+  chunk->borrowed = false;
+  chunk->arena = NULL;
   initValueArray(&chunk->constants);
 }
 
@@ -19,59 +35,91 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     chunk->capacity = GROW_CAPACITY(oldCapacity); 
     chunk->code = GROW_ARRAY(chunk->code, uint8_t,
       oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(chunk->lines, int,
-      oldCapacity, chunk->capacity);
   }
 
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
   chunk->count++;
+
+  // 和上一条指令在同一行时不需要新的一项
+  if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+    return;
+  }
+
+  if (chunk->lineCapacity < chunk->lineCount + 1) {
+    int oldCapacity = chunk->lineCapacity;
+    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->lines = GROW_ARRAY(chunk->lines, LineStart,
+      oldCapacity, chunk->lineCapacity);
+  }
+
+  LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+  lineStart->offset = chunk->count - 1;
+  lineStart->line = line;
 }
 
 void freeChunk(Chunk* chunk) {      
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
-  freeValueArray(&chunk->constants);
+  if (chunk->arena != NULL) {
+    // 代码区中的数组不能单独释放
+    if (--chunk->arena->refs == 0) {
+      reallocate(chunk->arena, chunk->arena->size, 0);
+    }
+  } else {
+    if (!chunk->borrowed) {
+      FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+      FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    }
+    freeValueArray(&chunk->constants);
+  }
   initChunk(chunk);
 }
 
+// 头的大小向上取整到Value的大小，保证紧跟在后面的常量数组是对齐的
+#define CODE_ARENA_HEADER \
+  ((sizeof(CodeArena) + sizeof(Value) - 1) / sizeof(Value) * sizeof(Value))
+
+CodeArena* newCodeArena(size_t dataSize) {
+  size_t size = CODE_ARENA_HEADER + dataSize;
+  CodeArena* arena = (CodeArena*)reallocate(NULL, 0, size);
+  arena->size = size;
+  arena->refs = 0;
+  return arena;
+}
+
+uint8_t* codeArenaData(CodeArena* arena) {
+  return (uint8_t*)arena + CODE_ARENA_HEADER;
+}
+
 int addConstant(Chunk* chunk, Value value) {
   // GC的边界情况：因为在writeValueArray中，正式将Value写入constants数组之前，
   // 如果在写入数组之前发现constants数组空间不足，需要重新分配空间
   // 这个时候就有可能触发一次垃圾回收，但这个时候value是一个没有宿主的情况，垃圾回收就会将其回收掉
   // 那么value就会变成一个空值，从而引起bug,
   // 因此我们简单的将其出入栈，保持其引用，使其不会被垃圾回收所回收
+  // 在独立的堆中(编译器)不会触发垃圾回收，也不能访问vm的栈(见memory.h)
+  if (currentHeap() != NULL) {
+    writeValueArray(&chunk->constants, value);
+    return chunk->constants.count - 1;
+  }
+
   push(value);
   writeValueArray(&chunk->constants, value);
   pop();
   return chunk->constants.count - 1;
 }
 
-// void writeConstant(Chunk* chunk, Value value, int line) {
-//   writeValueArray(&chunk->constants, value);
-//   int index = chunk->constants.count - 1;
-//   if (index <= 255) {
-//     writeChunk(chunk, OP_CONSTANT, line);
-//     writeChunk(chunk, index, line);
-//   } else {
-//     writeChunk(chunk, OP_CONSTANT_LONG, line);
-//     if (chunk->capacity < chunk->count + 3) {
-//       int oldCapacity = chunk->capacity;
-//       chunk->capacity = GROW_CAPACITY(oldCapacity); 
-//       chunk->code = GROW_ARRAY(chunk->code, uint8_t,
-//         oldCapacity, chunk->capacity);
-//       chunk->lines = GROW_ARRAY(chunk->lines, int,
-//         oldCapacity, chunk->capacity);
-//     }
-
-//     // 在连续内存（count -> count + 2）上写入 256？
-//     // chunk->code[chunk->count] = index;
-//     chunk->code[chunk->count] = index & 0xff;
-//     chunk->code[chunk->count + 1] = (index>>8)  & 0xff;
-//     chunk->code[chunk->count + 2] = (index>>16)  & 0xff;
-
-//     chunk->lines[chunk->count] = line;
-//     chunk->count += 3;
-//   }
-// }
-
+int getLine(Chunk* chunk, int offset) {
+  // 二分查找最后一个offset不大于给定位置的项
+  int low = 0;
+  int high = chunk->lineCount - 1;
+  int line = 0;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    if (chunk->lines[mid].offset <= offset) {
+      line = chunk->lines[mid].line;
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return line;
+}
@@ -3,11 +3,18 @@
 
 #include "common.h"
 #include "value.h"
+#include "superinstructions.h"
+
+// 常量的index最多由两个OP_WIDE前缀加上指令自身的一个字节表示，也就是三个字节
+#define MAX_CONSTANTS (1 << 24)
+
+// OP_CLOSURE中每个闭包变量的标志位
+#define UPVALUE_LOCAL 0x01 // 引用的是父函数的局部变量，否则为父函数的闭包变量
+#define UPVALUE_WIDE  0x02 // index占用两个字节(局部变量的位置可能超过255)
 
 typedef enum {
   // op-constant
   OP_CONSTANT,
-  // OP_CONSTANT_LONG,
   // Types of Values literal-ops
   OP_NIL,
   OP_TRUE,
@@ -27,6 +34,8 @@ typedef enum {
   // Closures upvalue-ops
   OP_GET_UPVALUE,
   OP_SET_UPVALUE,
+  // 读取按值捕获的闭包变量(这类变量不会被赋值，因此没有对应的SET指令)
+  OP_GET_CAPTURED,
   // Classes and Instances not-yet
   OP_GET_PROPERTY,
   OP_SET_PROPERTY,
@@ -71,9 +80,58 @@ typedef enum {
   // Superclasses not-yet
   OP_INHERIT,
   // Methods and Initializers not-yet
-  OP_METHOD
+  OP_METHOD,
+  // 宽操作数前缀：为下一条指令的操作数提供更高位的字节，见compiler.c中的emitArg
+  OP_WIDE,
+  // 跳转距离超过两个字节时使用的跳转指令，操作数为常量数组中保存跳转距离的位置
+  OP_JUMP_FAR,
+  OP_JUMP_IF_FALSE_FAR,
+  OP_LOOP_FAR,
+  // 导入模块，操作数为模块路径在常量数组中的位置
+  OP_IMPORT,
+  // 超级指令：由superinstructions.py根据指令频率生成，见superinstructions.h
+  #define SUPERINSTRUCTION_OPCODE(name, length, op1, op2, op3) name,
+  SUPERINSTRUCTIONS(SUPERINSTRUCTION_OPCODE)
+  #undef SUPERINSTRUCTION_OPCODE
+  // 指令总数
+  OP_COUNT
 } OpCode;
 
+/*
+  超级指令：将几条经常连续执行的指令合并为一条指令，从而减少指令分发(switch)的次数。
+
+  编译器并不会改变指令的长度，而是在写入序列的最后一条指令时，原地将第一条指令的操作码改写为超级指令，
+  其余指令的字节保持不变。vm执行超级指令时依次执行每条子指令，并跳过中间子指令的操作码。
+  这样即使跳转指令跳到了序列的中间，也能按原来的指令正确执行，也不需要修正任何跳转偏移量。
+*/
+typedef struct {
+  // 超级指令的操作码
+  uint8_t opcode;
+  // 子指令的个数
+  int length;
+  // 被合并的子指令
+  uint8_t ops[3];
+} Superinstruction;
+
+// 超级指令表，按子指令的个数从多到少排序，以便编译器优先匹配更长的序列
+extern const Superinstruction superinstructions[];
+extern const int superinstructionCount;
+
+// 行号表中的一项：从offset开始的指令都来自第line行，直到下一项的offset为止
+// 连续的指令通常来自同一行，按行程编码之后每一行只需要一项，而不是每个字节一个int
+typedef struct {
+  int offset;
+  int line;
+} LineStart;
+
+// 代码区：一次编译产生的所有函数的常量、指令和行号表在编译结束之后被复制进同一块连续的内存，
+// 数组的大小刚好等于内容的大小，不再有GROW_CAPACITY留下的空闲空间(见compiler.c中的packFunctions)
+// 数据紧跟在这个头之后
+typedef struct {
+  size_t size;  // 整块内存的大小(包括这个头)
+  int refs;     // 使用这块内存的chunk的个数，最后一个chunk释放时释放整块内存
+} CodeArena;
+
 // 指令集
 typedef struct {
   // 长度
@@ -82,16 +140,26 @@ typedef struct {
   int capacity;
   // 指令数组
   uint8_t* code;
-  // 指令对应的代码所在行数
-  int* lines;
+  // 指令对应的代码所在行数(按offset递增的行程编码，用getLine查找)
+  LineStart* lines;
+  int lineCount;
+  int lineCapacity;
   // 指令对应的常量数组，用于存储指令的操作数
   ValueArray constants;
+  // code和lines是否借用自映射到内存中的字节码镜像(见image.c)，借用的数组是只读的，也不能释放
+  bool borrowed;
+  // code、lines和常量数组所在的代码区，为NULL时这些数组都是单独分配的
+  CodeArena* arena;
 } Chunk;  
 
 void initChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
-void writeConstant(Chunk* chunk, Value value, int line);
 void freeChunk(Chunk* chunk);
 int addConstant(Chunk* chunk, Value value);
+// 分配一块可以容纳dataSize字节数据的代码区，数据从codeArenaData返回的位置开始
+CodeArena* newCodeArena(size_t dataSize);
+uint8_t* codeArenaData(CodeArena* arena);
+// 查找offset处的指令所在的行数，只在报告运行时错误和反汇编时使用
+int getLine(Chunk* chunk, int offset);
 
 #endif
\ No newline at end of file
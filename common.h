@@ -13,11 +13,20 @@
 // 内存分配和回收打印debug
 // #define DEBUG_LOG_GC
 
+// 统计运行时相邻指令(二元组、三元组)的执行频率，退出时追加写入opcodes.profile
+// 供superinstructions.py生成超级指令，开启时编译器不会合并超级指令
+// #define DEBUG_PROFILE_OPCODES
+
 // 开启NAN优化策略，由于这项优化策略在部分机器上可能不支持，
 // 因此定义为一个条件的宏，以便向后兼容 
 #define NAN_BOXING
 
+// 词法分析器使用SSE2指令一次判断16个字符(空白、注释、标识符、数字和字符串)
+// 不支持SSE2的平台自动使用逐个字符判断的实现
+#define SCANNER_SIMD
+
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -7,7 +7,9 @@
 #include "scanner.h"
 #include "chunk.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -28,7 +30,14 @@ typedef enum {
   PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign);
+// 每次预先扫描的token数量
+#define TOKEN_BATCH 256
+// 标识符缓存的大小，必须是2的幂
+#define IDENTIFIER_CACHE 64
+
+typedef struct Parser Parser;
+
+typedef void (*ParseFn)(Parser* parser, bool canAssign);
 
 typedef struct {
   ParseFn prefix;
@@ -36,6 +45,13 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
+// 局部变量被子函数捕获的方式
+typedef enum {
+  CAPTURE_UNKNOWN,      // 还没有被捕获过，第一次被捕获时再确定
+  CAPTURE_BY_VALUE,     // 声明之后不会再被赋值，创建闭包时直接复制它的值
+  CAPTURE_BY_REFERENCE  // 会被赋值，需要通过ObjUpvalue共享
+} CaptureKind;
+
 // 局部变量
 typedef struct {
   // 变量名
@@ -44,13 +60,15 @@ typedef struct {
   int depth;
   // 标明是否有子函数引用了该变量，导致该变量成为了一个闭包变量
   // 这进一步决定了当该变量的值在stack中去除的时候，我们是否应该生成一个ObjUpvalue，将其放入栈中
+  // 注意：按值捕获的变量不会标记isCaptured
   bool isCaptured;
+  CaptureKind capture;
 } Local;
 
 // 闭包变量
 typedef struct {
   // index 指向该闭包变量在slots和locals中的index(偏移量)
-  uint8_t index;
+  uint16_t index;
   // isLocal 标明该闭包变量引用的是一个局部变量(true)还是另外一个闭包变量(false)
   bool isLocal;
 } Upvalue;
@@ -71,13 +89,26 @@ typedef struct Compiler {
   // 函数类型，标明是在函数内(TYPE_FUNCTION)还是在顶级作用域内(TYPE_SCRIPT)
   FunctionType type;
   // 局部变量数组，主要用于记录变量的名字和位置，真实的变量存于stack中
-  Local locals[UINT8_COUNT];
+  // 数组按需增长，最多可以有LOCALS_MAX个局部变量(见vm.h)
+  Local* locals;
   // 变量个数
   int localCount;
+  int localCapacity;
   // 闭包环境变量数组
   Upvalue upvalues[UINT8_COUNT];
+  // 按值捕获的闭包变量数组
+  Upvalue captures[UINT8_COUNT];
   // 当前正在编译的块级作用域的深度，默认为0即全局作用域
   int scopeDepth;
+  // 常量去重表：开放寻址的哈希表，值为常量在constants数组中的位置，-1表示空位
+  // 用于在写入常量之前找到相同的数字或字符串常量并复用它
+  int* constantSlots;
+  int constantCount;
+  int constantCapacity;
+  // 最近写入的两条指令(操作码和在chunk中的位置)，用于合并超级指令
+  uint8_t recentOps[2];
+  int recentOffsets[2];
+  int recentCount;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -90,68 +121,85 @@ typedef struct ClassCompiler {
 } ClassCompiler;
 
 // Parser 执行one-pass策略，一次循环中编译
-typedef struct {
+// 一次编译的所有状态都保存在Parser中，并作为第一个参数传给每个编译函数，
+// 编译器没有任何全局状态，因此可以重入，多个线程也可以同时编译(见compileInHeap)
+struct Parser {
   Token current;  // 下一个token
   Token previous; // 当前token
   bool panicMode; // 是否已经进入了错误模式
   bool hadError;
-} Parser;
-
-// 语法分析器：创建一个全局变量，以免传来传去
-Parser parser;
-
-// 当前正在写入的chunk
-// @Deprecated: 每个函数都维护自己的chunk, 因此不需要一个全局的chunk
-// Chunk* compilingChunk;
-
-// compiler
-Compiler* current = NULL;
-
-// 用于记录当前正在编译的class类
-ClassCompiler* currentClass = NULL;
+  // 词法分析器
+  Scanner scanner;
+  // 预先扫描好的一批token，标识符已经intern(见fillTokens)
+  Token tokens[TOKEN_BATCH];
+  int tokenCount;
+  // 下一个要读取的token在tokens中的位置
+  int nextToken;
+  // 最近intern过的标识符，按长度和首尾字符直接映射，大部分标识符在这里就能找到，不需要计算hash
+  ObjString* recentIdentifiers[IDENTIFIER_CACHE];
+  // 当前正在编译的函数的compiler
+  Compiler* compiler;
+  // 用于记录当前正在编译的class类
+  ClassCompiler* currentClass;
+  // 延迟编译模式：全局函数的函数体在第一次调用时才编译(见lazyFunction)
+  bool lazy;
+};
 
-static void initCompiler(Compiler* compiler, FunctionType type) {
-  compiler->enclosing = current;
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type) {
+  compiler->enclosing = parser->compiler;
 
   compiler->function = NULL;
   compiler->type = type;
 
+  compiler->locals = NULL;
   compiler->localCount = 0;
+  compiler->localCapacity = 0;
   compiler->scopeDepth = 0;
+  compiler->constantSlots = NULL;
+  compiler->constantCount = 0;
+  compiler->constantCapacity = 0;
+  compiler->recentCount = 0;
 
   compiler->function = newFunction();
-  current = compiler;
+  parser->compiler = compiler;
 
   if (type != TYPE_SCRIPT) {
-    current->function->name = copyString(parser.previous.start, parser.previous.length);
+    parser->compiler->function->name = copyString(parser->previous.start, parser->previous.length);
   }
 
   // 将第一个变量写为空，作为全局作用域（函数）的名字
-  Local* local = &current->locals[current->localCount++];
+  parser->compiler->localCapacity = GROW_CAPACITY(0);
+  parser->compiler->locals = ALLOCATE(Local, parser->compiler->localCapacity);
+  parser->compiler->function->maxSlots = 1;
+  Local* local = &parser->compiler->locals[parser->compiler->localCount++];
   local->depth = 0;
   local->isCaptured = false;
+  // this不能被赋值
+  local->capture = CAPTURE_BY_VALUE;
 
   // 如果不是function类型，则将第一个变量设为this
   if (type != TYPE_FUNCTION) {
     local->name.start = "this";
     local->name.length = 4;
+    local->name.string = copyString("this", 4);
   } else {
     local->name.start = "";
     local->name.length = 0;
+    local->name.string = NULL;
   }
 }
 
-static Chunk* currentChunk() {
+static Chunk* currentChunk(Parser* parser) {
   // return compilingChunk;
-  return &current->function->chunk;
+  return &parser->compiler->function->chunk;
 }
 
 // -------------------- token方法 -------------------------
 
 // 打印错误信息
-static void errorAt(Token* token, const char* message) {
-  if (parser.panicMode) return;
-  parser.panicMode = true;
+static void errorAt(Parser* parser, Token* token, const char* message) {
+  if (parser->panicMode) return;
+  parser->panicMode = true;
 
   // 错误行数
   fprintf(stderr, "[line %d] Error", token->line);
@@ -167,194 +215,377 @@ static void errorAt(Token* token, const char* message) {
 
   // 错误信息
   fprintf(stderr, ": %s\n", message);
-  parser.hadError = true;
+  parser->hadError = true;
 }
 
 // 语法分析错误
-static void error(const char* message) {
-  errorAt(&parser.previous, message);   
+static void error(Parser* parser, const char* message) {
+  errorAt(parser, &parser->previous, message);   
 }
 
 // 词法分析错误
-static void errorAtCurrent(const char* message) {
-  errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+  errorAt(parser, &parser->current, message);
+}
+
+static ObjString* internIdentifier(Parser* parser, Token* token) {
+  unsigned slot = ((unsigned)token->length * 31 + (unsigned char)token->start[0] * 7 +
+                   (unsigned char)token->start[token->length - 1]) & (IDENTIFIER_CACHE - 1);
+  ObjString* string = parser->recentIdentifiers[slot];
+  if (string != NULL && string->length == token->length &&
+      memcmp(string->chars, token->start, token->length) == 0) {
+    return string;
+  }
+
+  string = copyString(token->start, token->length);
+  parser->recentIdentifiers[slot] = string;
+  return string;
+}
+
+// 一次扫描一批token，同时intern其中的标识符：每个标识符只在这里计算一次hash，
+// 之后比较标识符和生成变量名常量都只需要使用字符串对象的指针
+static void fillTokens(Parser* parser) {
+  int count = 0;
+  while (count < TOKEN_BATCH) {
+    Token token = scanToken(&parser->scanner);
+    if (token.type == TOKEN_IDENTIFIER || token.type == TOKEN_THIS) {
+      token.string = internIdentifier(parser, &token);
+    }
+    parser->tokens[count++] = token;
+    if (token.type == TOKEN_EOF) break;
+  }
+  parser->tokenCount = count;
+  parser->nextToken = 0;
 }
 
 // 消费任意的一个不为error的token
-static void advance() {
+static void advance(Parser* parser) {
   // 保存之前的一个token
-  parser.previous = parser.current;
+  parser->previous = parser->current;
 
   for (;;) {
-    parser.current = scanToken();
-    if (parser.current.type != TOKEN_ERROR) break;
+    if (parser->nextToken == parser->tokenCount) fillTokens(parser);
+    parser->current = parser->tokens[parser->nextToken++];
+    if (parser->current.type != TOKEN_ERROR) break;
 
     // 如果是error token，则报错, start 则是message
-    errorAtCurrent(parser.current.start);
+    errorAtCurrent(parser, parser->current.start);
   }
 }
 
 // 消费指定类型的token一个，用于前瞻
-static void consume(TokenType type, const char* message) {
-  if (parser.current.type == type) {
-    advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+  if (parser->current.type == type) {
+    advance(parser);
     return;
   }
 
-  errorAtCurrent(message);
+  errorAtCurrent(parser, message);
 }
 
-static bool check(TokenType type) {
-  return parser.current.type == type;
+static bool check(Parser* parser, TokenType type) {
+  return parser->current.type == type;
 }
 
-static bool match(TokenType type) {
-  if (!check(type)) return false;
-  advance();
+static bool match(Parser* parser, TokenType type) {
+  if (!check(parser, type)) return false;
+  advance(parser);
   return true;
 }
 
 // --------------------  字节码写入方法  -------------------------
 
 // 写入一个字节指令到chunk中
-static void emitByte(uint8_t byte) {
-  writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Parser* parser, uint8_t byte) {
+  writeChunk(currentChunk(parser), byte, parser->previous.line);
+}
+
+// 统计指令频率时需要原始的指令序列，因此不合并超级指令
+#ifndef DEBUG_PROFILE_OPCODES
+// 在写入一条指令之前，查看它和之前的指令能否组成一条超级指令(见chunk.h)
+// 如果可以，则原地将序列中第一条指令的操作码改写为超级指令
+static void fuseSuperinstruction(Parser* parser, uint8_t op) {
+  for (int i = 0; i < superinstructionCount; i++) {
+    const Superinstruction* pattern = &superinstructions[i];
+    int previous = pattern->length - 1;
+    if (pattern->ops[previous] != op || parser->compiler->recentCount < previous) continue;
+
+    bool matched = true;
+    for (int j = 0; j < previous; j++) {
+      if (parser->compiler->recentOps[2 - previous + j] != pattern->ops[j]) {
+        matched = false;
+        break;
+      }
+    }
+
+    if (matched) {
+      currentChunk(parser)->code[parser->compiler->recentOffsets[2 - previous]] = pattern->opcode;
+      break;
+    }
+  }
+
+  // 记录该指令，注意记录的是原始的操作码，而不是被改写后的超级指令
+  parser->compiler->recentOps[0] = parser->compiler->recentOps[1];
+  parser->compiler->recentOffsets[0] = parser->compiler->recentOffsets[1];
+  parser->compiler->recentOps[1] = op;
+  parser->compiler->recentOffsets[1] = currentChunk(parser)->count;
+  if (parser->compiler->recentCount < 2) parser->compiler->recentCount++;
+}
+#endif
+
+// 写入一条指令的操作码
+static void emitOp(Parser* parser, uint8_t op) {
+  #ifndef DEBUG_PROFILE_OPCODES
+    fuseSuperinstruction(parser, op);
+  #endif
+  emitByte(parser, op);
+}
+
+// 写入一条带一个字节操作数的指令到chunk中，例如constant的操作数
+static void emitBytes(Parser* parser, uint8_t op, uint8_t operand) {
+  emitOp(parser, op);
+  emitByte(parser, operand);
 }
 
-// 写入两个字节指令到chunk中，例如constant的操作数
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-  emitByte(byte1);
-  emitByte(byte2);
+// 写入一条操作数可能超过一个字节的指令(常量的index、局部变量的位置)
+// 操作数的低8位跟在指令后面，更高位的字节则由前面的OP_WIDE前缀依次给出：
+//   OP_WIDE b2  OP_WIDE b1  op b0  =>  操作数为 b2 << 16 | b1 << 8 | b0
+// 绝大多数的指令操作数都小于256，因此不会有额外的开销
+static void emitArg(Parser* parser, uint8_t op, int arg) {
+  if (arg > UINT16_MAX) emitBytes(parser, OP_WIDE, (arg >> 16) & 0xff);
+  if (arg > UINT8_MAX) emitBytes(parser, OP_WIDE, (arg >> 8) & 0xff);
+  emitBytes(parser, op, arg & 0xff);
 }
 
+static int makeConstant(Parser* parser, Value value);
+
 // jump补丁，在解析一定代码后，重写该跳过的字节指令
-static void patchJump(int offset) {
+static void patchJump(Parser* parser, int offset) {
   // 计算自从offsetIndex之后又写入了多少个字节指令
   // -2 表示减去jump指令后面的两个字节，这是我们要重写的两个字节
-  int jump = currentChunk()->count - offset - 2;
+  int jump = currentChunk(parser)->count - offset - 2;
 
   if (jump > UINT16_MAX) {
-    error("Too much code to jump over.");
+    // 两个字节放不下跳转距离时，将跳转距离放入常量数组中，
+    // 并将指令改写为对应的FAR指令，其操作数为该常量的位置
+    uint8_t* instruction = &currentChunk(parser)->code[offset - 1];
+    *instruction = *instruction == OP_JUMP ? OP_JUMP_FAR : OP_JUMP_IF_FALSE_FAR;
+    jump = makeConstant(parser, NUMBER_VAL(jump));
+
+    if (jump > UINT16_MAX) {
+      error(parser, "Too much code to jump over.");
+    }
   }
 
   // 将jump写入该两个字节，这叫做补丁
-  currentChunk()->code[offset] = jump >> 8 & 0xff;
-  currentChunk()->code[offset + 1] = jump & 0xff;
+  currentChunk(parser)->code[offset] = jump >> 8 & 0xff;
+  currentChunk(parser)->code[offset + 1] = jump & 0xff;
 }
 
 // 写入jump指令(三字节指令)，表明要跳过的执行指令字节数
-static int emitJump(uint8_t instruction) {
-  emitByte(instruction);
+static int emitJump(Parser* parser, uint8_t instruction) {
+  emitOp(parser, instruction);
   // 2个字节可以允许跳过65536字节指令，暂时用oxff来占位
-  emitByte(0xff);
-  emitByte(0xff);
+  emitByte(parser, 0xff);
+  emitByte(parser, 0xff);
   // 返回跳过字节在数组中的index，方便以后重写
-  return currentChunk()->count - 2;
+  return currentChunk(parser)->count - 2;
 }
 
 // 写入loop指令，用于回跳指令
-static void emitLoop(int loopStart) {
-  emitByte(OP_LOOP);
+static void emitLoop(Parser* parser, int loopStart) {
   // offset表示需要回跳的指令字节数
   // 在while中：即为：条件指令 + body中的指令 + OP_LOOP指令 + 2(下面的两个操作数占用的字节)
-  int offset = currentChunk()->count - loopStart + 2;
+  int offset = currentChunk(parser)->count - loopStart + 3;
 
-  if (offset > UINT16_MAX) error("Loop body too large.");
+  if (offset > UINT16_MAX) {
+    // 同patchJump，回跳距离过大时改用OP_LOOP_FAR，操作数为保存回跳距离的常量位置
+    offset = makeConstant(parser, NUMBER_VAL(offset));
+    if (offset > UINT16_MAX) error(parser, "Loop body too large.");
+    emitOp(parser, OP_LOOP_FAR);
+  } else {
+    emitOp(parser, OP_LOOP);
+  }
 
-  emitByte((offset >> 8) & 0xff);
-  emitByte(offset & 0xff);
+  emitByte(parser, (offset >> 8) & 0xff);
+  emitByte(parser, offset & 0xff);
 }
 
 // return 指令
-static void emitReturn() {
+static void emitReturn(Parser* parser) {
   // 如果是init函数，则需要返回类的实例（此时刚好在locals中的0位置）
-  if (current->type == TYPE_INITIALIZER) {
-    emitBytes(OP_GET_LOCAL, 0);
+  if (parser->compiler->type == TYPE_INITIALIZER) {
+    emitBytes(parser, OP_GET_LOCAL, 0);
   } else {
     // 手动触发return指令时，需要返回一个默认值：nil
-    emitByte(OP_NIL);
+    emitOp(parser, OP_NIL);
+  }
+  emitOp(parser, OP_RETURN);
+}
+
+// 常量去重表的负载上限，同table.c
+#define CONSTANT_MAX_LOAD 0.75
+
+// 只有数字和字符串常量会被复用，其余的常量(例如函数)每次都写入新的位置
+static bool isReusableConstant(Value value) {
+  return IS_NUMBER(value) || IS_STRING(value) || IS_SHORT_STRING(value);
+}
+
+static uint64_t numberBits(double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(double));
+  return bits;
+}
+
+// 判断两个常量是否可以共用同一个位置
+// 数字按二进制位比较而不是isEuqal：这样0和-0是两个不同的常量，而NaN(NaN != NaN)也可以被复用
+// 字符串都已经被interned，字面相同的字符串必然是同一个对象，直接比较指针即可
+// 相同的短字符串的Value完全相同，同样按二进制位比较
+static bool isSameConstant(Value a, Value b) {
+  if (IS_NUMBER(a) || IS_NUMBER(b)) {
+    return IS_NUMBER(a) && IS_NUMBER(b) &&
+        numberBits(AS_NUMBER(a)) == numberBits(AS_NUMBER(b));
+  }
+  if (IS_SHORT_STRING(a) || IS_SHORT_STRING(b)) {
+    return IS_SHORT_STRING(a) && IS_SHORT_STRING(b) &&
+        numberBits(AS_NUMBER(a)) == numberBits(AS_NUMBER(b));
   }
-  emitByte(OP_RETURN);
+  return AS_OBJ(a) == AS_OBJ(b);
+}
+
+static uint32_t hashConstant(Value value) {
+  // 字符串直接使用已经计算好的hash值
+  if (IS_STRING(value)) return AS_STRING(value)->hash;
+
+  // 数字和短字符串：将64位打散之后取低32位
+  uint64_t bits = numberBits(AS_NUMBER(value));
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+// 在去重表中找到该常量所在的槽位，如果不存在，返回一个空位
+static int* findConstantSlot(Parser* parser, int* slots, int capacity, Value value) {
+  ValueArray* constants = &currentChunk(parser)->constants;
+  uint32_t index = hashConstant(value) & (capacity - 1);
+  for (;;) {
+    int* slot = &slots[index];
+    if (*slot == -1 || isSameConstant(constants->values[*slot], value)) {
+      return slot;
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void adjustConstantCapacity(Parser* parser, int capacity) {
+  int* slots = ALLOCATE(int, capacity);
+  for (int i = 0; i < capacity; i++) slots[i] = -1;
+
+  // 扩容之后重新计算每个常量的位置
+  for (int i = 0; i < parser->compiler->constantCapacity; i++) {
+    int constant = parser->compiler->constantSlots[i];
+    if (constant == -1) continue;
+    Value value = currentChunk(parser)->constants.values[constant];
+    *findConstantSlot(parser, slots, capacity, value) = constant;
+  }
+
+  FREE_ARRAY(int, parser->compiler->constantSlots, parser->compiler->constantCapacity);
+  parser->compiler->constantSlots = slots;
+  parser->compiler->constantCapacity = capacity;
 }
 
 // 写一个Value struct到chunk的constants数组中，返回index
-static uint8_t makeConstant(Value value) {
-  // TOFIX: 优化： 如果已经存在相同的string Constant，则直接复用
-  // Chunk* ck = currentChunk();
-  // if (IS_STRING(value)) {
-  //   for (int i = 0; i < ck->count; i++) {
-  //     if (isEuqal(value, ck->constants.values[i])) {
-  //       return i;
-  //     }
-  //   }
-  // }
-  int constant = addConstant(currentChunk(), value);
-  if (constant > UINT8_MAX) {
-    error("Too many constants in one chunk.");
+// 相同的数字和字符串常量只会写入一次，例如方法中多次出现的this.x只占用一个常量
+static int makeConstant(Parser* parser, Value value) {
+  bool reusable = isReusableConstant(value);
+  if (reusable && parser->compiler->constantCapacity > 0) {
+    int* slot = findConstantSlot(parser, parser->compiler->constantSlots,
+                                 parser->compiler->constantCapacity, value);
+    if (*slot != -1) return *slot;
+  }
+
+  int constant = addConstant(currentChunk(parser), value);
+  // 常量的index最多用三个字节表示(见emitArg)
+  if (constant > MAX_CONSTANTS - 1) {
+    error(parser, "Too many constants in one chunk.");
     return 0;
   }
 
-  return (uint8_t)constant;
+  if (reusable) {
+    // 去重表需要在写入constants之后再扩容：扩容可能触发GC，
+    // 而新的常量(例如刚刚生成的变量名字符串)只有写入constants之后才不会被回收
+    if (parser->compiler->constantCount + 1 > parser->compiler->constantCapacity * CONSTANT_MAX_LOAD) {
+      adjustConstantCapacity(parser, GROW_CAPACITY(parser->compiler->constantCapacity));
+    }
+    *findConstantSlot(parser, parser->compiler->constantSlots, parser->compiler->constantCapacity,
+                      value) = constant;
+    parser->compiler->constantCount++;
+  }
+
+  return constant;
 }
 
 // 写入一个double类型的常量字节
-static void emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+  emitArg(parser, OP_CONSTANT, makeConstant(parser, value));
 }
 
 // 用return指令来结束当前函数的编译
-static ObjFunction* endCompiler() {
+static ObjFunction* endCompiler(Parser* parser) {
   // 不管一个函数有没有返回语句，在body结束后我们都默认加一个return指令，用于结束该函数的执行。
-  emitReturn();
+  emitReturn(parser);
 
-  ObjFunction* function = current->function;
+  ObjFunction* function = parser->compiler->function;
 
   // 打印当前指令集，验证编译正确性
   #ifdef DEBUG_PRINT_CODE
-  if (!parser.hadError) {
+  if (!parser->hadError) {
     disassembleChunk(
-      currentChunk(),
+      currentChunk(parser),
       function->name != NULL ? function->name->chars : "<script>"
     );
   }
   #endif
+  FREE_ARRAY(Local, parser->compiler->locals, parser->compiler->localCapacity);
+  FREE_ARRAY(int, parser->compiler->constantSlots, parser->compiler->constantCapacity);
   // 当一个函数体完毕之后，需要将current重置为父环境的current;
-  current = current->enclosing;
+  parser->compiler = parser->compiler->enclosing;
   return function;
 }
 
 
 // 存在循环引用，因此需要先声明，否则编译报错
-static void expression();
-static void declaration();
-static void statement();
+static void expression(Parser* parser);
+static void declaration(Parser* parser);
+static void statement(Parser* parser);
 static bool isIdentifierEqual(Token* a, Token* b);
-static uint8_t identifierConstant(Token*);
+static int identifierConstant(Parser* parser, Token*);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
 
 // -------------------- 将对应的表达式转为字节码 -------------------------
 
 // group表达式，去掉左右括号直接执行中间的表达式
-static void grouping(bool canAssign) {
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool canAssign) {
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-// 数字表达式：将字符串转为double, 类似parseFloat自动取前面的数字
-static void number(bool canAssign) {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+// 数字表达式：将字符串转为double(见number.c)
+static void number(Parser* parser, bool canAssign) {
+  double value = parseNumber(parser->previous.start, parser->previous.length);
+  emitConstant(parser, NUMBER_VAL(value));
 }
 
 // 从局部作用域去找该变量
-static int resolveLocal(Compiler* compiler, Token* name) {
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name) {
   // 从locals一层一层的往上找，直到找到名字相同的变量，返回其在locals中的位置index
   for (int i = compiler->localCount - 1; i >= 0; i--) {
     Local* local = &compiler->locals[i];
     if (isIdentifierEqual(name, &local->name)) {
       if (local->depth == -1) {                                     
-        error("Cannot read local variable in its own initializer.");
+        error(parser, "Cannot read local variable in its own initializer.");
       }
       return i;
     }
@@ -363,75 +594,141 @@ static int resolveLocal(Compiler* compiler, Token* name) {
   return -1;
 }
 
-// 添加或找到一个upvalue(闭包变量), 返回其在upvalues数组中的位置
-static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
-  int upvalueCount = compiler->function->upvalueCount;
+// 添加或找到一个upvalue(闭包变量), 返回其在upvalues(按值捕获时为captures)数组中的位置
+static int addUpvalue(Parser* parser, Compiler* compiler, uint16_t index, bool isLocal,
+                      bool byValue) {
+  Upvalue* upvalues = byValue ? compiler->captures : compiler->upvalues;
+  int* upvalueCount = byValue ? &compiler->function->captureCount
+                              : &compiler->function->upvalueCount;
   // 因为一个函数中可以多次引用该闭包变量，
   // 因此在添加一个新的upvalue之前，尝试找到之前已经生成过相同的闭包变量
-  for (int i = 0; i < upvalueCount; i++) {
-    Upvalue* upvalue = &compiler->upvalues[i];
+  for (int i = 0; i < *upvalueCount; i++) {
+    Upvalue* upvalue = &upvalues[i];
     if (upvalue->index == index && upvalue->isLocal == isLocal) {
       return i;
     }
   }
 
-  if (upvalueCount == UINT8_COUNT) {
-    error("Too many closure variables in this function");
+  if (*upvalueCount == UINT8_COUNT) {
+    error(parser, "Too many closure variables in this function");
     return 0;
   }
 
   // 添加一个upvalue
-  compiler->upvalues[upvalueCount].isLocal = isLocal;
-  compiler->upvalues[upvalueCount].index = index;
-  return compiler->function->upvalueCount++;
+  upvalues[*upvalueCount].isLocal = isLocal;
+  upvalues[*upvalueCount].index = index;
+  return (*upvalueCount)++;
+}
+
+// 从变量声明的位置开始向后扫描源码，查找对该变量的赋值(name = ...)，直到变量的作用域结束
+// 这是一个保守的判断：内部作用域中同名变量的赋值也会被当成对该变量的赋值，这最多只会少做一次优化
+static bool isAssignedAfterDeclaration(Token* name) {
+  // 使用一个单独的词法分析器，不影响parser的位置
+  Scanner scanner;
+  initScanner(&scanner, name->start);
+  // 跳过变量名本身，声明中的初始化表达式(var a = ...)不算作赋值
+  scanToken(&scanner);
+
+  bool assigned = false;
+  // 变量在参数列表或者for循环的括号中声明时，parens会在括号结束时变为负数
+  int braces = 0;
+  int parens = 0;
+  Token previous;
+  previous.type = TOKEN_EOF;
+  TokenType beforePrevious = TOKEN_EOF;
+
+  for (;;) {
+    Token token = scanToken(&scanner);
+    if (token.type == TOKEN_EOF) break;
+
+    // a.name = ... 是属性赋值，不是对变量的赋值
+    if (token.type == TOKEN_EQUAL && previous.type == TOKEN_IDENTIFIER &&
+        beforePrevious != TOKEN_DOT && isIdentifierEqual(&previous, name)) {
+      assigned = true;
+      break;
+    }
+
+    if (token.type == TOKEN_LEFT_PAREN) parens++;
+    if (token.type == TOKEN_RIGHT_PAREN) parens--;
+    if (token.type == TOKEN_LEFT_BRACE) braces++;
+    if (token.type == TOKEN_RIGHT_BRACE) braces--;
+
+    // 块级作用域结束
+    if (braces < 0) break;
+    // 函数体或者for循环体结束
+    if (parens < 0 && braces == 0 &&
+        (token.type == TOKEN_RIGHT_BRACE || token.type == TOKEN_SEMICOLON)) {
+      break;
+    }
+
+    beforePrevious = previous.type;
+    previous = token;
+  }
+
+  return assigned;
 }
 
 // 解析闭包变量, 返回其在upvalues数组中的位置作为指令操作数
-static int resolveUpvalue(Compiler* compiler, Token* name) {
+// 如果该变量可以按值捕获，则byValue被置为true，返回的是在captures数组中的位置
+static int resolveUpvalue(Parser* parser, Compiler* compiler, Token* name, bool* byValue) {
   // 如果已经在顶级作用域内，也就不存在闭包环境了
   if (compiler->enclosing == NULL) return -1;
 
   // 首先在闭包环境中的局部变量中去找
-  int local = resolveLocal(compiler->enclosing, name);
+  int local = resolveLocal(parser, compiler->enclosing, name);
   if (local != -1) {
+    Local* variable = &compiler->enclosing->locals[local];
+    // 第一次被捕获时，判断该变量之后是否还会被赋值
+    // 如果不会，创建闭包时直接复制它的值即可：不需要ObjUpvalue，也不需要在作用域结束时close
+    if (variable->capture == CAPTURE_UNKNOWN) {
+      variable->capture = isAssignedAfterDeclaration(&variable->name)
+          ? CAPTURE_BY_REFERENCE : CAPTURE_BY_VALUE;
+    }
+
+    *byValue = variable->capture == CAPTURE_BY_VALUE;
     // 将该变量置为一个闭包变量
-    compiler->enclosing->locals[local].isCaptured = true;
+    if (!*byValue) variable->isCaptured = true;
     // 如果在闭包环境中找到了该变量，则为该函数添加一个闭包环境变量(upvalue)
-    return addUpvalue(compiler, (uint8_t)local, true);
+    return addUpvalue(parser, compiler, (uint16_t)local, true, *byValue);
   }
 
   // 然后在闭包环境中的父环境中去递归寻找，直到没有父环境为止
-  int upvalue = resolveUpvalue(compiler->enclosing, name);
-  if (local != -1) {
+  int upvalue = resolveUpvalue(parser, compiler->enclosing, name, byValue);
+  if (upvalue != -1) {
     // 如果在闭包环境中找到了该变量，则为该函数添加一个闭包环境变量(upvalue)
     // note: 注意这儿只要在父环境中存在这样一个变量
     // 那么这个父环境 -> 引用这个变量的子环境中间所有的函数都会在其upvalues中添加这个upvalue
     // 注意这isLocal被置为了false, 标明这个upvalue是一个引用upvalue的值，index值也变成了在upvalues中的index值
-    return addUpvalue(compiler, (uint8_t)upvalue, false);
+    // 按值捕获的变量同理，从父函数的captures中复制
+    return addUpvalue(parser, compiler, (uint16_t)upvalue, false, *byValue);
   }
 
   return -1;
 }
 
 // assignment → ( call "." )? IDENTIFIER "=" assignment
-static void namedVariable(Token name, bool canAssign) {
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
   uint8_t getOp, setOp;
+  bool byValue = false;
   // 首先尝试从块级作用域去找该变量
   // 局部: arg为在locals中的位置
-  int arg = resolveLocal(current, &name);
+  int arg = resolveLocal(parser, parser->compiler, &name);
 
   // 变量在当前的块级作用域找到
   if (arg != -1) {
     getOp = OP_GET_LOCAL;
     setOp = OP_SET_LOCAL;
-  } else if ((arg = resolveUpvalue(current, &name)) != -1) {
+  } else if ((arg = resolveUpvalue(parser, parser->compiler, &name, &byValue)) != -1) {
     // 在闭包环境中找到
     // 闭包变量：此时的arg为在upvalues中的位置
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
+    // 按值捕获的变量：arg为在captures中的位置，
+    // 这类变量不会被赋值(见isAssignedAfterDeclaration)，因此不会用到setOp
+    if (byValue) getOp = OP_GET_CAPTURED;
   } else {
     // 全局变量: arg为在constants中的位置
-    arg = identifierConstant(&name);
+    arg = identifierConstant(parser, &name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
@@ -441,168 +738,168 @@ static void namedVariable(Token name, bool canAssign) {
     因此需要加一个限制条件: canAssign.
     成立的条件：变量前面的运算符的优先级 <= PREC_ASSIGNMENT
    */
-  if (canAssign && match(TOKEN_EQUAL)) {
-    expression();
-    emitBytes(setOp, arg);
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    expression(parser);
+    emitArg(parser, setOp, arg);
   } else {
-    emitBytes(getOp, arg);
+    emitArg(parser, getOp, arg);
   }
 }
 
 // 变量
-static void variable(bool canAssign) {
-  namedVariable(parser.previous, canAssign);
+static void variable(Parser* parser, bool canAssign) {
+  namedVariable(parser, parser->previous, canAssign);
 }
 
 // 文本表达式：nil, false, true;
-static void literal(bool canAssign) {
+static void literal(Parser* parser, bool canAssign) {
   // 直接写入对应的操作指令
-  switch (parser.previous.type) {
-    case TOKEN_FALSE: emitByte(OP_FALSE); break;
-    case TOKEN_TRUE: emitByte(OP_TRUE); break;
-    case TOKEN_NIL: emitByte(OP_NIL); break;
+  switch (parser->previous.type) {
+    case TOKEN_FALSE: emitOp(parser, OP_FALSE); break;
+    case TOKEN_TRUE: emitOp(parser, OP_TRUE); break;
+    case TOKEN_NIL: emitOp(parser, OP_NIL); break;
     default:
       break;
   }
 }
 
 // 字符串
-static void string(bool canAssign) {
-  // 将去掉引号的字符串copy并组成ObjString，然后组成Value类型写入内存
-  emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
-    parser.previous.length - 2)));
+static void string(Parser* parser, bool canAssign) {
+  // 将去掉引号的字符串copy并组成ObjString(很短的字符串直接保存在Value中)，然后写入内存
+  emitConstant(parser, copyStringValue(parser->previous.start + 1,
+    parser->previous.length - 2));
 }
 
 // 一元表达式
-static void unary(bool canAssign) {
-  TokenType operatorType = parser.previous.type;
+static void unary(Parser* parser, bool canAssign) {
+  TokenType operatorType = parser->previous.type;
   // 因为是右结合的，优先写入同级或更高优先级的表达式
-  parsePrecedence(PREC_UNARY);
+  parsePrecedence(parser, PREC_UNARY);
 
   // 然后写入一元表达式操作符
   switch (operatorType) {
-    case TOKEN_BANG: emitByte(OP_NOT); break;
-    case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_BANG: emitOp(parser, OP_NOT); break;
+    case TOKEN_MINUS: emitOp(parser, OP_NEGATE); break;
     default:
       return;
   }
 }
 
 // 二元表达式
-static void binary(bool canAssign) {
-  TokenType operatorType = parser.previous.type;
+static void binary(Parser* parser, bool canAssign) {
+  TokenType operatorType = parser->previous.type;
 
   ParseRule* rule = getRule(operatorType);
   // 写入右边表达式
   // 因为是左结合的，所以只能优先写入优先级更高的，不然 a - b - c 就会被解析成 a - (b - c)
-  parsePrecedence((Precedence)(rule->precedence + 1));
+  parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
   // 写入操作符，我们的字节码是基于栈的，因此先写操作数，再写入操作符
   switch (operatorType) {
-    case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-    case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-    case TOKEN_GREATER:       emitByte(OP_GREATER); break;
+    case TOKEN_BANG_EQUAL:    emitOp(parser, OP_EQUAL); emitOp(parser, OP_NOT); break;
+    case TOKEN_EQUAL_EQUAL:   emitOp(parser, OP_EQUAL); break;
+    case TOKEN_GREATER:       emitOp(parser, OP_GREATER); break;
     // 这里并没有GREATER_EQUAL指令，而是使用 !(a < b) 来代替 a >= b
-    case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:          emitByte(OP_LESS); break;
-    case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-    case TOKEN_PLUS:          emitByte(OP_ADD); break;
-    case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-    case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-    case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+    case TOKEN_GREATER_EQUAL: emitOp(parser, OP_LESS); emitOp(parser, OP_NOT); break;
+    case TOKEN_LESS:          emitOp(parser, OP_LESS); break;
+    case TOKEN_LESS_EQUAL:    emitOp(parser, OP_GREATER); emitOp(parser, OP_NOT); break;
+    case TOKEN_PLUS:          emitOp(parser, OP_ADD); break;
+    case TOKEN_MINUS:         emitOp(parser, OP_SUBTRACT); break;
+    case TOKEN_STAR:          emitOp(parser, OP_MULTIPLY); break;
+    case TOKEN_SLASH:         emitOp(parser, OP_DIVIDE); break;
     default:
       return;
   }
 }
 
 // logic_and  → equality ( "and" equality )* ;
-static void and_(bool canAssign) {
-  int endJump = emitJump(OP_JUMP_IF_FALSE);
+static void and_(Parser* parser, bool canAssign) {
+  int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
   // 在这个函数执行的时候，&& 左边的表达式已经被执行了
   // 如果左边表达式为真，这里的OP_POP指令会将左边的表达式产生的值丢弃，并将右边的值作为整个and表达式的值存在stack中
-  emitByte(OP_POP);
-  parsePrecedence(PREC_AND);
+  emitOp(parser, OP_POP);
+  parsePrecedence(parser, PREC_AND);
 
   // 如果左边的表达式为假, OP_POP指令以及后面的表达式产生的指令都会被跳过，
   // 则左边的表达式值作为整个and表达式的值
-  patchJump(endJump);
+  patchJump(parser, endJump);
 }
 
 // logic_or   → logic_and ( "or" logic_and )* ;
-static void or_(bool canAssign) {
-  int elseJump = emitJump(OP_JUMP_IF_FALSE);
+static void or_(Parser* parser, bool canAssign) {
+  int elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
-  int endJump = emitJump(OP_JUMP);
+  int endJump = emitJump(parser, OP_JUMP);
 
   // 如果左边表达式为假，OP_JUMP指令会被跳过，则OP_POP指令和右边表达式正常执行
   // 左边的表达式的值被OP_POP丢弃，右边返回的值作为整个表达式的值
-  patchJump(elseJump);
-  emitByte(OP_POP);
+  patchJump(parser, elseJump);
+  emitOp(parser, OP_POP);
 
   // 正常执行右边表达式
-  parsePrecedence(PREC_OR);
+  parsePrecedence(parser, PREC_OR);
   // 如果左边表达式为真，OP_JUMP指令正常执行，OP_POP和右边表达式被丢弃
   // 左边的表达式返回的值作为整个表达式的值
-  patchJump(endJump);
+  patchJump(parser, endJump);
 }
 
-static uint8_t argumentList() {
+static uint8_t argumentList(Parser* parser) {
   uint8_t argCount = 0;
 
   // 执行参数arguments
-  if (!check(TOKEN_RIGHT_PAREN)) {
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
     do {
-      expression();
+      expression(parser);
       if (argCount == 255) {
-        error("Cannot have more than 255 arguments.");
+        error(parser, "Cannot have more than 255 arguments.");
       }
       argCount++;
-    } while (match(TOKEN_COMMA));
+    } while (match(parser, TOKEN_COMMA));
   }
 
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
   return argCount;
 }
 
-static void call(bool canAssign) {
-  uint8_t argCount = argumentList();
-  emitBytes(OP_CALL, argCount);
+static void call(Parser* parser, bool canAssign) {
+  uint8_t argCount = argumentList(parser);
+  emitBytes(parser, OP_CALL, argCount);
 }
 
 // 属性读取
-static void dot(bool canAssign) {
-  consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-  uint8_t name = identifierConstant(&parser.previous);
+static void dot(Parser* parser, bool canAssign) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+  int name = identifierConstant(parser, &parser->previous);
 
   // canAssign 可以阻止这种非法表达式的解析: `a + b.c = 3`
-  if (canAssign && match(TOKEN_EQUAL)) {
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
     // 解析等号右边表达式
-    expression();
+    expression(parser);
     // 属性赋值
-    emitBytes(OP_SET_PROPERTY, name);
-  } else if (match(TOKEN_LEFT_PAREN)) {
+    emitArg(parser, OP_SET_PROPERTY, name);
+  } else if (match(parser, TOKEN_LEFT_PAREN)) {
     /* 
       传统的调用分为两步：1. OP_GET_PROPERTY从实例中取出方法 2. 用OP_CALL调用该方法
       这里做一个字节码常用的优化策略：将两个指令合为一个指令OP_INVOKE.
       在大规模的调用下：可以提升7-8倍的速度
     */
-    uint8_t argCount = argumentList();
-    emitBytes(OP_INVOKE, name);
-    emitByte(argCount);
+    uint8_t argCount = argumentList(parser);
+    emitArg(parser, OP_INVOKE, name);
+    emitByte(parser, argCount);
   } else {
     // 属性读取
-    emitBytes(OP_GET_PROPERTY, name);
+    emitArg(parser, OP_GET_PROPERTY, name);
   }
 }
 
 // preserve `this` for c++
-static void this_(bool canAssign) {
-  if (currentClass == NULL) {
-    error("Cannot use 'this' outside of a class.");
+static void this_(Parser* parser, bool canAssign) {
+  if (parser->currentClass == NULL) {
+    error(parser, "Cannot use 'this' outside of a class.");
     return;
   }
-  variable(false);
+  variable(parser, false);
 }
 
 // 根据字符串手动合成一个Token
@@ -610,36 +907,37 @@ static Token syntheticToken(const char* text) {
   Token token;                                 
   token.start = text;                          
   token.length = (int)strlen(text);            
+  token.string = copyString(token.start, token.length);
   return token;                                
 }
 
 // preserve `super` for c++
-static void super_(bool canAssign) {
-  if (currentClass == NULL) {                                  
-    error("Cannot use 'super' outside of a class.");           
-  } else if (!currentClass->hasSuperclass) {                   
-    error("Cannot use 'super' in a class with no superclass.");
+static void super_(Parser* parser, bool canAssign) {
+  if (parser->currentClass == NULL) {                                  
+    error(parser, "Cannot use 'super' outside of a class.");           
+  } else if (!parser->currentClass->hasSuperclass) {                   
+    error(parser, "Cannot use 'super' in a class with no superclass.");
   }
 
-  consume(TOKEN_DOT, "Expect '.' after 'super'.");
-  consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
+  consume(parser, TOKEN_DOT, "Expect '.' after 'super'.");
+  consume(parser, TOKEN_IDENTIFIER, "Expect superclass method name.");
   // 方法名
-  uint8_t name = identifierConstant(&parser.previous);
+  int name = identifierConstant(parser, &parser->previous);
 
   // 这里每次执行super指令之前，都要去生成两个OP_GET指令，
   // 来将this(子类实例), super(父类)变量依次放入栈中以便OP_GET_SUPER使用
   // 有了super才能找到对应的执行方法, 而该方法必须绑定在this上执行。
-  namedVariable(syntheticToken("this"), false);
+  namedVariable(parser, syntheticToken("this"), false);
 
   // 这里用一个常用的优化策略，将两个连续的指令合成一个指令OP_SUPER_INVOKE
-  if (match(TOKEN_LEFT_PAREN)) {
-    uint8_t argCount = argumentList();
-    namedVariable(syntheticToken("super"), false);
-    emitBytes(OP_SUPER_INVOKE, name);
-    emitByte(argCount);
+  if (match(parser, TOKEN_LEFT_PAREN)) {
+    uint8_t argCount = argumentList(parser);
+    namedVariable(parser, syntheticToken("super"), false);
+    emitArg(parser, OP_SUPER_INVOKE, name);
+    emitByte(parser, argCount);
   } else {
-    namedVariable(syntheticToken("super"), false);
-    emitBytes(OP_GET_SUPER, name);
+    namedVariable(parser, syntheticToken("super"), false);
+    emitArg(parser, OP_GET_SUPER, name);
   }
 }
 
@@ -723,6 +1021,7 @@ ParseRule rules[] = {
   { NULL,     NULL,    PREC_NONE },       // TOKEN_FOR
   { NULL,     NULL,    PREC_NONE },       // TOKEN_FUN
   { NULL,     NULL,    PREC_NONE },       // TOKEN_IF
+  { NULL,     NULL,    PREC_NONE },       // TOKEN_IMPORT
 //> Types of Values table-nil
   { literal,  NULL,    PREC_NONE },       // TOKEN_NIL
 //< Types of Values table-nil
@@ -758,20 +1057,21 @@ ParseRule rules[] = {
   { NULL,     NULL,    PREC_NONE },       // TOKEN_EOF
 };
 
-static void synchronize() {
+static void synchronize(Parser* parser) {
   // 重置panic位
-  parser.panicMode = false;
+  parser->panicMode = false;
 
   // 当遇见下述token的时候，我们认为即将开始一个新的语句，在这之前，丢弃所遇见的token
-  while (parser.current.type != TOKEN_EOF) {
-    if (parser.previous.type == TOKEN_SEMICOLON) return;
+  while (parser->current.type != TOKEN_EOF) {
+    if (parser->previous.type == TOKEN_SEMICOLON) return;
 
-    switch (parser.current.type) {
+    switch (parser->current.type) {
       case TOKEN_CLASS:
       case TOKEN_FUN:
       case TOKEN_VAR:
       case TOKEN_FOR:
       case TOKEN_IF:
+      case TOKEN_IMPORT:
       case TOKEN_WHILE:
       case TOKEN_PRINT:
       case TOKEN_RETURN:
@@ -779,242 +1079,389 @@ static void synchronize() {
       default: break;
     }
 
-    advance();
+    advance(parser);
   }
 }
 
-static uint8_t identifierConstant(Token* name) {
+static int identifierConstant(Parser* parser, Token* name) {
   // 将变量名字符串对象写入constants中
-  return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+  // 出现语法错误时name可能不是标识符，没有intern过的字符串
+  ObjString* string = name->string != NULL ? name->string : copyString(name->start, name->length);
+  return makeConstant(parser, OBJ_VAL(string));
 }
 
 // 将变量名加入到locals数组
-static void addLocal(Token name) {
-  if (current->localCount == UINT8_COUNT) {
-    error("Too many local variables in function.");
+static void addLocal(Parser* parser, Token name) {
+  if (parser->compiler->localCount == LOCALS_MAX) {
+    error(parser, "Too many local variables in function.");
     return;
   }
 
-  Local* local = &current->locals[current->localCount++];
+  if (parser->compiler->localCapacity < parser->compiler->localCount + 1) {
+    int oldCapacity = parser->compiler->localCapacity;
+    parser->compiler->localCapacity = GROW_CAPACITY(oldCapacity);
+    parser->compiler->locals = GROW_ARRAY(parser->compiler->locals, Local,
+        oldCapacity, parser->compiler->localCapacity);
+  }
+
+  Local* local = &parser->compiler->locals[parser->compiler->localCount++];
+  if (parser->compiler->localCount > parser->compiler->function->maxSlots) {
+    parser->compiler->function->maxSlots = parser->compiler->localCount;
+  }
   local->name = name;
   // 此时变量还未完成初始化，将其设为-1, 如果在初始化表达式中引用了该变量，则报错
   // eg: var a = a;
   local->depth = -1;
   // 默认不为闭包变量，就是普通变量
   local->isCaptured = false;
+  local->capture = CAPTURE_UNKNOWN;
 }
 
 static bool isIdentifierEqual(Token* a, Token* b) {
+  // 标识符在扫描时已经intern，相同的标识符必然是同一个字符串对象
+  if (a->string != NULL && b->string != NULL) return a->string == b->string;
+  // isAssignedAfterDeclaration中单独扫描的token没有intern，只能比较字符
   if (a->length != b->length) return false;
   return memcmp(a->start, b->start, a->length) == 0;
 }
 
 // 声明一个局部变量
-static void declareVariable() {
+static void declareVariable(Parser* parser) {
   // 如果是全局环境，自动返回
-  if (current->scopeDepth == 0) return;
+  if (parser->compiler->scopeDepth == 0) return;
 
-  Token* name = &parser.previous;
+  Token* name = &parser->previous;
 
   // 检测当前作用域内是否存在同名变量
-  for (int i = current->localCount - 1; i >= 0; i--) {
-    Local* local = &current->locals[i];
-    if (local->depth != -1 && local->depth < current->scopeDepth) {
+  for (int i = parser->compiler->localCount - 1; i >= 0; i--) {
+    Local* local = &parser->compiler->locals[i];
+    if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) {
       break;
     }
 
     if (isIdentifierEqual(name, &local->name)) {
-      error("Variable with this name already declared in this scope.");
+      error(parser, "Variable with this name already declared in this scope.");
     }
   }
 
-  addLocal(*name);
+  addLocal(parser, *name);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
-  consume(TOKEN_IDENTIFIER, errorMessage);
+static int parseVariable(Parser* parser, const char* errorMessage) {
+  consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
   // 局部变量
-  if (current->scopeDepth > 0) {
-    declareVariable();
+  if (parser->compiler->scopeDepth > 0) {
+    declareVariable(parser);
     return 0;
   }
 
   // 全局变量
-  return identifierConstant(&parser.previous);
+  return identifierConstant(parser, &parser->previous);
 }
 
-static void markInitialized() {
+static void markInitialized(Parser* parser) {
   // 如果是全局作用域不需要判断
-  if (current->scopeDepth == 0) return;
-  current->locals[current->localCount - 1].depth =
-      current->scopeDepth;
+  if (parser->compiler->scopeDepth == 0) return;
+  parser->compiler->locals[parser->compiler->localCount - 1].depth =
+      parser->compiler->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(Parser* parser, int global) {
   // 局部变量
   // NOTE: 在声明局部变量的时候，并不需要像全局变量一样
   // 反之，我们并不产生任何指令，而是让expression产生的值暂时就放置在stack中
   // 这样变量值在stack中的位置 = 变量名在locals中的位置
-  if (current->scopeDepth > 0) {
+  if (parser->compiler->scopeDepth > 0) {
     // 完成变量的初始化
-    markInitialized();
+    markInitialized(parser);
     return;
   }
 
   // 全局变量：runtime的时候用一个OP_DEFINE_GLOBAL指令来将expression产生的值
   // 保存在table中，然后pop掉stack中的值
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitArg(parser, OP_DEFINE_GLOBAL, global);
 }
 
 // varDecl → "var" IDENTIFIER ( "=" expression )? ";" ;
-static void varDeclaration() {
+static void varDeclaration(Parser* parser) {
   // 解析变量名，并返回其在instants中存储的index位置
-  uint8_t global = parseVariable("Expect variable name");
+  int global = parseVariable(parser, "Expect variable name");
 
-  if (match(TOKEN_EQUAL)) {
-    expression();
+  if (match(parser, TOKEN_EQUAL)) {
+    expression(parser);
   } else {
     // 默认初始化为nil值
-    emitByte(OP_NIL);
+    emitOp(parser, OP_NIL);
   }
 
-  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
   // 写入定义全局变量指令和该指令的操作数：global
-  defineVariable(global);
+  defineVariable(parser, global);
 }
 
-static void beginScope() {
-  current->scopeDepth++;
+static void beginScope(Parser* parser) {
+  parser->compiler->scopeDepth++;
 }
 
-static void endScope() {
-  current->scopeDepth--;
+static void endScope(Parser* parser) {
+  parser->compiler->scopeDepth--;
 
   // 从当前作用域退出时，删除该作用域的中的变量，同时也就是去除stack中的临时变量
-  while (current->localCount > 0 &&
-         current->locals[current->localCount - 1].depth > current->scopeDepth) {
+  while (parser->compiler->localCount > 0 &&
+         parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth) {
     // 对于闭包变量，需要将其持久化之后，才能删除，以便闭包函数的持久访问
-    if (current->locals[current->localCount - 1].isCaptured) {
-      emitByte(OP_CLOSE_UPVALUE);
+    if (parser->compiler->locals[parser->compiler->localCount - 1].isCaptured) {
+      emitOp(parser, OP_CLOSE_UPVALUE);
     } else {
       // 对于普通变量，我们直接删除
-      emitByte(OP_POP);
+      emitOp(parser, OP_POP);
     }
-    current->localCount--;
+    parser->compiler->localCount--;
   }
 }
 
 // blockStmt → "{" declaration* "}" ;
-static void block() {
-  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-    declaration();
+static void block(Parser* parser) {
+  while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+    declaration(parser);
   }
 
-  consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(FunctionType type) {
-  // 为每个函数初始化一个独立的compiler, 这样每个函数都拥有其独立的chunk和locals
-  Compiler compiler;
-  initCompiler(&compiler, type);
-  beginScope();
+// 写入一个闭包变量的描述
+// 第一个字节为标志位：UPVALUE_LOCAL表示引用的是局部变量，UPVALUE_WIDE表示index占用两个字节
+static void emitUpvalue(Parser* parser, Upvalue* upvalue) {
+  uint8_t flags = upvalue->isLocal ? UPVALUE_LOCAL : 0;
+  if (upvalue->index > UINT8_MAX) flags |= UPVALUE_WIDE;
+
+  emitByte(parser, flags);
+  if (flags & UPVALUE_WIDE) emitByte(parser, upvalue->index >> 8);
+  emitByte(parser, upvalue->index & 0xff);
+}
+
+// 编译参数和函数体，函数名为parser.previous
+static ObjFunction* functionBody(Parser* parser, Compiler* compiler, FunctionType type) {
+  initCompiler(parser, compiler, type);
+  beginScope(parser);
 
   // 参数
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
-  if (!check(TOKEN_RIGHT_PAREN)) {                                    
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {                                    
     do {                                                              
-      current->function->arity++;
-      if (current->function->arity > 255) {
-        errorAtCurrent("Cannot have more than 255 parameters.");
+      parser->compiler->function->arity++;
+      if (parser->compiler->function->arity > 255) {
+        errorAtCurrent(parser, "Cannot have more than 255 parameters.");
       }
       // 初始化每个参数为函数的局部变量
-      uint8_t paramConstant = parseVariable("Expect parameter name.");
-      defineVariable(paramConstant);
-    } while (match(TOKEN_COMMA));
+      int paramConstant = parseVariable(parser, "Expect parameter name.");
+      defineVariable(parser, paramConstant);
+    } while (match(parser, TOKEN_COMMA));
   }
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
 
   // 函数体
-  consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-  block();
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+  block(parser);
   
-  ObjFunction* function = endCompiler();
+  return endCompiler(parser);
+}
+
+static void function(Parser* parser, FunctionType type) {
+  // 为每个函数初始化一个独立的compiler, 这样每个函数都拥有其独立的chunk和locals
+  Compiler compiler;
+  ObjFunction* function = functionBody(parser, &compiler, type);
   // 定义一个闭包，为了统一处理，默认将所有函数都视为闭包处理（TODO: 待优化）
-  emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+  emitArg(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function)));
 
-  // OP_CLOSURE是一个不定长指令，后面每一对字节都代表一个当前函数所持有的可引用的闭包变量
+  // OP_CLOSURE是一个不定长指令，后面的每一组字节都代表一个当前函数所持有的可引用的闭包变量
+  // 先是所有的upvalues，然后是所有按值捕获的captures
   for (int i = 0; i < function->upvalueCount; i++) {
-    emitBytes(compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+    emitUpvalue(parser, &compiler.upvalues[i]);
+  }
+  for (int i = 0; i < function->captureCount; i++) {
+    emitUpvalue(parser, &compiler.captures[i]);
+  }
+}
+
+// 延迟编译的函数：只解析参数得到arity，函数体通过括号匹配直接跳过，只记录它在源码中的位置
+// 只有全局函数可以延迟编译，它们不会引用任何局部变量，因此之后可以脱离当前的编译器单独编译
+static void lazyFunction(Parser* parser) {
+  ObjFunction* function = newFunction();
+  function->name = copyString(parser->previous.start, parser->previous.length);
+  function->lazySource = parser->current.start;
+  function->lazyLine = parser->current.line;
+
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
+    do {
+      function->arity++;
+      if (function->arity > 255) {
+        errorAtCurrent(parser, "Cannot have more than 255 parameters.");
+      }
+      consume(parser, TOKEN_IDENTIFIER, "Expect parameter name.");
+    } while (match(parser, TOKEN_COMMA));
+  }
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+  for (int depth = 1; depth > 0; advance(parser)) {
+    if (check(parser, TOKEN_EOF)) {
+      errorAtCurrent(parser, "Expect '}' after block.");
+      break;
+    }
+    if (check(parser, TOKEN_LEFT_BRACE)) depth++;
+    if (check(parser, TOKEN_RIGHT_BRACE)) depth--;
   }
+
+  // 没有upvalue，OP_CLOSURE后面不需要跟任何闭包变量的信息
+  int constant = makeConstant(parser, OBJ_VAL(function));
+  emitArg(parser, OP_CLOSURE, constant);
 }
 
 // func → "fun" IDENTIFIER? "(" parameters? ")" block ;
-static void funDeclaration() {
-  uint8_t global = parseVariable("Expect function name.");
+static void funDeclaration(Parser* parser) {
+  int global = parseVariable(parser, "Expect function name.");
   // 函数可以在声明初始化之前在函数体中使用（递归），因此直接完成初始化
-  markInitialized();
+  markInitialized(parser);
   // 解析参数和函数体
-  function(TYPE_FUNCTION);
+  if (parser->lazy && parser->compiler->type == TYPE_SCRIPT && parser->compiler->scopeDepth == 0) {
+    lazyFunction(parser);
+  } else {
+    function(parser, TYPE_FUNCTION);
+  }
   // 定义该函数变量
-  defineVariable(global);
+  defineVariable(parser, global);
 }
 
 // function → IDENTIFIER "(" parameters? ")" block ;
-static void method() {
-  consume(TOKEN_IDENTIFIER, "Expect method name");
-  uint8_t constant = identifierConstant(&parser.previous);
+static void method(Parser* parser) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect method name");
+  int constant = identifierConstant(parser, &parser->previous);
 
   FunctionType type = TYPE_METHOD;
 
   // init函数特殊类型
-  if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
+  if (parser->previous.length == 4 && memcmp(parser->previous.start, "init", 4) == 0) {
     type = TYPE_INITIALIZER;
   }
 
-  function(type);
+  function(parser, type);
 
   // 将这个方法的名字的constantIndex作为操作数，方便vm读取
-  emitBytes(OP_METHOD, constant);
+  emitArg(parser, OP_METHOD, constant);
+}
+
+// 模块的路径去掉目录和扩展名作为默认的变量名：import "lib/math.lox"; -> math
+static Token moduleName(Parser* parser, Token* path) {
+  // 去掉两边的引号
+  const char* start = path->start + 1;
+  const char* end = path->start + path->length - 1;
+  for (const char* c = start; c < end; c++) {
+    if (*c == '/') start = c + 1;
+  }
+  for (const char* c = start; c < end; c++) {
+    if (*c == '.') {
+      end = c;
+      break;
+    }
+  }
+
+  Token name;
+  name.type = TOKEN_IDENTIFIER;
+  name.start = start;
+  name.length = (int)(end - start);
+  name.line = path->line;
+  name.string = copyString(name.start, name.length);
+
+  // 文件名必须是一个合法的标识符，否则需要用as指定变量名
+  bool valid = name.length > 0 && !(*start >= '0' && *start <= '9');
+  for (const char* c = start; c < end; c++) {
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+          (*c >= '0' && *c <= '9') || *c == '_')) {
+      valid = false;
+    }
+  }
+  if (!valid) error(parser, "Module name is not an identifier, use 'as' to name it.");
+  return name;
+}
+
+// importDecl → "import" STRING ( "as" IDENTIFIER )? ";" ;
+// 执行模块文件(每个文件只会执行一次)，然后将模块对象赋值给一个变量，通过 模块名.变量名 访问模块的全局变量
+static void importDeclaration(Parser* parser) {
+  consume(parser, TOKEN_STRING, "Expect module path after 'import'.");
+  Token path = parser->previous;
+  int pathConstant = makeConstant(parser, OBJ_VAL(copyString(path.start + 1, path.length - 2)));
+
+  // as不是关键字，只在这里作为上下文关键字使用
+  Token name;
+  if (check(parser, TOKEN_IDENTIFIER) && parser->current.length == 2 &&
+      memcmp(parser->current.start, "as", 2) == 0) {
+    advance(parser);
+    consume(parser, TOKEN_IDENTIFIER, "Expect module name after 'as'.");
+    name = parser->previous;
+  } else {
+    name = moduleName(parser, &path);
+  }
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after import.");
+
+  // OP_IMPORT执行完之后栈顶为[module, 模块顶级函数的返回值]，丢弃返回值，模块对象作为变量的值
+  emitArg(parser, OP_IMPORT, pathConstant);
+  emitOp(parser, OP_POP);
+
+  if (parser->compiler->scopeDepth > 0) {
+    Token previous = parser->previous;
+    parser->previous = name;
+    declareVariable(parser);
+    parser->previous = previous;
+    // 变量名可能来自字符串中的路径，无法从变量名开始扫描源码判断之后是否会被赋值，按引用捕获
+    parser->compiler->locals[parser->compiler->localCount - 1].capture = CAPTURE_BY_REFERENCE;
+    defineVariable(parser, 0);
+  } else {
+    defineVariable(parser, identifierConstant(parser, &name));
+  }
 }
 
 // classDecl → "class" IDENTIFIER ( "<" IDENTIFIER )? "{" "static"? function* "}" ;
-static void classDeclaration() {
-  consume(TOKEN_IDENTIFIER, "Expect class name after class declaration.");
-  Token className = parser.previous;
+static void classDeclaration(Parser* parser) {
+  consume(parser, TOKEN_IDENTIFIER, "Expect class name after class declaration.");
+  Token className = parser->previous;
 
-  uint8_t nameConstant = identifierConstant(&parser.previous);
-  declareVariable();
+  int nameConstant = identifierConstant(parser, &parser->previous);
+  declareVariable(parser);
 
-  emitBytes(OP_CLASS, nameConstant);
-  defineVariable(nameConstant);
+  emitArg(parser, OP_CLASS, nameConstant);
+  defineVariable(parser, nameConstant);
 
   // 修改当前的currentClass
   ClassCompiler classCompiler;
-  classCompiler.name = parser.previous;
+  classCompiler.name = parser->previous;
   classCompiler.hasSuperclass = false;
-  classCompiler.enclosing = currentClass;
-  currentClass = &classCompiler;
+  classCompiler.enclosing = parser->currentClass;
+  parser->currentClass = &classCompiler;
 
-  if (match(TOKEN_LESS)) {
-    consume(TOKEN_IDENTIFIER, "Expect superclass name.");
+  if (match(parser, TOKEN_LESS)) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect superclass name.");
     // 生成获取父类的指令, 将其放入栈中待OP_INHERIT使用
-    variable(false);
+    variable(parser, false);
 
     // 类不能继承自身
-    if (isIdentifierEqual(&className, &parser.previous)) {
-      error("A class cannot inherit from itself.");      
+    if (isIdentifierEqual(&className, &parser->previous)) {
+      error(parser, "A class cannot inherit from itself.");      
     }
 
     // 新建一个作用域，以免两个类的super冲突
-    beginScope();
+    beginScope(parser);
     // 将super变量加入变量locals数组中
-    addLocal(syntheticToken("super"));
-    defineVariable(0);
+    addLocal(parser, syntheticToken("super"));
+    // super是一个合成的变量，不会被赋值
+    parser->compiler->locals[parser->compiler->localCount - 1].capture = CAPTURE_BY_VALUE;
+    defineVariable(parser, 0);
 
     // 生成获取父类的指令, 将其放入栈中待OP_INHERIT使用
-    namedVariable(className, false);
-    emitByte(OP_INHERIT);
+    namedVariable(parser, className, false);
+    emitOp(parser, OP_INHERIT);
 
     classCompiler.hasSuperclass = true;
   }
@@ -1022,93 +1469,95 @@ static void classDeclaration() {
   // 由于defineVariable会将stack中的class pop出来放入global table中，
   // 但是由于以后的method指令需要知道它的方法绑定在哪一个类中
   // 因此需要将classname重新放入栈中，以便OP_METHOD指令查找
-  namedVariable(className, false);
+  namedVariable(parser, className, false);
 
-  consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
 
   // class内容
-  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-    method();
+  while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+    method(parser);
   }
 
-  consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
 
   // 重新将class中栈中删除
-  emitByte(OP_POP);
+  emitOp(parser, OP_POP);
 
   if (classCompiler.hasSuperclass) {
-    endScope();                          
+    endScope(parser);                          
   }
 
   // 该类编译完之后，当前类自动变为上一级
-  currentClass = currentClass->enclosing;
+  parser->currentClass = parser->currentClass->enclosing;
 }
 
 /* 
-  declaration  → classDecl | funDecl | varDecl | statement ;
+  declaration  → classDecl | funDecl | varDecl | importDecl | statement ;
 */
-static void declaration() {
-  if (match(TOKEN_VAR)) {
-    varDeclaration();
-  } else if (match(TOKEN_CLASS)) {
-    classDeclaration();
-  } else if (match(TOKEN_FUN)) {
-    funDeclaration();
+static void declaration(Parser* parser) {
+  if (match(parser, TOKEN_VAR)) {
+    varDeclaration(parser);
+  } else if (match(parser, TOKEN_CLASS)) {
+    classDeclaration(parser);
+  } else if (match(parser, TOKEN_FUN)) {
+    funDeclaration(parser);
+  } else if (match(parser, TOKEN_IMPORT)) {
+    importDeclaration(parser);
   } else {
-    statement();
+    statement(parser);
   }
   // 解析某个语句发生错误的时候，进行同步操作：即丢弃当前语句的解析工作，跳到下个语句
   // 这样做可以让我们的编译器同时的发现更多的错误，而不是在第一个错误的时候就退出
-  if (parser.panicMode) synchronize();
+  if (parser->panicMode) synchronize(parser);
 }
 
 // printStmt → "print" expression ";" ;
-static void printStatement() {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+static void printStatement(Parser* parser) {
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
   // 写入print指令
-  emitByte(OP_PRINT);
+  emitOp(parser, OP_PRINT);
 }
 
 // exprStmt  → expression ";" ;
-static void expressionStatement() {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+static void expressionStatement(Parser* parser) {
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
   // 语义上来说，表达式语句会产生一个值，并且直接被丢弃
-  emitByte(OP_POP);
+  emitOp(parser, OP_POP);
 }
 
 // ifStmt → "if" "(" expression ")" statement ( "else" statement )? ;
-static void ifStatement() {
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+static void ifStatement(Parser* parser) {
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
   // 跳过then的指令
-  int thenJump = emitJump(OP_JUMP_IF_FALSE);
+  int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
   // 在执行expression之后，条件表达式产生的值会留在stack中，这里需要将其处理掉
   // 如果条件为真，我们在这里清理
   // Note: 每个语句都必须是对栈零副作用的，也就是说，每个语句执行完之后，stack的长度应该和执行该语句之前一样长
-  emitByte(OP_POP);
+  emitOp(parser, OP_POP);
 
-  statement();
+  statement(parser);
 
   // 写入跳过else的指令
-  int elseJump = emitJump(OP_JUMP);
+  int elseJump = emitJump(parser, OP_JUMP);
 
   // Note: 这里计算的字节数包含了上面的OP_JUMP和OP_POP
   // 也就是说如果条件为假，会自动跳过OP_JUMP和OP_POP指令的执行，也就是说else语句会正常执行。
-  patchJump(thenJump);
+  patchJump(parser, thenJump);
 
   // 如果条件为假，前面的OP_POP指令会被跳过，我们在这里清理
-  emitByte(OP_POP);
+  emitOp(parser, OP_POP);
 
   // 匹配else语句
-  if (match(TOKEN_ELSE)) statement();
+  if (match(parser, TOKEN_ELSE)) statement(parser);
   // 为OP_JUMP指令打补丁
   // 如果上面的条件为真，则这个OP_JUMP指令会被执行，则OP_POP和else语句内的指令就被跳过了
-  patchJump(elseJump);
+  patchJump(parser, elseJump);
 }
 
 /* 
@@ -1116,135 +1565,135 @@ static void ifStatement() {
                       expression? ";"
                       expression? ")" statement ;
  */
-static void forStatement() {
+static void forStatement(Parser* parser) {
   // 新建一个scope，保持在for初始表达式中初始的变量仅仅在for循环内部使用
-  beginScope();
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  beginScope(parser);
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
 
   // Initializer clause: ( varDecl | exprStmt | ";" )
-  if (match(TOKEN_SEMICOLON)) {
+  if (match(parser, TOKEN_SEMICOLON)) {
     // No initializer.
-  } else if (match(TOKEN_VAR)) {
-    varDeclaration();
+  } else if (match(parser, TOKEN_VAR)) {
+    varDeclaration(parser);
   } else {
-    expressionStatement();
+    expressionStatement(parser);
   }
 
   // 条件表达式的开始位置
-  int loopStart = currentChunk()->count;
+  int loopStart = currentChunk(parser)->count;
 
   // Condition clause: expression? ";"
   int exitJump = -1;
-  if (!match(TOKEN_SEMICOLON)) {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+  if (!match(parser, TOKEN_SEMICOLON)) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
     // 如果条件为假，需要跳出整个循环语句
-    exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP); // 去除该条件表达式的stack effect
+    exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitOp(parser, OP_POP); // 去除该条件表达式的stack effect
   }
   
   // Increment clause: expression? ")"
-  if (!match(TOKEN_RIGHT_PAREN)) {
+  if (!match(parser, TOKEN_RIGHT_PAREN)) {
     // 如果条件为真，需要跳过增量语句，直接执行循环体
-    int bodyJump = emitJump(OP_JUMP);
+    int bodyJump = emitJump(parser, OP_JUMP);
 
     // 增量表达式的开始位置
-    int incrementStart = currentChunk()->count;
+    int incrementStart = currentChunk(parser)->count;
 
-    expression();
-    emitByte(OP_POP);
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    expression(parser);
+    emitOp(parser, OP_POP);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
     // 如果执行了增量表达式，需要跳回到条件表达式开始前，开始新一轮循环
-    emitLoop(loopStart);
+    emitLoop(parser, loopStart);
     loopStart = incrementStart;
 
-    patchJump(bodyJump);
+    patchJump(parser, bodyJump);
   }
 
-  statement();
+  statement(parser);
   // 当函数体执行完毕之后
   // 增量表达式存在：需要跳回到增量表达式开始前
   // 增量表达式不存在：需要跳回到条件表达式开始前
-  emitLoop(loopStart);
+  emitLoop(parser, loopStart);
 
   if (exitJump != -1) {
-    patchJump(exitJump);
+    patchJump(parser, exitJump);
     // 如果上面的OP_POP被跳过，则需要一个OP_POP来清除condition stack effect
-    emitByte(OP_POP);
+    emitOp(parser, OP_POP);
   }
 
-  endScope();
+  endScope(parser);
 }
 
 // whileStmt → "while" "(" expression ")" statement ;
-static void whileStatement() {
+static void whileStatement(Parser* parser) {
   // 记录循环开始的位置
-  int loopStart = currentChunk()->count;
+  int loopStart = currentChunk(parser)->count;
 
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
   // 如果条件为false,则跳过while的body语句
-  int exitJump = emitJump(OP_JUMP_IF_FALSE);
-  emitByte(OP_POP);
-  statement();
+  int exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+  emitOp(parser, OP_POP);
+  statement(parser);
 
   // 在while body执行完毕之后，需要用一个OP_LOOP重新跳回到条件指令执行之前，重新执行一遍整个while语句
-  emitLoop(loopStart);
+  emitLoop(parser, loopStart);
 
   // 一旦当某个时候条件为false, 则整个Body指令和上面的OP_LOOP指令会被跳过，则跳出了while循环，程序正常向下执行
-  patchJump(exitJump);
+  patchJump(parser, exitJump);
   // 条件为false的时候跳出循环，上面的OP_POP指令也会被跳过，需要在这里清理条件指令产生的stack effect
-  emitByte(OP_POP);
+  emitOp(parser, OP_POP);
 }
 
-static void returnStatement() {
-  if (current->type == TYPE_SCRIPT) {
-    error("Iegal return statement");
+static void returnStatement(Parser* parser) {
+  if (parser->compiler->type == TYPE_SCRIPT) {
+    error(parser, "Iegal return statement");
   }
 
   // 无返回值
-  if (match(TOKEN_SEMICOLON)) {
-    emitReturn();
+  if (match(parser, TOKEN_SEMICOLON)) {
+    emitReturn(parser);
   } else {
     // 限制在init函数中使用return语句
-    if (current->type == TYPE_INITIALIZER) {
-      error("Iegal return statement from an initializer.");
+    if (parser->compiler->type == TYPE_INITIALIZER) {
+      error(parser, "Iegal return statement from an initializer.");
     }
 
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after return statement.");
-    emitByte(OP_RETURN);
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after return statement.");
+    emitOp(parser, OP_RETURN);
   }
 }
 
 // statement → exprStmt | forStmt | ifStmt | printStmt | returnStmt | whileStmt | block ;
-static void statement() {
-  if (match(TOKEN_PRINT)) {
-    printStatement();
-  } else if (match(TOKEN_IF)) {
-    ifStatement();
-  } else if (match(TOKEN_FOR)) {
-    forStatement();
-  } else if (match(TOKEN_RETURN)) {
-    returnStatement();
-  } else if (match(TOKEN_WHILE)) {
-    whileStatement();
-  } else if (match(TOKEN_LEFT_BRACE)) {
-    beginScope();
-    block();
-    endScope();
+static void statement(Parser* parser) {
+  if (match(parser, TOKEN_PRINT)) {
+    printStatement(parser);
+  } else if (match(parser, TOKEN_IF)) {
+    ifStatement(parser);
+  } else if (match(parser, TOKEN_FOR)) {
+    forStatement(parser);
+  } else if (match(parser, TOKEN_RETURN)) {
+    returnStatement(parser);
+  } else if (match(parser, TOKEN_WHILE)) {
+    whileStatement(parser);
+  } else if (match(parser, TOKEN_LEFT_BRACE)) {
+    beginScope(parser);
+    block(parser);
+    endScope(parser);
   } else {
-    expressionStatement();
+    expressionStatement(parser);
   }
 }
 
 // 表达式
-static void expression() {
+static void expression(Parser* parser) {
   // 从优先级最低的开始
-  parsePrecedence(PREC_ASSIGNMENT);
+  parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
 // 根据类型获取token的解析规则
@@ -1255,29 +1704,29 @@ static ParseRule* getRule(TokenType type) {
 /* 
   how `(-1 + 2) * 3 - -4` works:
 
-  parsePrecedence(PREC_ASSIGNMENT)
+  parsePrecedence(parser, PREC_ASSIGNMENT)
   ( => prefix => grouping
-    parsePrecedence(PREC_ASSIGNMENT)
+    parsePrecedence(parser, PREC_ASSIGNMENT)
     - => unary
-      parsePrecedence(PREC_UNARY);
+      parsePrecedence(parser, PREC_UNARY);
       1 => number; // 写入CONSTANT: 1
       +号的优先级PREC_TERM低于PREC_UNARY: 退出
       => // 写入NEGATE指令
     +的优先级大于PREC_ASSIGNMENT => infixRule => binary
-      parsePrecedence(PREC_FACTOR);
+      parsePrecedence(parser, PREC_FACTOR);
       2 => number; // 写入CONSTANT: 2
       )号的优先级PREC_NONE低于PREC_FACTOR: 退出
       => // 写入ADD
     => )号的优先级PREC_NONE低于PREC_ASSIGNMENT: 退出
   * => infix => binary
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
     3 => number; // 写入CONSTANT: 3
     PREC_TERM低于PREC_UNARY: 退出
     => // 写入OP_MULTIPLY
   - => infix => binary
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
       - => unary
-      parsePrecedence(PREC_UNARY);
+      parsePrecedence(parser, PREC_UNARY);
         4 => number; // 写入CONSTANT: 4
         PREC_NONE低于PREC_UNARY: 退出
       => // 写入NEGATE指令
@@ -1286,76 +1735,204 @@ static ParseRule* getRule(TokenType type) {
   => // 写入OP_SUBTRACT
   EOF号的优先级PREC_NONE低于PREC_UNARY: 退出
 */
-static void parsePrecedence(Precedence precedence) {
+static void parsePrecedence(Parser* parser, Precedence precedence) {
   // lox中一个表达式的开头必须为前缀表达式.
   // 也就是：(, -, !, indentifier, string, number, false, true, nil, super, this
-  advance();
-  ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+  advance(parser);
+  ParseFn prefixRule = getRule(parser->previous.type)->prefix;
   if (prefixRule == NULL) {
-    error("Expect expression.");
+    error(parser, "Expect expression.");
     return;
   }
   // 解析对应的前缀表达式
   bool canAssign = precedence <= PREC_ASSIGNMENT;
-  prefixRule(canAssign);
+  prefixRule(parser, canAssign);
 
   // 开始查看是否有中序表达式的优先级token
   // 当后续的token优先级比当前解析的优先级高或者同级的时候，继续解析后续的表达式
   // 这里是<=, 因此默认为右结合
-  while (precedence <= getRule(parser.current.type)->precedence) {
+  while (precedence <= getRule(parser->current.type)->precedence) {
     // 消费操作符
-    advance();
+    advance(parser);
     // 开始解析右边表达式，目前只有binary
-    ParseFn infixRule = getRule(parser.previous.type)->infix;
-    infixRule(canAssign);
+    ParseFn infixRule = getRule(parser->previous.type)->infix;
+    infixRule(parser, canAssign);
   }
 
   // (a * b) = c + d
   // (a * b)不是一个有效的可赋值对象
-  if (canAssign && match(TOKEN_EQUAL)) {
-    error("Invalid assignment target.");
-    expression();
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    error(parser, "Invalid assignment target.");
+    expression(parser);
   }
 }
 
 // -------------------- entry -------------------------
 
-ObjFunction* compile(const char* source) {
-  // 初始化词法分析器
-  initScanner(source);
+// -------------------- 代码区 -------------------------
+
+// 刚刚编译完成、数组还是单独分配的函数
+// 来自镜像的函数借用映射的内存，延迟编译的函数还没有函数体，都不需要打包
+static bool isPackable(ObjFunction* function) {
+  return function->chunk.arena == NULL && !function->chunk.borrowed &&
+         function->image == NULL && function->lazySource == NULL;
+}
+
+typedef struct {
+  ObjFunction** functions;
+  int count;
+  int capacity;
+} FunctionList;
+
+// 深度优先的收集函数：每个函数后面紧跟着它内部定义的函数，调用者和被调用者的指令通常会挨在一起
+static void collectPackable(FunctionList* list, ObjFunction* function, bool includeSelf) {
+  if (includeSelf) {
+    if (list->capacity < list->count + 1) {
+      int oldCapacity = list->capacity;
+      list->capacity = GROW_CAPACITY(oldCapacity);
+      list->functions = GROW_ARRAY(list->functions, ObjFunction*,
+          oldCapacity, list->capacity);
+    }
+    list->functions[list->count++] = function;
+  }
+
+  ValueArray* constants = &function->chunk.constants;
+  for (int i = 0; i < constants->count; i++) {
+    if (IS_FUNCTION(constants->values[i]) && isPackable(AS_FUNCTION(constants->values[i]))) {
+      collectPackable(list, AS_FUNCTION(constants->values[i]), true);
+    }
+  }
+}
+
+// 编译结束之后，将root(includeRoot为true时)以及其中定义的所有函数的常量、行号表和指令复制进同一个代码区，
+// 并释放原来的数组。原来的数组是按GROW_CAPACITY倍增的，平均有四分之一的空间是空闲的
+static void packFunctions(ObjFunction* root, bool includeRoot) {
+  if (!isPackable(root)) return;
+
+  FunctionList list = { NULL, 0, 0 };
+  collectPackable(&list, root, includeRoot);
+  if (list.count == 0) return;
+
+  size_t constantCount = 0;
+  size_t lineCount = 0;
+  size_t codeSize = 0;
+  for (int i = 0; i < list.count; i++) {
+    Chunk* chunk = &list.functions[i]->chunk;
+    constantCount += chunk->constants.count;
+    lineCount += chunk->lineCount;
+    codeSize += chunk->count;
+  }
+
+  // 按对齐的要求依次存放：常量 | 行号表 | 指令
+  CodeArena* arena = newCodeArena(sizeof(Value) * constantCount +
+                                  sizeof(LineStart) * lineCount + codeSize);
+  Value* constants = (Value*)codeArenaData(arena);
+  LineStart* lines = (LineStart*)(constants + constantCount);
+  uint8_t* code = (uint8_t*)(lines + lineCount);
+
+  for (int i = 0; i < list.count; i++) {
+    Chunk* chunk = &list.functions[i]->chunk;
+
+    // 没有常量(或者指令)的数组为NULL，不能传给memcpy
+    if (chunk->constants.count > 0) {
+      memcpy(constants, chunk->constants.values, sizeof(Value) * chunk->constants.count);
+    }
+    FREE_ARRAY(Value, chunk->constants.values, chunk->constants.capacity);
+    chunk->constants.values = constants;
+    chunk->constants.capacity = chunk->constants.count;
+    constants += chunk->constants.count;
+
+    if (chunk->lineCount > 0) memcpy(lines, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->lines = lines;
+    chunk->lineCapacity = chunk->lineCount;
+    lines += chunk->lineCount;
+
+    if (chunk->count > 0) memcpy(code, chunk->code, chunk->count);
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    chunk->code = code;
+    chunk->capacity = chunk->count;
+    code += chunk->count;
+
+    chunk->arena = arena;
+    arena->refs++;
+  }
+
+  FREE_ARRAY(ObjFunction*, list.functions, list.capacity);
+}
+
+ObjFunction* compile(const char* source, bool lazy) {
+  return compileFrom(source, 1, lazy);
+}
+
+ObjFunction* compileFrom(const char* source, int firstLine, bool lazy) {
+  Heap heap;
+  initHeap(&heap);
+  ObjFunction* function = compileInHeap(&heap, source, firstLine, lazy);
+  // 出现编译错误时已经分配的对象也要交给vm，由GC回收
+  mergeHeap(&heap);
+  return function;
+}
+
+static void initParser(Parser* parser, const char* source, int line, bool lazy) {
+  parser->hadError = false;
+  parser->panicMode = false;
+  parser->compiler = NULL;
+  parser->currentClass = NULL;
+  parser->lazy = lazy;
+  initScanner(&parser->scanner, source);
+  parser->scanner.line = line;
+  parser->tokenCount = 0;
+  parser->nextToken = 0;
+  for (int i = 0; i < IDENTIFIER_CACHE; i++) {
+    parser->recentIdentifiers[i] = NULL;
+  }
+}
+
+ObjFunction* compileInHeap(Heap* heap, const char* source, int firstLine, bool lazy) {
+  Heap* previous = useHeap(heap);
+
+  // 初始化语法分析器和词法分析器
+  Parser parser;
+  initParser(&parser, source, firstLine, lazy);
 
   // 初始化编译器
   Compiler compiler;
-  initCompiler(&compiler, TYPE_SCRIPT);
-
-  // 初始化语法分析器
-  parser.hadError = false;
-  parser.panicMode = false;
+  initCompiler(&parser, &compiler, TYPE_SCRIPT);
 
   // 由于我们的语法分析器每次最多只需要前瞻一个字符
   // 为了节约资源，我们可以同时进行词法分析和语法分析
-  advance();
-  while (!match(TOKEN_EOF)) {
-    declaration();
+  advance(&parser);
+  while (!match(&parser, TOKEN_EOF)) {
+    declaration(&parser);
   }
-  
-  consume(TOKEN_EOF, "Unexpected end of expression");
+
+  consume(&parser, TOKEN_EOF, "Unexpected end of expression");
 
   // 结束编译，我们将整个script作为一个顶级的function，这样只需要在虚拟机中执行这个function的字节码
   // 将源码编译为一个顶级function
-  // 类似与js中的Immediately Invoked Function Expression: 
-  /* 
+  // 类似与js中的Immediately Invoked Function Expression:
+  /*
     (function () {
       statements
     })();
   */
-  ObjFunction* function = endCompiler();
-  return parser.hadError ? NULL : function;
+  ObjFunction* function = endCompiler(&parser);
+  if (parser.hadError) {
+    useHeap(previous);
+    return NULL;
+  }
+
+  // 顶级代码只执行一次，单独放在一个代码区中：执行完之后即使其中定义的函数还在使用，它也可以被回收
+  packFunctions(function, false);
+  packFunctions(function, true);
+  useHeap(previous);
+  return function;
 
   // 不需要像glox一样一次性把所有的token分析出来，只需要按需分析，节省内存
   // int line = -1;
   // for (;;) {
-  //   Token token = scanToken();
+  //   Token token = scanToken(&scanner);
   //   if (token.line != line) {
   //     printf("%4d ", token.line);
   //     line = token.line;
@@ -1367,10 +1944,128 @@ ObjFunction* compile(const char* source) {
   // }
 }
 
-void markCompilerRoots() {
-  Compiler* compiler = current;
-  while (compiler != NULL) {
-    markObject((Obj*)compiler->function);
-    compiler = compiler->enclosing;
+int completeStatements(const char* source) {
+  Scanner scanner;
+  initScanner(&scanner, source);
+
+  // 在括号之外的;或者}之后是一条顶级语句的结束，除非后面紧跟着else
+  // 下一个token必须是完整的(没有到达源码的末尾)，否则无法判断它是不是else
+  const char* end = source;
+  int depth = 0;
+  Token token = scanToken(&scanner);
+  while (token.type != TOKEN_EOF) {
+    switch (token.type) {
+      case TOKEN_LEFT_PAREN:
+      case TOKEN_LEFT_BRACE:
+        depth++;
+        break;
+      case TOKEN_RIGHT_PAREN:
+      case TOKEN_RIGHT_BRACE:
+        if (depth > 0) depth--;
+        break;
+      default:
+        break;
+    }
+
+    Token next = scanToken(&scanner);
+    if (depth == 0 && (token.type == TOKEN_SEMICOLON || token.type == TOKEN_RIGHT_BRACE) &&
+        next.type != TOKEN_EOF && next.type != TOKEN_ELSE &&
+        next.type != TOKEN_ERROR && next.start[next.length] != '\0') {
+      end = token.start + token.length;
+    }
+    token = next;
   }
-}
\ No newline at end of file
+
+  return (int)(end - source);
+}
+
+void initInputState(InputState* state) {
+  state->scanned = 0;
+  state->depth = 0;
+  state->hasTokens = false;
+  state->ended = false;
+  state->pending = false;
+  state->end = 0;
+}
+
+bool isInputComplete(InputState* state, const char* source) {
+  Scanner scanner;
+  initScanner(&scanner, source + state->scanned);
+
+  for (;;) {
+    Token token = scanToken(&scanner);
+    if (token.type == TOKEN_EOF) {
+      if (!state->pending) state->end = (int)(token.start - source);
+      break;
+    }
+
+    // 上一个token是括号之外的}：后面是else或者.时语句还没有结束，否则语句在}之后就已经结束了
+    if (state->pending) {
+      state->pending = false;
+      if (token.type != TOKEN_ELSE && token.type != TOKEN_DOT) return true;
+    }
+
+    if (token.type == TOKEN_ERROR) {
+      // 字符串跨越了多行，下一次从字符串的开头重新扫描
+      if (*scanner.start == '"') {
+        state->scanned = (int)(scanner.start - source);
+        state->hasTokens = true;
+        return false;
+      }
+      // 其他的错误交给编译器报告
+      state->scanned = (int)(scanner.current - source);
+      state->ended = true;
+      continue;
+    }
+
+    switch (token.type) {
+      case TOKEN_LEFT_PAREN:
+      case TOKEN_LEFT_BRACE:
+        state->depth++;
+        break;
+      case TOKEN_RIGHT_PAREN:
+      case TOKEN_RIGHT_BRACE:
+        state->depth--;
+        break;
+      default:
+        break;
+    }
+    state->hasTokens = true;
+    state->ended = token.type == TOKEN_SEMICOLON;
+    state->scanned = (int)(token.start + token.length - source);
+    if (token.type == TOKEN_RIGHT_BRACE && state->depth <= 0) {
+      state->pending = true;
+      state->end = state->scanned;
+    }
+  }
+
+  return state->depth <= 0 && state->ended;
+}
+
+bool compileLazyFunction(ObjFunction* function) {
+  Heap heap;
+  initHeap(&heap);
+  Heap* previous = useHeap(&heap);
+
+  // 从参数列表开始重新扫描，函数名作为parser.previous交给initCompiler
+  Parser parser;
+  initParser(&parser, function->lazySource, function->lazyLine, false);
+  advance(&parser);
+  parser.previous.start = function->name->chars;
+  parser.previous.length = function->name->length;
+  parser.previous.string = copyString(function->name->chars, function->name->length);
+
+  Compiler compiler;
+  ObjFunction* compiled = functionBody(&parser, &compiler, TYPE_FUNCTION);
+  if (!parser.hadError) packFunctions(compiled, true);
+  useHeap(previous);
+  mergeHeap(&heap);
+  if (parser.hadError) return false;
+
+  // 将编译结果移动到原来的函数对象中，所有引用了它的闭包都会看到编译好的函数体
+  function->chunk = compiled->chunk;
+  function->maxSlots = compiled->maxSlots;
+  function->lazySource = NULL;
+  initChunk(&compiled->chunk);
+  return true;
+}
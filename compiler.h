@@ -2,10 +2,40 @@
 #define clox_compiler_h
 
 #include "chunk.h"
+#include "memory.h"
 #include "object.h"
 
-ObjFunction* compile(const char* source);
-// 标记编译期间的根对象
-void markCompilerRoots();
+// lazy为true时全局函数的函数体延迟到第一次调用时才编译，调用者需要保证源码一直有效
+ObjFunction* compile(const char* source, bool lazy);
+// 同compile，源码的第一行为第firstLine行(流式执行时源码被分成了若干段)
+ObjFunction* compileFrom(const char* source, int firstLine, bool lazy);
+// 返回源码中由完整的顶级语句组成的最长前缀的长度，源码的末尾可能是被截断的语句
+int completeStatements(const char* source);
+
+// 交互式输入的扫描状态：源码只会在末尾追加，已经扫描过的部分不会再重复扫描
+typedef struct {
+  // 已经扫描过的源码长度，下一次从这里继续扫描
+  int scanned;
+  // 还没有闭合的括号数量
+  int depth;
+  // 是否扫描到了任何token
+  bool hasTokens;
+  // 最后一个token是否为;
+  bool ended;
+  // 最后一个token是否为括号之外的}：要看到下一个token才能判断语句是否结束(后面可能是else或者.)
+  bool pending;
+  // 返回true时，源码的前end个字节由完整的语句组成
+  int end;
+} InputState;
+
+void initInputState(InputState* state);
+// 扫描新追加的源码，返回源码的开头是否已经是完整的语句，完整的部分的长度为state->end
+// 以}结尾的语句要等到下一个token不是else或者.时才算完整，此时end为}之后的位置，剩下的源码属于下一条语句
+bool isInputComplete(InputState* state, const char* source);
+// 在heap中编译源码，编译期间不访问vm，可以在任意线程中调用，不同的线程使用不同的heap即可
+// 返回的函数在heap中，需要在主线程中调用mergeHeap之后才能执行；出现编译错误时返回NULL(heap同样需要合并)
+ObjFunction* compileInHeap(Heap* heap, const char* source, int firstLine, bool lazy);
+// 编译延迟编译的函数的函数体，出现编译错误时返回false
+bool compileLazyFunction(ObjFunction* function);
 
 #endif
\ No newline at end of file
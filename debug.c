@@ -5,6 +5,72 @@
 #include "object.h"
 #include "value.h"
 
+// 指令名称表
+static const char* opcodeNames[OP_COUNT] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_NIL] = "OP_NIL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_POP] = "OP_POP",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+  [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+  [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+  [OP_GET_CAPTURED] = "OP_GET_CAPTURED",
+  [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+  [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+  [OP_GET_SUPER] = "OP_GET_SUPER",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_LESS] = "OP_LESS",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_PRINT] = "OP_PRINT",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_CALL] = "OP_CALL",
+  [OP_INVOKE] = "OP_INVOKE",
+  [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+  [OP_SUPER] = "OP_SUPER",
+  [OP_CLOSURE] = "OP_CLOSURE",
+  [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_CLASS] = "OP_CLASS",
+  [OP_INHERIT] = "OP_INHERIT",
+  [OP_METHOD] = "OP_METHOD",
+  [OP_WIDE] = "OP_WIDE",
+  [OP_JUMP_FAR] = "OP_JUMP_FAR",
+  [OP_JUMP_IF_FALSE_FAR] = "OP_JUMP_IF_FALSE_FAR",
+  [OP_LOOP_FAR] = "OP_LOOP_FAR",
+  [OP_IMPORT] = "OP_IMPORT",
+  #define SUPERINSTRUCTION_NAME(name, length, op1, op2, op3) [name] = #name,
+  SUPERINSTRUCTIONS(SUPERINSTRUCTION_NAME)
+  #undef SUPERINSTRUCTION_NAME
+};
+
+const char* opcodeName(uint8_t opcode) {
+  if (opcode >= OP_COUNT || opcodeNames[opcode] == NULL) return "OP_UNKNOWN";
+  return opcodeNames[opcode];
+}
+
+// 前面的OP_WIDE前缀累积的高位字节(见compiler.c中的emitArg)
+static int wideOperand = 0;
+
+// 读取一个可以被OP_WIDE扩展的操作数
+static int readOperand(Chunk* chunk, int offset) {
+  int operand = wideOperand | chunk->code[offset];
+  wideOperand = 0;
+  return operand;
+}
+
 // single byte instruction, like: 'OP_RETURN'
 static int simpleInstruction(const char* name, int offset) {
   printf("%s\n", name);
@@ -12,7 +78,7 @@ static int simpleInstruction(const char* name, int offset) {
 }
 
 static int byteInstruction(const char* name, Chunk* chunk, int offset) {
-  uint8_t slot = chunk->code[offset + 1];
+  int slot = readOperand(chunk, offset + 1);
   printf("%-16s %4d\n", name, slot);
   return offset + 2;
 }
@@ -20,7 +86,7 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) {
 // 有附加参数的指令
 static int constantInstruction(const char* name, Chunk* chunk,
     int offset) {
-  uint8_t constant = chunk->code[offset + 1];
+  int constant = readOperand(chunk, offset + 1);
 
   // name and index of constant 
   printf("%-16s %4d '", name, constant);
@@ -29,18 +95,12 @@ static int constantInstruction(const char* name, Chunk* chunk,
   return offset + 2;
 }
 
-static int constantLongInstruction(const char* name, Chunk* chunk,
-    int offset) {
-  int constant = 0;
-  // 如何在连续内存（offset+1 -> offset + 3）上读出256？
-  memcpy(&constant, &chunk->code[offset + 1], sizeof(uint8_t) * 3);
-  // uint8_t constant = chunk->code[offset + 1];
-
-  // name and index of constant 
-  printf("%-16s %4d '", name, constant);
-  printValue(chunk->constants.values[constant]);
-  printf("'\n");
-  return offset + 4;
+// OP_WIDE前缀：打印其提供的高位字节
+static int wideInstruction(Chunk* chunk, int offset) {
+  uint8_t byte = chunk->code[offset + 1];
+  printf("%-16s %4d\n", "OP_WIDE", byte);
+  wideOperand = (wideOperand | byte) << 8;
+  return offset + 2;
 }
 
 // jump指令：打印出jump指令以及该指令跳过的指令字节范围
@@ -53,14 +113,24 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk,
   return offset + 3;
 }
 
+// 跳转距离存放在常量数组中的jump指令
+static int farJumpInstruction(const char* name, int sign, Chunk* chunk,
+                              int offset) {
+  uint16_t constant = (uint16_t)(chunk->code[offset + 1] << 8);
+  constant |= chunk->code[offset + 2];
+  int jump = (int)AS_NUMBER(chunk->constants.values[constant]);
+  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+  return offset + 3;
+}
+
 static int invokeInstruction(const char* name, Chunk* chunk,
                                 int offset) {               
-  uint8_t constant = chunk->code[offset + 1];               
+  int constant = readOperand(chunk, offset + 1);
   uint8_t argCount = chunk->code[offset + 2];               
   printf("%-16s (%d args) %4d '", name, argCount, constant);
   printValue(chunk->constants.values[constant]);            
   printf("'\n");                                            
-  return offset + 2;                                        
+  return offset + 3;
 } 
 
 void disassembleChunk(Chunk* chunk, const char* name) {
@@ -78,14 +148,26 @@ int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
 
   // Show a | for any instruction that comes from the same source line as the preceding one.
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = getLine(chunk, offset);
+  if (offset > 0 && line == getLine(chunk, offset - 1)) {
     printf("   | ");
   } else { 
-    printf("%4d ", chunk->lines[offset]);   
+    printf("%4d ", line);   
   }
 
   // read instruction
   uint8_t instruction = chunk->code[offset]; 
+
+  // 超级指令原地覆盖了第一条子指令的操作码，其余的字节不变，
+  // 因此打印出超级指令的名称之后，按第一条子指令继续打印，后续的子指令会按普通指令依次打印
+  for (int i = 0; i < superinstructionCount; i++) {
+    if (superinstructions[i].opcode == instruction) {
+      printf("%s\n          ", opcodeName(instruction));
+      instruction = superinstructions[i].ops[0];
+      break;
+    }
+  }
+
   switch (instruction) {
     case OP_ADD:     
       return simpleInstruction("OP_ADD", offset);
@@ -101,8 +183,6 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_NOT", offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
-    // case OP_CONSTANT_LONG:
-    //   return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
     case OP_NIL:
@@ -133,6 +213,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return byteInstruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
       return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+    case OP_GET_CAPTURED:
+      return byteInstruction("OP_GET_CAPTURED", chunk, offset);
     case OP_CLOSE_UPVALUE:
       return byteInstruction("OP_CLOSE_UPVALUE", chunk, offset);
     case OP_CALL:
@@ -144,18 +226,22 @@ int disassembleInstruction(Chunk* chunk, int offset) {
     case OP_CLOSURE: {
       // 打印函数
       offset++;
-      uint8_t constant = chunk->code[offset++];
+      int constant = readOperand(chunk, offset++);
       printf("%-16s %4d ", "OP_CLOSURE", constant);
       printValue(chunk->constants.values[constant]);
       printf("\n");
 
       // 打印函数可引用的闭包变量upvalue的信息
       ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);                    
-      for (int j = 0; j < function->upvalueCount; j++) {
-        int isLocal = chunk->code[offset++];
+      // 按值捕获的变量跟在upvalues后面
+      for (int j = 0; j < function->upvalueCount + function->captureCount; j++) {
+        int start = offset;
+        int flags = chunk->code[offset++];
         int index = chunk->code[offset++];
-        printf("%04d      |                     %s %d\n",
-               offset - 2, isLocal ? "local" : "upvalue", index);
+        if (flags & UPVALUE_WIDE) index = index << 8 | chunk->code[offset++];
+        printf("%04d      |                     %s%s %d\n",
+               start, (flags & UPVALUE_LOCAL) ? "local" : "upvalue",
+               j >= function->upvalueCount ? " copy" : "", index);
       }
 
       return offset;
@@ -168,8 +254,18 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return jumpInstruction("OP_LOOP", -1, chunk, offset);
     case OP_JUMP_IF_FALSE:
       return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_FAR:
+      return farJumpInstruction("OP_JUMP_FAR", 1, chunk, offset);
+    case OP_LOOP_FAR:
+      return farJumpInstruction("OP_LOOP_FAR", -1, chunk, offset);
+    case OP_JUMP_IF_FALSE_FAR:
+      return farJumpInstruction("OP_JUMP_IF_FALSE_FAR", 1, chunk, offset);
+    case OP_WIDE:
+      return wideInstruction(chunk, offset);
     case OP_CLASS:
       return constantInstruction("OP_CLASS", chunk, offset);
+    case OP_IMPORT:
+      return constantInstruction("OP_IMPORT", chunk, offset);
     case OP_INHERIT:
       return simpleInstruction("OP_INHERIT", offset);
     case OP_GET_SUPER:
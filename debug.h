@@ -5,5 +5,7 @@
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset); 
+// 指令的名称，用于调试和统计指令频率
+const char* opcodeName(uint8_t opcode);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,868 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "debug.h"
+#include "image.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+  .loxc 文件格式(所有整数均为本机字节序，所有数组都按自身的大小对齐，可以直接在映射的内存上访问)：
+
+  ImageHeader
+  ImageFunction[functionCount]   所有函数，下标0为顶级函数
+  ImageConstant[constantCount]   所有函数的常量依次排列
+  ImageString[stringCount]       字符串常量和函数名
+  LineStart lines[]              所有函数的行号表(行程编码，见chunk.h)
+  uint8_t code[]                 所有函数的指令
+  char chars[]                   所有字符串的字符
+
+  文件头之后的所有内容都计入文件头中的校验和，读取时校验和不一致的镜像视为缓存不存在。
+  此外函数的字节码在第一次执行之前还会逐条检查(见verifyCode)，损坏的镜像不会被执行。
+*/
+
+#define IMAGE_MAGIC "LOXC"
+#define IMAGE_VERSION 6
+
+typedef enum {
+  CONSTANT_NUMBER,
+  CONSTANT_STRING,
+  CONSTANT_FUNCTION,
+  CONSTANT_SHORT_STRING,
+} ConstantType;
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t fingerprint;
+  uint32_t functionCount;
+  uint64_t sourceHash;
+  uint64_t checksum;        // 文件头之后所有内容的校验和(见imageChecksum)
+  uint32_t constantCount;
+  uint32_t stringCount;
+  uint32_t functionsOffset;
+  uint32_t constantsOffset;
+  uint32_t stringsOffset;
+  uint32_t padding;
+} ImageHeader;
+
+typedef struct {
+  int32_t arity;
+  int32_t upvalueCount;
+  int32_t captureCount;
+  int32_t maxSlots;
+  int32_t name;             // 函数名在字符串表中的下标，顶级函数为-1
+  int32_t count;            // 指令的字节数
+  int32_t lineCount;        // 行号表的项数
+  uint32_t codeOffset;
+  uint32_t linesOffset;
+  uint32_t firstConstant;   // 第一个常量在常量表中的下标
+  uint32_t constantCount;
+  uint32_t padding;         // 使记录的大小为8的倍数，紧跟在后面的常量表才能按8字节对齐
+} ImageFunction;
+
+typedef struct {
+  uint32_t type;
+  uint32_t index;           // 字符串或者函数的下标，短字符串的长度
+  union {
+    double number;
+    char chars[8];          // 短字符串的内容(见value.h)
+  } as;
+} ImageConstant;
+
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+} ImageString;
+
+// 所有已经映射的镜像
+static Image* images = NULL;
+
+uint64_t hashSource(const char* source) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char* c = source; *c != '\0'; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// 镜像内容的校验和：按8字节的字计算的FNV-1a，每个字混合之后再将高位折叠到低位，
+// 保证任意一个字节的改动都会扩散到整个hash，最后不足8字节的部分补0
+static uint64_t imageChecksum(const uint8_t* bytes, size_t size) {
+  uint64_t hash = 14695981039346656037ull ^ size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 1099511628211ull;
+    hash ^= hash >> 29;
+  }
+  if (i < size) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + i, size - i);
+    hash = (hash ^ word) * 1099511628211ull;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+uint32_t instructionSetFingerprint() {
+  uint32_t hash = 2166136261u;
+  for (int op = 0; op < OP_COUNT; op++) {
+    for (const char* c = opcodeName((uint8_t)op); *c != '\0'; c++) {
+      hash ^= (uint8_t)*c;
+      hash *= 16777619;
+    }
+    hash ^= ' ';
+    hash *= 16777619;
+  }
+
+  hash ^= (uint32_t)sizeof(Value);
+  hash *= 16777619;
+  // 统计指令频率时编译器不会合并超级指令，两者的字节码不能混用
+  #ifdef DEBUG_PROFILE_OPCODES
+    hash ^= 1;
+    hash *= 16777619;
+  #endif
+  return hash;
+}
+
+char* imagePath(const char* sourcePath, uint64_t sourceHash) {
+  const char* cacheDir = getenv("LOX_CACHE_DIR");
+  if (cacheDir != NULL && cacheDir[0] != '\0') {
+    size_t length = strlen(cacheDir) + strlen("/0123456789abcdef.loxc") + 1;
+    char* path = (char*)malloc(length);
+    snprintf(path, length, "%s/%016llx.loxc", cacheDir,
+             (unsigned long long)sourceHash);
+    return path;
+  }
+
+  // script.lox -> script.loxc, 其他后缀的文件直接加上.loxc
+  size_t length = strlen(sourcePath);
+  char* path = (char*)malloc(length + strlen(".loxc") + 1);
+  memcpy(path, sourcePath, length + 1);
+  if (length >= 4 && strcmp(path + length - 4, ".lox") == 0) {
+    strcat(path, "c");
+  } else {
+    strcat(path, ".loxc");
+  }
+  return path;
+}
+
+// -------------------- 写入 -------------------------
+
+// 写入之前先收集所有的函数、常量和字符串，以便计算出各个数组的偏移量
+typedef struct {
+  ObjFunction** functions;
+  int functionCount;
+  int functionCapacity;
+  ImageConstant* constants;
+  int constantCount;
+  int constantCapacity;
+  ObjString** strings;
+  int stringCount;
+  int stringCapacity;
+  // 字符串 -> 在字符串表中的下标，同一个字符串只写入一次
+  Table stringIndexes;
+} ImageWriter;
+
+static int addFunction(ImageWriter* writer, ObjFunction* function) {
+  if (writer->functionCapacity < writer->functionCount + 1) {
+    int oldCapacity = writer->functionCapacity;
+    writer->functionCapacity = GROW_CAPACITY(oldCapacity);
+    writer->functions = GROW_ARRAY(writer->functions, ObjFunction*,
+        oldCapacity, writer->functionCapacity);
+  }
+  writer->functions[writer->functionCount] = function;
+  return writer->functionCount++;
+}
+
+static int addString(ImageWriter* writer, ObjString* string) {
+  Value index;
+  if (tableGet(&writer->stringIndexes, string, &index)) {
+    return (int)AS_NUMBER(index);
+  }
+
+  if (writer->stringCapacity < writer->stringCount + 1) {
+    int oldCapacity = writer->stringCapacity;
+    writer->stringCapacity = GROW_CAPACITY(oldCapacity);
+    writer->strings = GROW_ARRAY(writer->strings, ObjString*,
+        oldCapacity, writer->stringCapacity);
+  }
+  writer->strings[writer->stringCount] = string;
+  tableSet(&writer->stringIndexes, string, NUMBER_VAL(writer->stringCount));
+  return writer->stringCount++;
+}
+
+static void addImageConstant(ImageWriter* writer, ImageConstant constant) {
+  if (writer->constantCapacity < writer->constantCount + 1) {
+    int oldCapacity = writer->constantCapacity;
+    writer->constantCapacity = GROW_CAPACITY(oldCapacity);
+    writer->constants = GROW_ARRAY(writer->constants, ImageConstant,
+        oldCapacity, writer->constantCapacity);
+  }
+  writer->constants[writer->constantCount++] = constant;
+}
+
+// 广度优先的收集所有函数，函数的下标就是它被发现的顺序
+static bool collectFunctions(ImageWriter* writer, ObjFunction* function) {
+  addFunction(writer, function);
+
+  for (int i = 0; i < writer->functionCount; i++) {
+    ObjFunction* current = writer->functions[i];
+    // 还没有编译的函数体无法写入镜像
+    if (current->lazySource != NULL) return false;
+    if (current->name != NULL) addString(writer, current->name);
+
+    ValueArray* constants = &current->chunk.constants;
+    for (int j = 0; j < constants->count; j++) {
+      Value value = constants->values[j];
+      ImageConstant constant = { 0, 0, { 0 } };
+      if (IS_NUMBER(value)) {
+        constant.type = CONSTANT_NUMBER;
+        constant.as.number = AS_NUMBER(value);
+      } else if (IS_SHORT_STRING(value)) {
+        constant.type = CONSTANT_SHORT_STRING;
+        constant.index = SHORT_STRING_LENGTH(value);
+        shortStringChars(value, constant.as.chars);
+      } else if (IS_STRING(value)) {
+        constant.type = CONSTANT_STRING;
+        constant.index = addString(writer, AS_STRING(value));
+      } else if (IS_FUNCTION(value)) {
+        constant.type = CONSTANT_FUNCTION;
+        constant.index = addFunction(writer, AS_FUNCTION(value));
+      } else {
+        // 编译器不会生成其他类型的常量
+        return false;
+      }
+      addImageConstant(writer, constant);
+    }
+  }
+
+  return true;
+}
+
+static bool writeSections(FILE* file, ImageWriter* writer, uint64_t sourceHash) {
+  ImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, 4);
+  header.version = IMAGE_VERSION;
+  header.fingerprint = instructionSetFingerprint();
+  header.functionCount = writer->functionCount;
+  header.sourceHash = sourceHash;
+  header.constantCount = writer->constantCount;
+  header.stringCount = writer->stringCount;
+
+  // 计算各个数组的偏移量，固定大小的记录在前，保证后面的行号数组按int对齐
+  uint64_t offset = sizeof(ImageHeader);
+  header.functionsOffset = (uint32_t)offset;
+  offset += sizeof(ImageFunction) * (uint64_t)writer->functionCount;
+  header.constantsOffset = (uint32_t)offset;
+  offset += sizeof(ImageConstant) * (uint64_t)writer->constantCount;
+  header.stringsOffset = (uint32_t)offset;
+  offset += sizeof(ImageString) * (uint64_t)writer->stringCount;
+
+  uint64_t codeSize = 0;
+  uint64_t lineCount = 0;
+  for (int i = 0; i < writer->functionCount; i++) {
+    codeSize += writer->functions[i]->chunk.count;
+    lineCount += writer->functions[i]->chunk.lineCount;
+  }
+  uint64_t linesStart = offset;
+  uint64_t codeStart = linesStart + sizeof(LineStart) * lineCount;
+  uint64_t charsStart = codeStart + codeSize;
+  uint64_t charsSize = 0;
+  for (int i = 0; i < writer->stringCount; i++) {
+    charsSize += writer->strings[i]->length;
+  }
+  // 所有的偏移量都是32位的
+  if (charsStart + charsSize > UINT32_MAX) return false;
+
+  // 校验和写在文件头中，因此先在内存中拼出整个文件，计算校验和之后一次写入
+  size_t size = (size_t)(charsStart + charsSize);
+  uint8_t* buffer = (uint8_t*)calloc(size, 1);
+  if (buffer == NULL) return false;
+
+  uint64_t codeOffset = codeStart;
+  uint64_t linesOffset = linesStart;
+  uint32_t firstConstant = 0;
+  ImageFunction* records = (ImageFunction*)(buffer + header.functionsOffset);
+  for (int i = 0; i < writer->functionCount; i++) {
+    ObjFunction* function = writer->functions[i];
+    ImageFunction* record = &records[i];
+    record->arity = function->arity;
+    record->upvalueCount = function->upvalueCount;
+    record->captureCount = function->captureCount;
+    record->maxSlots = function->maxSlots;
+    record->name = -1;
+    if (function->name != NULL) {
+      Value index;
+      tableGet(&writer->stringIndexes, function->name, &index);
+      record->name = (int32_t)AS_NUMBER(index);
+    }
+    record->count = function->chunk.count;
+    record->lineCount = function->chunk.lineCount;
+    record->codeOffset = (uint32_t)codeOffset;
+    record->linesOffset = (uint32_t)linesOffset;
+    record->firstConstant = firstConstant;
+    record->constantCount = function->chunk.constants.count;
+
+    Chunk* chunk = &function->chunk;
+    if (chunk->lineCount > 0) {
+      memcpy(buffer + linesOffset, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+    }
+    if (chunk->count > 0) memcpy(buffer + codeOffset, chunk->code, chunk->count);
+
+    codeOffset += function->chunk.count;
+    linesOffset += sizeof(LineStart) * function->chunk.lineCount;
+    firstConstant += function->chunk.constants.count;
+  }
+
+  if (writer->constantCount > 0) {
+    memcpy(buffer + header.constantsOffset, writer->constants,
+           sizeof(ImageConstant) * writer->constantCount);
+  }
+
+  uint64_t charsOffset = charsStart;
+  ImageString* strings = (ImageString*)(buffer + header.stringsOffset);
+  for (int i = 0; i < writer->stringCount; i++) {
+    ObjString* string = writer->strings[i];
+    strings[i].offset = (uint32_t)charsOffset;
+    strings[i].length = string->length;
+    if (string->length > 0) memcpy(buffer + charsOffset, string->chars, string->length);
+    charsOffset += string->length;
+  }
+
+  header.checksum = imageChecksum(buffer + sizeof(ImageHeader), size - sizeof(ImageHeader));
+  memcpy(buffer, &header, sizeof(header));
+
+  bool success = fwrite(buffer, 1, size, file) == size;
+  free(buffer);
+  return success;
+}
+
+bool writeImage(const char* path, ObjFunction* function, uint64_t sourceHash) {
+  // 收集的过程中会分配内存，将函数入栈避免被GC回收
+  push(OBJ_VAL(function));
+
+  ImageWriter writer;
+  memset(&writer, 0, sizeof(writer));
+  initTable(&writer.stringIndexes);
+
+  bool success = collectFunctions(&writer, function);
+
+  // 先写入临时文件再重命名，这样同时运行的其他clox进程不会读到写了一半的镜像
+  size_t length = strlen(path) + 32;
+  char* tempPath = (char*)malloc(length);
+  snprintf(tempPath, length, "%s.%ld.tmp", path, (long)getpid());
+
+  FILE* file = success ? fopen(tempPath, "wb") : NULL;
+  if (file != NULL) {
+    success = writeSections(file, &writer, sourceHash);
+    if (ferror(file)) success = false;
+    if (fclose(file) != 0) success = false;
+
+    if (success) success = rename(tempPath, path) == 0;
+    if (!success) remove(tempPath);
+  } else {
+    success = false;
+  }
+
+  free(tempPath);
+  FREE_ARRAY(ObjFunction*, writer.functions, writer.functionCapacity);
+  FREE_ARRAY(ImageConstant, writer.constants, writer.constantCapacity);
+  FREE_ARRAY(ObjString*, writer.strings, writer.stringCapacity);
+  freeTable(&writer.stringIndexes);
+  pop();
+  return success;
+}
+
+// -------------------- 读取 -------------------------
+
+// 检查[offset, offset + size)是否在镜像的范围之内
+static bool inImage(Image* image, uint64_t offset, uint64_t size) {
+  return offset <= image->size && size <= image->size - offset;
+}
+
+static const ImageHeader* imageHeader(Image* image) {
+  return (const ImageHeader*)image->base;
+}
+
+// 记录数组(从arrayOffset开始，每项size个字节)中第index项的地址，这一项不完整的在镜像之内时返回NULL
+// 常量是在函数第一次调用时才加载的，每次读取记录之前都按映射的大小重新检查，不依赖读取文件头时的检查
+static const void* imageRecord(Image* image, uint32_t arrayOffset, uint32_t index, size_t size) {
+  uint64_t offset = arrayOffset + (uint64_t)index * size;
+  return inImage(image, offset, size) ? image->base + offset : NULL;
+}
+
+static ObjString* imageString(Image* image, uint32_t index) {
+  const ImageHeader* header = imageHeader(image);
+  if (index >= header->stringCount) return NULL;
+
+  const ImageString* record = (const ImageString*)imageRecord(
+      image, header->stringsOffset, index, sizeof(ImageString));
+  if (record == NULL) return NULL;
+  if (record->length > INT32_MAX || !inImage(image, record->offset, record->length)) {
+    return NULL;
+  }
+  return copyString((const char*)image->base + record->offset, (int)record->length);
+}
+
+// 创建镜像中的函数对象，code和lines直接指向映射的内存，常量等到第一次调用时再加载
+static ObjFunction* newImageFunction(Image* image, uint32_t index) {
+  const ImageHeader* header = imageHeader(image);
+  if (index >= header->functionCount) return NULL;
+
+  const ImageFunction* record = (const ImageFunction*)imageRecord(
+      image, header->functionsOffset, index, sizeof(ImageFunction));
+  if (record == NULL) return NULL;
+  // 函数的各项计数必须是编译器可能生成的值，vm按照这些值分配闭包变量的数组以及检查栈的空间
+  if (record->arity < 0 || record->arity > UINT8_MAX ||
+      record->maxSlots <= record->arity || record->maxSlots > LOCALS_MAX ||
+      record->upvalueCount < 0 || record->upvalueCount > UINT8_COUNT ||
+      record->captureCount < 0 || record->captureCount > UINT8_COUNT) {
+    return NULL;
+  }
+  if (record->count <= 0 || record->lineCount < 0 ||
+      !inImage(image, record->codeOffset, record->count) ||
+      record->linesOffset % sizeof(int) != 0 ||
+      !inImage(image, record->linesOffset, sizeof(LineStart) * (uint64_t)record->lineCount)) {
+    return NULL;
+  }
+
+  ObjFunction* function = newFunction();
+  function->arity = record->arity;
+  function->upvalueCount = record->upvalueCount;
+  function->captureCount = record->captureCount;
+  function->maxSlots = record->maxSlots;
+  function->image = image;
+  function->imageIndex = index;
+
+  Chunk* chunk = &function->chunk;
+  chunk->code = image->base + record->codeOffset;
+  chunk->lines = (LineStart*)(image->base + record->linesOffset);
+  chunk->lineCount = record->lineCount;
+  chunk->lineCapacity = record->lineCount;
+  chunk->count = record->count;
+  chunk->capacity = record->count;
+  chunk->borrowed = true;
+
+  if (record->name >= 0) {
+    // 创建函数名的字符串时可能会触发GC
+    push(OBJ_VAL(function));
+    function->name = imageString(image, record->name);
+    pop();
+    if (function->name == NULL) return NULL;
+  }
+
+  return function;
+}
+
+// -------------------- 校验字节码 -------------------------
+
+// 不是指令起始位置的字节(操作数)
+#define NOT_INSTRUCTION 0xff
+
+// 按照vm的方式解码指令时的状态
+typedef struct {
+  Chunk* chunk;
+  int next;         // 下一个要读取的字节
+  uint32_t wide;    // OP_WIDE前缀累积的高位字节
+  int wides;        // 前面连续的OP_WIDE前缀的个数
+} Decoder;
+
+static bool readByte(Decoder* decoder, uint32_t* byte) {
+  if (decoder->next >= decoder->chunk->count) return false;
+  *byte = decoder->chunk->code[decoder->next++];
+  return true;
+}
+
+// 同vm中的READ_ARG：读取一个可以被OP_WIDE扩展的操作数
+static bool readArg(Decoder* decoder, uint32_t* arg) {
+  if (!readByte(decoder, arg)) return false;
+  *arg |= decoder->wide;
+  decoder->wide = 0;
+  decoder->wides = 0;
+  return true;
+}
+
+static bool readShort(Decoder* decoder, uint32_t* value) {
+  uint32_t high;
+  uint32_t low;
+  if (!readByte(decoder, &high) || !readByte(decoder, &low)) return false;
+  *value = high << 8 | low;
+  return true;
+}
+
+static const Superinstruction* findSuperinstruction(uint8_t opcode) {
+  for (int i = 0; i < superinstructionCount; i++) {
+    if (superinstructions[i].opcode == opcode) return &superinstructions[i];
+  }
+  return NULL;
+}
+
+// 超级指令按第一条子指令解码
+static uint8_t baseOpcode(uint8_t opcode) {
+  const Superinstruction* pattern = findSuperinstruction(opcode);
+  return pattern != NULL ? pattern->ops[0] : opcode;
+}
+
+static bool isConstant(ValueArray* constants, uint32_t index) {
+  return index < (uint32_t)constants->count;
+}
+
+static bool isStringConstant(ValueArray* constants, uint32_t index) {
+  return isConstant(constants, index) && IS_STRING(constants->values[index]);
+}
+
+// 检查OP_CLOSURE之后每个闭包变量的描述：引用的局部变量或者闭包变量在当前函数中必须存在
+static bool verifyClosure(Decoder* decoder, ObjFunction* function, ObjFunction* nested) {
+  for (int i = 0; i < nested->upvalueCount + nested->captureCount; i++) {
+    uint32_t flags;
+    uint32_t index;
+    if (!readByte(decoder, &flags) || !readByte(decoder, &index)) return false;
+    if ((flags & ~(UPVALUE_LOCAL | UPVALUE_WIDE)) != 0) return false;
+    if (flags & UPVALUE_WIDE) {
+      uint32_t low;
+      if (!readByte(decoder, &low)) return false;
+      index = index << 8 | low;
+    }
+
+    uint32_t limit;
+    if (flags & UPVALUE_LOCAL) {
+      limit = (uint32_t)function->maxSlots;
+    } else if (i < nested->upvalueCount) {
+      limit = (uint32_t)function->upvalueCount;
+    } else {
+      limit = (uint32_t)function->captureCount;
+    }
+    if (index >= limit) return false;
+  }
+  return true;
+}
+
+// 解码一条指令并检查它的操作数，返回下一条指令的位置，指令不合法时返回-1
+static int verifyInstruction(Decoder* decoder, ObjFunction* function, uint8_t op) {
+  ValueArray* constants = &function->chunk.constants;
+  uint32_t arg;
+  uint32_t byte;
+  bool valid;
+
+  switch (op) {
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_PRINT:
+    case OP_CLOSE_UPVALUE:
+    case OP_RETURN:
+    case OP_INHERIT:
+      valid = true;
+      break;
+    case OP_CONSTANT:
+      valid = readArg(decoder, &arg) && isConstant(constants, arg);
+      break;
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+      valid = readArg(decoder, &arg) && arg < (uint32_t)function->maxSlots;
+      break;
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_CLASS:
+    case OP_METHOD:
+    case OP_IMPORT:
+      valid = readArg(decoder, &arg) && isStringConstant(constants, arg);
+      break;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+      valid = readArg(decoder, &arg) && isStringConstant(constants, arg) &&
+              readByte(decoder, &byte);
+      break;
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+      valid = readByte(decoder, &byte) && byte < (uint32_t)function->upvalueCount;
+      break;
+    case OP_GET_CAPTURED:
+      valid = readByte(decoder, &byte) && byte < (uint32_t)function->captureCount;
+      break;
+    case OP_CALL:
+      valid = readByte(decoder, &byte);
+      break;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+      valid = readShort(decoder, &arg);
+      break;
+    case OP_JUMP_FAR:
+    case OP_JUMP_IF_FALSE_FAR:
+    case OP_LOOP_FAR:
+      valid = readShort(decoder, &arg) && isConstant(constants, arg) &&
+              IS_NUMBER(constants->values[arg]);
+      break;
+    case OP_WIDE:
+      // 操作数最多三个字节，也就是最多两个前缀
+      valid = decoder->wides < 2 && readByte(decoder, &byte);
+      if (valid) {
+        decoder->wide = (decoder->wide | byte) << 8;
+        decoder->wides++;
+      }
+      return valid ? decoder->next : -1;
+    case OP_CLOSURE:
+      valid = readArg(decoder, &arg) && isConstant(constants, arg) &&
+              IS_FUNCTION(constants->values[arg]) &&
+              verifyClosure(decoder, function, AS_FUNCTION(constants->values[arg]));
+      break;
+    default:
+      // 未知的操作码，以及编译器不会生成的指令
+      valid = false;
+      break;
+  }
+
+  // OP_WIDE之后必须是一条读取操作数的指令，否则前缀会留给后面不相关的指令
+  if (decoder->wides > 0) valid = false;
+  return valid ? decoder->next : -1;
+}
+
+// 跳转指令的目标位置，距离不合法时返回-1
+static int64_t jumpTarget(Chunk* chunk, int offset, uint8_t op) {
+  uint32_t operand = (uint32_t)chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+  int64_t next = offset + 3;
+  switch (op) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      return next + operand;
+    case OP_LOOP:
+      return next - operand;
+    default: {
+      // 跳转距离保存在常量中，先检查范围再转换为整数
+      double distance = AS_NUMBER(chunk->constants.values[operand]);
+      if (!(distance >= 0 && distance <= chunk->count)) return -1;
+      return op == OP_LOOP_FAR ? next - (uint32_t)distance : next + (uint32_t)distance;
+    }
+  }
+}
+
+/*
+  在镜像中的函数第一次执行之前检查它的字节码，保证vm按照编译器生成的字节码的假设执行时不会越界：
+  - 操作码合法，操作数完整的在chunk之内，OP_WIDE前缀最多两个并且后面是读取操作数的指令
+  - 常量的下标在常量数组之内，并且是指令需要的类型(名称为字符串，OP_CLOSURE为函数，远跳转为数字)
+  - 局部变量的位置小于maxSlots，闭包变量的下标小于函数的upvalueCount/captureCount
+  - 跳转的目标是chunk内某条指令的起始位置
+  - 超级指令之后紧跟着它的其余子指令(vm执行时直接跳过这些操作码)
+  - 最后一条指令不会继续向后执行
+*/
+static bool verifyCode(ObjFunction* function) {
+  Chunk* chunk = &function->chunk;
+  int count = chunk->count;
+
+  // 每条指令起始位置上的操作码(超级指令为第一条子指令)，其余的字节为NOT_INSTRUCTION
+  uint8_t* ops = (uint8_t*)malloc(count);
+  if (ops == NULL) return false;
+  memset(ops, NOT_INSTRUCTION, count);
+
+  Decoder decoder = { chunk, 0, 0, 0 };
+  int last = 0;
+  bool valid = true;
+  while (valid && decoder.next < count) {
+    last = decoder.next;
+    uint8_t op = baseOpcode(chunk->code[decoder.next++]);
+    ops[last] = op;
+    valid = verifyInstruction(&decoder, function, op) >= 0;
+  }
+
+  valid = valid && (ops[last] == OP_RETURN || ops[last] == OP_JUMP || ops[last] == OP_LOOP ||
+                    ops[last] == OP_JUMP_FAR || ops[last] == OP_LOOP_FAR);
+
+  for (int offset = 0; valid && offset < count; offset++) {
+    uint8_t op = ops[offset];
+    if (op == NOT_INSTRUCTION) continue;
+
+    if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP ||
+        op == OP_JUMP_FAR || op == OP_JUMP_IF_FALSE_FAR || op == OP_LOOP_FAR) {
+      int64_t target = jumpTarget(chunk, offset, op);
+      valid = target >= 0 && target < count && ops[target] != NOT_INSTRUCTION;
+    }
+
+    const Superinstruction* pattern = findSuperinstruction(chunk->code[offset]);
+    int next = offset;
+    for (int i = 1; valid && pattern != NULL && i < pattern->length; i++) {
+      do {
+        next++;
+      } while (next < count && ops[next] == NOT_INSTRUCTION);
+      valid = next < count && ops[next] == pattern->ops[i];
+    }
+  }
+
+  free(ops);
+  return valid;
+}
+
+bool loadImageFunction(ObjFunction* function) {
+  Image* image = function->image;
+  const ImageHeader* header = imageHeader(image);
+  const ImageFunction* record = (const ImageFunction*)imageRecord(
+      image, header->functionsOffset, function->imageIndex, sizeof(ImageFunction));
+  if (record == NULL || record->constantCount > MAX_CONSTANTS ||
+      record->firstConstant > header->constantCount ||
+      record->constantCount > header->constantCount - record->firstConstant) {
+    return false;
+  }
+
+  // 先按照最终的大小分配常量数组并填充nil，这样加载过程中触发GC时数组中总是有效的值
+  ValueArray* constants = &function->chunk.constants;
+  int count = (int)record->constantCount;
+  constants->values = ALLOCATE(Value, count);
+  constants->capacity = count;
+  for (int i = 0; i < count; i++) {
+    constants->values[i] = NIL_VAL;
+  }
+  constants->count = count;
+
+  for (int i = 0; i < count; i++) {
+    const ImageConstant* constant = (const ImageConstant*)imageRecord(
+        image, header->constantsOffset, record->firstConstant + i, sizeof(ImageConstant));
+    if (constant == NULL) return false;
+
+    switch (constant->type) {
+      case CONSTANT_NUMBER:
+        constants->values[i] = NUMBER_VAL(constant->as.number);
+        break;
+      case CONSTANT_SHORT_STRING:
+        if ((int64_t)constant->index > SHORT_STRING_MAX) return false;
+        constants->values[i] = copyStringValue(constant->as.chars, (int)constant->index);
+        break;
+      case CONSTANT_STRING: {
+        ObjString* string = imageString(image, constant->index);
+        if (string == NULL) return false;
+        constants->values[i] = OBJ_VAL(string);
+        break;
+      }
+      case CONSTANT_FUNCTION: {
+        ObjFunction* nested = newImageFunction(image, constant->index);
+        if (nested == NULL) return false;
+        constants->values[i] = OBJ_VAL(nested);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+
+  if (!verifyCode(function)) return false;
+
+  function->image = NULL;
+  return true;
+}
+
+// 检查文件头：格式版本、指令集和源码都一致时镜像才是新鲜的，并且所有的记录数组都在文件范围之内
+static bool checkHeader(Image* image, bool checkSource, uint64_t sourceHash) {
+  if (image->size < sizeof(ImageHeader)) return false;
+
+  const ImageHeader* header = imageHeader(image);
+  return memcmp(header->magic, IMAGE_MAGIC, 4) == 0 &&
+         header->version == IMAGE_VERSION &&
+         header->fingerprint == instructionSetFingerprint() &&
+         (!checkSource || header->sourceHash == sourceHash) &&
+         header->checksum == imageChecksum(image->base + sizeof(ImageHeader),
+                                           image->size - sizeof(ImageHeader)) &&
+         header->functionCount > 0 &&
+         header->functionsOffset % sizeof(uint64_t) == 0 &&
+         header->constantsOffset % sizeof(uint64_t) == 0 &&
+         header->stringsOffset % sizeof(uint32_t) == 0 &&
+         inImage(image, header->functionsOffset,
+                 sizeof(ImageFunction) * (uint64_t)header->functionCount) &&
+         inImage(image, header->constantsOffset,
+                 sizeof(ImageConstant) * (uint64_t)header->constantCount) &&
+         inImage(image, header->stringsOffset,
+                 sizeof(ImageString) * (uint64_t)header->stringCount);
+}
+
+ObjFunction* readImage(const char* path, bool checkSource, uint64_t sourceHash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // 只读的私有映射，多个进程映射同一个文件时共享page cache中的同一份内存
+  void* base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  Image* image = (Image*)malloc(sizeof(Image));
+  image->base = (uint8_t*)base;
+  image->size = info.st_size;
+
+  // 顶级函数没有外层函数，也没有参数，并且在这里就加载和检查，这样损坏的镜像只会被当作缓存不存在
+  ObjFunction* function = NULL;
+  if (checkHeader(image, checkSource, sourceHash)) {
+    function = newImageFunction(image, 0);
+  }
+  if (function != NULL) {
+    push(OBJ_VAL(function));
+    if (function->arity != 0 || function->upvalueCount != 0 || function->captureCount != 0 ||
+        !loadImageFunction(function)) {
+      function = NULL;
+    }
+    pop();
+  }
+
+  if (function == NULL) {
+    munmap(image->base, image->size);
+    free(image);
+    return NULL;
+  }
+
+  image->next = images;
+  images = image;
+  return function;
+}
+
+ObjFunction* compileWithCache(const char* path, const char* source, bool lazy) {
+  if (getenv("LOX_NO_CACHE") != NULL) return compile(source, lazy);
+
+  // 优先读取字节码缓存，缓存不存在或者已经过期时重新编译，并写入新的缓存
+  uint64_t sourceHash = hashSource(source);
+  char* cachePath = imagePath(path, sourceHash);
+  ObjFunction* function = readImage(cachePath, true, sourceHash);
+  if (function == NULL) {
+    function = compile(source, lazy);
+    // 延迟编译时函数体还没有编译，不能写入缓存
+    if (function != NULL && !lazy) writeImage(cachePath, function, sourceHash);
+  }
+  free(cachePath);
+  return function;
+}
+
+void freeImages() {
+  while (images != NULL) {
+    Image* next = images->next;
+    munmap(images->base, images->size);
+    free(images);
+    images = next;
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "common.h"
+#include "object.h"
+
+/*
+  字节码镜像(.loxc)：将编译得到的顶级函数(以及常量中嵌套的函数)序列化到文件中，
+  下次执行同一份源码时直接读取，跳过词法分析和编译。
+
+  文件头中记录了源码的hash，以及指令集的指纹(超级指令重新生成之后操作码会变化)，
+  任意一个不一致则视为缓存过期，重新编译。
+
+  镜像通过mmap只读的映射到内存中，函数的code和lines直接指向映射的内存，不会复制；
+  函数的常量(字符串的intern以及嵌套的函数对象)在函数第一次被调用时才加载，同时检查函数的字节码。
+  启动时只需要顺序读一遍文件计算校验和，同一台机器上的多个clox进程也共享同一份page cache。
+  校验和不一致或者结构损坏的镜像视为缓存不存在，嵌套函数的字节码损坏时调用该函数会报错，都不会执行损坏的字节码。
+*/
+
+typedef struct sImage {
+  uint8_t* base;        // 映射的起始地址
+  size_t size;          // 映射的大小
+  struct sImage* next;  // 所有已经映射的镜像组成的链表，在freeVM时统一解除映射
+} Image;
+
+// 源码内容的hash(64位FNV-1a)，用于判断缓存是否新鲜
+uint64_t hashSource(const char* source);
+
+// 指令集指纹：所有操作码的名称和顺序，以及Value的表示方式
+// 重新生成超级指令或者修改了指令之后，旧的镜像(以及堆快照)会自动失效
+uint32_t instructionSetFingerprint();
+
+// 缓存文件的路径：默认在源码旁边(script.lox -> script.loxc)，
+// 如果设置了环境变量LOX_CACHE_DIR，则为 $LOX_CACHE_DIR/<源码hash>.loxc
+// 返回的字符串需要调用者free
+char* imagePath(const char* sourcePath, uint64_t sourceHash);
+
+// 映射镜像并返回其中的顶级函数，文件不存在、已过期或者损坏时返回NULL
+// checkSource为false时不检查源码的hash(直接执行.loxc文件)
+ObjFunction* readImage(const char* path, bool checkSource, uint64_t sourceHash);
+
+// 写入镜像，失败时(例如目录不可写)返回false
+bool writeImage(const char* path, ObjFunction* function, uint64_t sourceHash);
+
+// 加载来自镜像的函数的常量并检查它的字节码，在函数第一次被调用之前执行，镜像损坏时返回false
+bool loadImageFunction(ObjFunction* function);
+
+// 编译源码文件(主脚本或者import的模块)，优先使用字节码缓存，缓存不存在或者已经过期时编译并写入新的缓存
+// 设置了环境变量LOX_NO_CACHE时既不读取也不写入缓存
+ObjFunction* compileWithCache(const char* path, const char* source, bool lazy);
+
+// 解除所有镜像的映射
+void freeImages();
+
+#endif
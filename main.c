@@ -4,21 +4,101 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "compiler.h"
+#include "image.h"
+#include "snapshot.h"
 #include "vm.h"
 #include "debug.h"
 
+// 读取一整行追加到缓冲区的末尾(包括换行符)，行的长度没有限制，读到文件末尾时返回false
+static bool readLine(char** buffer, size_t* length, size_t* capacity) {
+  size_t start = *length;
+  for (;;) {
+    if (*capacity - *length < 256) {
+      *capacity = *capacity < 1024 ? 1024 : *capacity * 2;
+      *buffer = (char*)realloc(*buffer, *capacity);
+      if (*buffer == NULL) {
+        fprintf(stderr, "Not enough memory to read input.\n");
+        exit(74);
+      }
+    }
+
+    if (!fgets(*buffer + *length, (int)(*capacity - *length), stdin)) {
+      (*buffer)[*length] = '\0';
+      return *length > start;
+    }
+    *length += strlen(*buffer + *length);
+    if ((*buffer)[*length - 1] == '\n') return true;
+  }
+}
+
+static bool isBlank(const char* line) {
+  for (; *line != '\0'; line++) {
+    if (*line != ' ' && *line != '\t' && *line != '\r' && *line != '\n') return false;
+  }
+  return true;
+}
+
+// 统计源码的前length个字节中的换行符个数
+static int countLines(const char* source, size_t length) {
+  int lines = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (source[i] == '\n') lines++;
+  }
+  return lines;
+}
+
+// 交互式执行：输入不是完整的语句(括号没有闭合，或者没有以;或者}结尾)时继续读取下一行，
+// 完整之后一起编译执行。以}结尾的语句要看到下一行的第一个token才执行，是else或者.时继续读取。
+// 输入一个空行可以强制执行(由编译器报告错误)
+// 之前输入的行不会被重复扫描，粘贴一大段定义时也只需要扫描一遍
 static void repl() {
-  char line[1024];
+  char* buffer = NULL;
+  size_t length = 0;
+  size_t capacity = 0;
+  // 已经执行过的行数，使错误信息中的行号和输入的行号一致
+  int line = 1;
+  InputState state;
+  initInputState(&state);
 
   for (;;) {
-    printf("> ");
-    if (!fgets(line, sizeof(line), stdin)) {
-      printf("\n");
-      break;
+    printf(state.hasTokens ? "... " : "> ");
+    size_t start = length;
+    bool atEnd = !readLine(&buffer, &length, &capacity);
+    if (atEnd) printf("\n");
+
+    // 输入结束或者空行时强制执行缓冲区中剩下的源码
+    bool forced = atEnd || isBlank(buffer + start);
+    // 新的一行可能结束了上一条以}结尾的语句，剩下的部分属于下一条语句，需要继续判断
+    while (length > 0) {
+      bool complete = isInputComplete(&state, buffer);
+      if (!complete && !(forced && state.hasTokens)) {
+        // 只有空白和注释的输入直接丢弃
+        if (!state.hasTokens) {
+          line += countLines(buffer, length);
+          length = 0;
+          initInputState(&state);
+        }
+        break;
+      }
+
+      size_t end = complete ? (size_t)state.end : length;
+      char next = buffer[end];
+      buffer[end] = '\0';
+      ObjFunction* function = compileFrom(buffer, line, false);
+      if (function != NULL) interpretFunction(function);
+      buffer[end] = next;
+
+      line += countLines(buffer, end);
+      memmove(buffer, buffer + end, length - end + 1);
+      length -= end;
+      initInputState(&state);
     }
 
-    interpret(line);
+    if (atEnd) break;
   }
+
+  free(buffer);
 }
 
 static char* readFile(const char* path) {
@@ -52,10 +132,32 @@ static char* readFile(const char* path) {
   return buffer;
 }
 
-static void runFile(const char* path) {
+// 直接执行编译好的字节码镜像
+static void runImage(const char* path) {
+  ObjFunction* function = readImage(path, false, 0);
+  if (function == NULL) {
+    fprintf(stderr, "Could not load bytecode image \"%s\".\n", path);
+    exit(74);
+  }
+
+  InterpretResult result = interpretFunction(function);
+  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+static void runFile(const char* path, bool lazy) {
+  setScriptPath(path);
+  size_t length = strlen(path);
+  if (length >= 5 && strcmp(path + length - 5, ".loxc") == 0) {
+    runImage(path);
+    return;
+  }
+
   char* source = readFile(path);
-  InterpretResult result = interpret(source);
-  // 必须手动释放内存
+  ObjFunction* function = compileWithCache(path, source, lazy);
+
+  InterpretResult result = function == NULL
+      ? INTERPRET_COMPILE_ERROR : interpretFunction(function);
+  // 必须手动释放内存，延迟编译的函数在执行过程中还需要源码，因此执行完之后才能释放
   free(source);
 
   if (result == INTERPRET_COMPILE_ERROR) exit(65);
@@ -63,14 +165,110 @@ static void runFile(const char* path) {
 }
 
 
+// 流式执行每次至少读取的字节数
+#define STREAM_CHUNK (1024 * 1024)
+
+// 流式执行：按块读取源码，每读到若干条完整的顶级语句就编译执行这一段，然后丢弃这段源码。
+// 全局变量保存在vm中，因此后面的语句可以使用前面定义的变量和函数；
+// 每一段的顶级代码执行完之后不再被引用，会被GC回收，不需要一次性读入和编译整个文件
+static void runStream(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+  setScriptPath(path);
+
+  size_t capacity = STREAM_CHUNK;
+  size_t length = 0;
+  char* buffer = (char*)malloc(capacity + 1);
+  int line = 1;
+  bool atEnd = false;
+
+  while (!atEnd) {
+    // 一条语句可能非常长，每次读取的大小随缓冲区中未执行的源码一起增长，避免反复扫描同一段源码
+    size_t want = length > STREAM_CHUNK ? length : STREAM_CHUNK;
+    if (capacity < length + want) {
+      capacity = length + want;
+      buffer = (char*)realloc(buffer, capacity + 1);
+    }
+    if (buffer == NULL) {
+      fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+      exit(74);
+    }
+
+    size_t bytesRead = fread(buffer + length, sizeof(char), want, file);
+    if (bytesRead < want) {
+      if (ferror(file)) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+      }
+      atEnd = true;
+    }
+    length += bytesRead;
+    buffer[length] = '\0';
+
+    // 读完之后剩下的源码全部执行(包括不完整的语句，由编译器报告错误)
+    size_t end = atEnd ? length : (size_t)completeStatements(buffer);
+    if (end == 0) continue;
+
+    char next = buffer[end];
+    buffer[end] = '\0';
+    ObjFunction* function = compileFrom(buffer, line, false);
+    InterpretResult result = function == NULL
+        ? INTERPRET_COMPILE_ERROR : interpretFunction(function);
+    buffer[end] = next;
+
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+
+    for (size_t i = 0; i < end; i++) {
+      if (buffer[i] == '\n') line++;
+    }
+    memmove(buffer, buffer + end, length - end);
+    length -= end;
+  }
+
+  free(buffer);
+  fclose(file);
+}
+
+// 从堆快照中恢复，然后从snapshot()返回的地方继续执行
+static void runSnapshot(const char* path) {
+  if (!restoreSnapshot(path)) {
+    fprintf(stderr, "Could not load snapshot \"%s\".\n", path);
+    exit(74);
+  }
+
+  InterpretResult result = resume();
+  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
 int main(int argc, const char* argv[]) {
   initVM();
   if (argc == 1) {
     repl();
   } else if (argc == 2) {
-    runFile(argv[1]);
+    runFile(argv[1], false);
+  } else if (argc == 3 && strcmp(argv[1], "--lazy") == 0) {
+    // 全局函数在第一次调用时才编译
+    runFile(argv[2], true);
+  } else if (argc == 4 && strcmp(argv[1], "--snapshot") == 0) {
+    // 执行到snapshot()时写入快照并退出
+    vm.snapshotPath = argv[2];
+    runFile(argv[3], false);
+    fprintf(stderr, "Script finished without calling snapshot().\n");
+    exit(70);
+  } else if (argc == 3 && strcmp(argv[1], "--from-snapshot") == 0) {
+    runSnapshot(argv[2]);
+  } else if (argc == 3 && strcmp(argv[1], "--stream") == 0) {
+    // 边读取边执行，用于非常大的(生成的)脚本
+    runStream(argv[2]);
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
+    fprintf(stderr, "Usage: clox [--lazy] [path]\n"
+                    "       clox --snapshot out.img path\n"
+                    "       clox --from-snapshot out.img\n"
+                    "       clox --stream path\n");
     exit(64);
   }
   freeVM();
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "table.h"
 #include "compiler.h"
+#include "snapshot.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
@@ -13,20 +14,34 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
+// 当前线程的分配目标，为NULL时为vm的堆
+static _Thread_local Heap* threadHeap = NULL;
+
 void* reallocate(void* previous, size_t oldSize, size_t newSize) {
+  // 独立的堆中的分配只记录使用量，合并之前不会被回收
+  if (threadHeap != NULL) {
+    threadHeap->bytesAllocated += newSize - oldSize;
+    if (newSize == 0) {
+      free(previous);
+      return NULL;
+    }
+    return realloc(previous, newSize);
+  }
+
   // 更新堆内存使用量的值
   vm.bytesAllocated += newSize - oldSize;
 
   // 在debug模式下，每次新分配了内存之前都跑一次垃圾回收(bad)
+  // 注意只在分配内存的时候回收，释放内存(例如sweep中的freeObject)时不能再次触发垃圾回收
   if (newSize > oldSize) {
     #ifdef DEBUG_STRESS_GC
       collectGarbage();
     #endif
-  }
 
-  // 每次当总内存使用量超过了下一次垃圾回收的阈值时，我们跑一次垃圾回收
-  if (vm.bytesAllocated > vm.nextGC) {
-    collectGarbage();
+    // 每次当总内存使用量超过了下一次垃圾回收的阈值时，我们跑一次垃圾回收
+    if (vm.bytesAllocated > vm.nextGC) {
+      collectGarbage();
+    }
   }
 
   if (newSize == 0) {
@@ -37,6 +52,84 @@ void* reallocate(void* previous, size_t oldSize, size_t newSize) {
   return realloc(previous, newSize);                              
 }
 
+void initHeap(Heap* heap) {
+  heap->objects = NULL;
+  initTable(&heap->strings);
+  heap->bytesAllocated = 0;
+}
+
+Heap* useHeap(Heap* heap) {
+  Heap* previous = threadHeap;
+  threadHeap = heap;
+  return previous;
+}
+
+Heap* currentHeap() {
+  return threadHeap;
+}
+
+// 将字符串替换为它在vm.strings中对应的字符串(合并时记录在heap->strings的值中)
+static ObjString* mergedString(Heap* heap, ObjString* string) {
+  Value merged;
+  if (string != NULL && tableGet(&heap->strings, string, &merged)) {
+    return AS_STRING(merged);
+  }
+  return string;
+}
+
+void mergeHeap(Heap* heap) {
+  // 合并期间的分配(vm.strings扩容)也记入heap，因此不会触发GC：
+  // 此时heap中的对象还不在vm.objects中，也还没有被任何根对象引用
+  Heap* previous = useHeap(heap);
+
+  // 1. 将heap中的字符串intern到vm.strings，已经存在的字符串使用vm中的那一个
+  for (int i = 0; i < heap->strings.capacity; i++) {
+    Entry* entry = &heap->strings.entries[i];
+    if (entry->key == NULL) continue;
+    ObjString* string = entry->key;
+    ObjString* interned = tableFindString(&vm.strings, string->chars,
+                                          string->length, string->hash);
+    if (interned == NULL) {
+      tableSet(&vm.strings, string, NIL_VAL);
+      interned = string;
+    }
+    entry->value = OBJ_VAL(interned);
+  }
+
+  // 2. 编译器只会分配字符串和函数，将函数引用的字符串替换为intern之后的字符串
+  for (Obj* object = heap->objects; object != NULL; object = object->next) {
+    if (object->type != OBJ_FUNCTION) continue;
+    ObjFunction* function = (ObjFunction*)object;
+    function->name = mergedString(heap, function->name);
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+      if (IS_STRING(constants->values[i])) {
+        constants->values[i] = OBJ_VAL(mergedString(heap, AS_STRING(constants->values[i])));
+      }
+    }
+  }
+
+  useHeap(previous);
+  vm.bytesAllocated += heap->bytesAllocated;
+
+  // 3. 将对象移动到vm.objects中，重复的字符串直接释放
+  Obj* object = heap->objects;
+  while (object != NULL) {
+    Obj* next = object->next;
+    if (object->type == OBJ_STRING &&
+        mergedString(heap, (ObjString*)object) != (ObjString*)object) {
+      freeObject(object);
+    } else {
+      object->next = vm.objects;
+      vm.objects = object;
+    }
+    object = next;
+  }
+
+  freeTable(&heap->strings);
+  initHeap(heap);
+}
+
 void freeObject(Obj* object) {
 
   // debug模式下，每次释放对象内存之前都打印该对象的内存信息
@@ -65,6 +158,7 @@ void freeObject(Obj* object) {
       // free upvalues数组
       ObjClosure* closure = (ObjClosure*)object;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
+      FREE_ARRAY(Value, closure->captured, closure->capturedCount);
       // free对象本身
       FREE(ObjClosure, object);
       break;
@@ -96,6 +190,27 @@ void freeObject(Obj* object) {
       FREE(ObjBoundMethod, object);
       break;
     }
+    case OBJ_MODULE: {
+      ObjModule* module = (ObjModule*)object;
+      // 释放模块的全局变量表
+      freeTable(&module->globals);
+      FREE(ObjModule, object);
+      break;
+    }
+    case OBJ_ROPE: {
+      FREE(ObjRope, object);
+      break;
+    }
+    case OBJ_STRING_BUILDER: {
+      ObjStringBuilder* builder = (ObjStringBuilder*)object;
+      FREE_ARRAY(char, builder->chars, builder->capacity);
+      FREE(ObjStringBuilder, object);
+      break;
+    }
+    case OBJ_STRING_VIEW: {
+      FREE(ObjStringView, object);
+      break;
+    }
   }
 }
 
@@ -158,20 +273,25 @@ static void markRoots() {
   }
 
   // 所有的在调用帧中的runtime函数也为根对象
+  // 还存在栈中引用的闭包对象都是根对象
   for (int i = 0; i < vm.frameCount; i++) {
     markObject((Obj*)vm.frames[i].closure);
-  }
-  
-  // 还存在栈中引用的闭包对象都是根对象
-  for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
-    markObject((Obj*)upvalue);
+    for (ObjUpvalue* upvalue = vm.frames[i].openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+      markObject((Obj*)upvalue);
+    }
   }
 
   // 自然的，所有全局变量和其中的内置函数也被视为根对象
   markTable(&vm.globals);
+  markTable(&vm.natives);
 
-  // 编译期间产生的函数对象也为根对象
-  markCompilerRoots();
+  // 已经导入的模块
+  markTable(&vm.modules);
+  markObject((Obj*)vm.scriptDirectory);
+
+  // 从快照中恢复的对象在恢复完成之前也为根对象
+  markSnapshotRoots();
 
   markObject((Obj*)vm.initString);
 
@@ -212,9 +332,13 @@ static void blackenObject(Obj* object) {
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*)object;
       markObject((Obj*)closure->function);
+      markObject((Obj*)closure->module);
       for (int i = 0; i < closure->upvalueCount; i++) {
         markObject((Obj*)closure->upvalues[i]);
       }
+      for (int i = 0; i < closure->capturedCount; i++) {
+        markValue(closure->captured[i]);
+      }
       break;
     }
 
@@ -242,9 +366,37 @@ static void blackenObject(Obj* object) {
       break;
     }
 
-    // 字符串对象和native对象是不存在引用的
+    // 模块的名称、所在的目录和全局变量
+    case OBJ_MODULE: {
+      ObjModule* module = (ObjModule*)object;
+      markObject((Obj*)module->name);
+      markObject((Obj*)module->directory);
+      markTable(&module->globals);
+      break;
+    }
+
+    // 内置函数的名字
     case OBJ_NATIVE:
+      markObject((Obj*)((ObjNative*)object)->name);
+      break;
+
+    // 字符串连接的两部分，展开之后只引用展开的结果
+    case OBJ_ROPE: {
+      ObjRope* rope = (ObjRope*)object;
+      markValue(rope->left);
+      markValue(rope->right);
+      markObject((Obj*)rope->flat);
+      break;
+    }
+
+    // 子串引用的字符串
+    case OBJ_STRING_VIEW:
+      markObject((Obj*)((ObjStringView*)object)->string);
+      break;
+
+    // 字符串对象和字符串缓冲区是不存在引用的
     case OBJ_STRING:
+    case OBJ_STRING_BUILDER:
       break;
   }
 }
@@ -20,7 +20,28 @@
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
+/*
+  独立的堆：编译器在自己的堆中分配对象和内存，编译期间既不会访问vm，也不会触发GC，
+  因此多个线程可以同时编译。编译结束之后在主线程中调用mergeHeap将其合并到vm的堆中。
+*/
+typedef struct {
+  // 在这个堆中分配的对象
+  Obj* objects;
+  // 在这个堆中intern的字符串，合并时再intern到vm.strings中
+  Table strings;
+  // 这个堆中分配的内存
+  size_t bytesAllocated;
+} Heap;
+
 void* reallocate(void* previous, size_t oldSize, size_t newSize);
+void initHeap(Heap* heap);
+// 之后当前线程中的所有分配都记入heap，传入NULL时恢复为vm的堆，返回之前的堆
+Heap* useHeap(Heap* heap);
+// 当前线程正在使用的独立的堆，为NULL时为vm的堆
+Heap* currentHeap();
+// 将heap中的对象合并到vm的堆中：字符串intern到vm.strings，引用了重复字符串的地方改为引用已有的字符串
+// 只能在主线程中调用
+void mergeHeap(Heap* heap);
 void markValue(Value value);
 void markObject(Obj* obj);
 void markTable(Table* table);
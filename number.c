@@ -0,0 +1,467 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+
+// -------------------- 解析 -------------------------
+
+// 10的0-22次方都可以用double精确表示
+static const double exactPowersOf10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// 通用的解析：strtod是正确舍入的，因此结果与快速路径以及其他平台上的结果一致
+static double parseNumberSlow(const char* start, int length) {
+  // 字面量后面紧跟着的字符(例如e)不能被strtod当作数字的一部分，需要复制出来
+  char small[64];
+  char* copy = length < (int)sizeof(small) ? small : (char*)malloc(length + 1);
+  memcpy(copy, start, length);
+  copy[length] = '\0';
+
+  double value = strtod(copy, NULL);
+  if (copy != small) free(copy);
+  return value;
+}
+
+double parseNumber(const char* start, int length) {
+  // 快速路径(Clinger)：所有数字组成的整数不超过2^53并且小数不超过22位时，
+  // 这个整数和10的幂都可以精确表示，IEEE的除法保证结果是正确舍入的
+  uint64_t mantissa = 0;
+  int fractionDigits = 0;
+  bool fraction = false;
+
+  for (int i = 0; i < length; i++) {
+    if (start[i] == '.') {
+      fraction = true;
+      continue;
+    }
+
+    int digit = start[i] - '0';
+    if (mantissa > ((UINT64_C(1) << 53) - digit) / 10) {
+      return parseNumberSlow(start, length);
+    }
+    mantissa = mantissa * 10 + digit;
+    if (fraction) fractionDigits++;
+  }
+
+  if (fractionDigits > 22) return parseNumberSlow(start, length);
+  return (double)mantissa / exactPowersOf10[fractionDigits];
+}
+
+// -------------------- 格式化 -------------------------
+
+/*
+  使用Ryu算法(Ulf Adams, 2018)计算最短的十进制表示：
+  设double的值为 m2 * 2^e2，它的舍入区间内的所有实数都会被解析为这个double，
+  Ryu将区间的上下界和值本身乘以5的幂(或者5的幂的倒数)转换为十进制，然后不断去掉末位，
+  直到上下界之间不再有更短的数为止，最后得到区间内最短并且最接近真实值的十进制数 output * 10^e10。
+  全部使用64位整数运算，结果不依赖于平台和C库。
+*/
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+
+// 5的幂表的精度(位数)和大小
+#define POW5_BITCOUNT 125
+#define POW5_INV_BITCOUNT 125
+#define POW5_TABLE_SIZE 326
+#define POW5_INV_TABLE_SIZE 342
+
+/*
+  5^i保留最高的125位：pow5Split[i] = floor(5^i / 2^(len(5^i) - 125))
+  5^-i放大之后向上取整：pow5InvSplit[i] = floor(2^(len(5^i) - 1 + 125) / 5^i) + 1
+  用低64位和高64位两个整数表示。表在第一次用到某一项时才计算(见bigint)，
+  之后只读，只有执行print的线程会用到它们
+*/
+static uint64_t pow5Split[POW5_TABLE_SIZE][2];
+static bool pow5SplitReady[POW5_TABLE_SIZE];
+static uint64_t pow5InvSplit[POW5_INV_TABLE_SIZE][2];
+static bool pow5InvSplitReady[POW5_INV_TABLE_SIZE];
+
+// 计算表项用的大整数，2^(len(5^341) - 1 + 125)不超过1024位
+#define BIGINT_LIMBS 32
+
+typedef struct {
+  uint32_t limbs[BIGINT_LIMBS]; // 低位在前
+  int count;
+} BigInt;
+
+static void bigPow5(BigInt* big, int exponent) {
+  big->limbs[0] = 1;
+  big->count = 1;
+  for (int i = 0; i < exponent; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < big->count; j++) {
+      uint64_t product = (uint64_t)big->limbs[j] * 5 + carry;
+      big->limbs[j] = (uint32_t)product;
+      carry = product >> 32;
+    }
+    if (carry != 0) big->limbs[big->count++] = (uint32_t)carry;
+  }
+}
+
+static int bigBitLength(const BigInt* big) {
+  uint32_t top = big->limbs[big->count - 1];
+  int bits = 0;
+  while (top != 0) {
+    bits++;
+    top >>= 1;
+  }
+  return (big->count - 1) * 32 + bits;
+}
+
+static int bigBit(const BigInt* big, int index) {
+  if (index < 0 || index >= big->count * 32) return 0;
+  return (big->limbs[index / 32] >> (index % 32)) & 1;
+}
+
+static int bigCompare(const BigInt* a, const BigInt* b) {
+  if (a->count != b->count) return a->count < b->count ? -1 : 1;
+  for (int i = a->count - 1; i >= 0; i--) {
+    if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+// a = a * 2 + bit
+static void bigShiftIn(BigInt* a, int bit) {
+  uint32_t carry = (uint32_t)bit;
+  for (int i = 0; i < a->count; i++) {
+    uint32_t next = a->limbs[i] >> 31;
+    a->limbs[i] = (a->limbs[i] << 1) | carry;
+    carry = next;
+  }
+  if (carry != 0) a->limbs[a->count++] = carry;
+}
+
+// a = a - b，要求a >= b
+static void bigSubtract(BigInt* a, const BigInt* b) {
+  int64_t borrow = 0;
+  for (int i = 0; i < a->count; i++) {
+    int64_t difference = (int64_t)a->limbs[i] - (i < b->count ? b->limbs[i] : 0) - borrow;
+    borrow = difference < 0;
+    a->limbs[i] = (uint32_t)(difference + (borrow << 32));
+  }
+  while (a->count > 1 && a->limbs[a->count - 1] == 0) a->count--;
+}
+
+static const uint64_t* getPow5Split(int i) {
+  if (!pow5SplitReady[i]) {
+    BigInt pow;
+    bigPow5(&pow, i);
+    int shift = bigBitLength(&pow) - POW5_BITCOUNT;
+    uint64_t split[2] = { 0, 0 };
+    for (int bit = 0; bit < POW5_BITCOUNT; bit++) {
+      split[bit / 64] |= (uint64_t)bigBit(&pow, shift + bit) << (bit % 64);
+    }
+    pow5Split[i][0] = split[0];
+    pow5Split[i][1] = split[1];
+    pow5SplitReady[i] = true;
+  }
+  return pow5Split[i];
+}
+
+static const uint64_t* getPow5InvSplit(int i) {
+  if (!pow5InvSplitReady[i]) {
+    BigInt pow;
+    bigPow5(&pow, i);
+    int top = bigBitLength(&pow) - 1 + POW5_INV_BITCOUNT;
+
+    // 逐位做除法 2^top / 5^i，商不超过126位
+    BigInt remainder;
+    remainder.limbs[0] = 0;
+    remainder.count = 1;
+    uint64_t quotient[2] = { 0, 0 };
+    for (int bit = top; bit >= 0; bit--) {
+      bigShiftIn(&remainder, bit == top);
+      if (bigCompare(&remainder, &pow) >= 0) {
+        bigSubtract(&remainder, &pow);
+        quotient[bit / 64] |= UINT64_C(1) << (bit % 64);
+      }
+    }
+
+    // 加一
+    quotient[0]++;
+    if (quotient[0] == 0) quotient[1]++;
+    pow5InvSplit[i][0] = quotient[0];
+    pow5InvSplit[i][1] = quotient[1];
+    pow5InvSplitReady[i] = true;
+  }
+  return pow5InvSplit[i];
+}
+
+// ceil(log2(5^e))，e在[0, 3528]之间时成立
+static int pow5bits(int e) {
+  return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))，e在[0, 1650]之间时成立
+static uint32_t log10Pow2(int e) {
+  return ((uint32_t)e * 78913) >> 18;
+}
+
+// floor(log10(5^e))，e在[0, 2620]之间时成立
+static uint32_t log10Pow5(int e) {
+  return ((uint32_t)e * 732923) >> 20;
+}
+
+static uint32_t pow5Factor(uint64_t value) {
+  uint32_t count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count;
+}
+
+static bool multipleOfPowerOf5(uint64_t value, uint32_t p) {
+  return pow5Factor(value) >= p;
+}
+
+static bool multipleOfPowerOf2(uint64_t value, uint32_t p) {
+  return (value & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+// 64位乘64位得到128位，不依赖于编译器的128位整数
+static uint64_t multiply128(uint64_t a, uint64_t b, uint64_t* high) {
+  uint64_t aLow = (uint32_t)a;
+  uint64_t aHigh = a >> 32;
+  uint64_t bLow = (uint32_t)b;
+  uint64_t bHigh = b >> 32;
+
+  uint64_t lowLow = aLow * bLow;
+  uint64_t lowHigh = aLow * bHigh;
+  uint64_t highLow = aHigh * bLow;
+  uint64_t highHigh = aHigh * bHigh;
+
+  uint64_t middle1 = highLow + (lowLow >> 32);
+  uint64_t middle2 = lowHigh + (uint32_t)middle1;
+  *high = highHigh + (middle1 >> 32) + (middle2 >> 32);
+  return (middle2 << 32) | (uint32_t)lowLow;
+}
+
+// (m * mul) >> j，mul为125位，j在[64, 128)之间
+static uint64_t mulShift64(uint64_t m, const uint64_t* mul, int j) {
+  uint64_t high1;
+  uint64_t low1 = multiply128(m, mul[1], &high1);
+  uint64_t high0;
+  multiply128(m, mul[0], &high0);
+  uint64_t sum = high0 + low1;
+  if (sum < high0) high1++;
+
+  int shift = j - 64;
+  if (shift == 0) return sum;
+  return (high1 << (64 - shift)) | (sum >> shift);
+}
+
+// 计算最短的十进制表示 output * 10^exponent，value必须是有限的正数
+static void shortestDecimal(uint64_t ieeeMantissa, uint32_t ieeeExponent,
+                            uint64_t* output, int* exponent) {
+  int e2;
+  uint64_t m2;
+  if (ieeeExponent == 0) {
+    // 非规格化数
+    e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+    m2 = ieeeMantissa;
+  } else {
+    e2 = (int)ieeeExponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+    m2 = (UINT64_C(1) << DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+  }
+  // 尾数为偶数时舍入区间包含两个端点(解析时向偶数舍入)
+  bool acceptBounds = (m2 & 1) == 0;
+
+  // 区间的下界 mm、值 mv、上界 mp，都乘以了4(e2中减去了2)
+  // 2的整数次幂与下面一个数之间的间隔只有与上面的数的一半
+  uint64_t mv = 4 * m2;
+  uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+  // 转换为十进制：vr * 10^e10 = mv * 2^e2，vp和vm同理
+  uint64_t vr, vp, vm;
+  int e10;
+  bool vmIsTrailingZeros = false;
+  bool vrIsTrailingZeros = false;
+
+  if (e2 >= 0) {
+    uint32_t q = log10Pow2(e2) - (e2 > 3);
+    e10 = (int)q;
+    int k = POW5_INV_BITCOUNT + pow5bits((int)q) - 1;
+    int i = -e2 + (int)q + k;
+    const uint64_t* mul = getPow5InvSplit((int)q);
+    vr = mulShift64(4 * m2, mul, i);
+    vp = mulShift64(4 * m2 + 2, mul, i);
+    vm = mulShift64(4 * m2 - 1 - mmShift, mul, i);
+
+    if (q <= 21) {
+      // 只有这种情况下被去掉的部分可能全部为0，需要精确地判断
+      if (mv % 5 == 0) {
+        vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+      } else if (acceptBounds) {
+        vmIsTrailingZeros = multipleOfPowerOf5(mv - 1 - mmShift, q);
+      } else {
+        vp -= multipleOfPowerOf5(mv + 2, q);
+      }
+    }
+  } else {
+    uint32_t q = log10Pow5(-e2) - (-e2 > 1);
+    e10 = (int)q + e2;
+    int i = -e2 - (int)q;
+    int k = pow5bits(i) - POW5_BITCOUNT;
+    int j = (int)q - k;
+    const uint64_t* mul = getPow5Split(i);
+    vr = mulShift64(4 * m2, mul, j);
+    vp = mulShift64(4 * m2 + 2, mul, j);
+    vm = mulShift64(4 * m2 - 1 - mmShift, mul, j);
+
+    if (q <= 1) {
+      // mv = 4 * m2，至少有两个为0的低位
+      vrIsTrailingZeros = true;
+      if (acceptBounds) {
+        vmIsTrailingZeros = mmShift == 1;
+      } else {
+        vp--;
+      }
+    } else if (q < 63) {
+      vrIsTrailingZeros = multipleOfPowerOf2(mv, q);
+    }
+  }
+
+  // 去掉末位，直到上下界之间没有更短的数
+  int removed = 0;
+  uint8_t lastRemovedDigit = 0;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    // 少见的情况：需要记录去掉的部分是否全为0，以便正确处理区间的端点和向偶数舍入
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = (uint8_t)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = (uint8_t)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    // 正好在两个数的中间时向偶数舍入
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+      lastRemovedDigit = 4;
+    }
+    *output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+  } else {
+    bool roundUp = false;
+    while (vp / 10 > vm / 10) {
+      roundUp = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    *output = vr + (vr == vm || roundUp);
+  }
+  *exponent = e10 + removed;
+}
+
+static int decimalLength(uint64_t value) {
+  int length = 1;
+  while (value >= 10) {
+    value /= 10;
+    length++;
+  }
+  return length;
+}
+
+int formatNumber(double value, char* buffer) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(double));
+  bool sign = (bits >> 63) != 0;
+  uint64_t ieeeMantissa = bits & ((UINT64_C(1) << DOUBLE_MANTISSA_BITS) - 1);
+  uint32_t ieeeExponent = (uint32_t)((bits >> DOUBLE_MANTISSA_BITS) & ((1u << DOUBLE_EXPONENT_BITS) - 1));
+
+  char* start = buffer;
+  if (ieeeExponent == (1u << DOUBLE_EXPONENT_BITS) - 1) {
+    if (ieeeMantissa != 0) {
+      memcpy(buffer, "nan", 4);
+      return 3;
+    }
+    if (sign) *buffer++ = '-';
+    memcpy(buffer, "inf", 4);
+    return (int)(buffer - start) + 3;
+  }
+
+  if (sign) *buffer++ = '-';
+  if (ieeeExponent == 0 && ieeeMantissa == 0) {
+    memcpy(buffer, "0", 2);
+    return (int)(buffer - start) + 1;
+  }
+
+  uint64_t output;
+  int exponent;
+  double magnitude = sign ? -value : value;
+  if (magnitude < 9007199254740992.0 && magnitude == (double)(uint64_t)magnitude) {
+    // 小于2^53的整数：相邻的double之间相差不超过1，整数本身就是最短的表示
+    output = (uint64_t)magnitude;
+    exponent = 0;
+    while (output % 10 == 0) {
+      output /= 10;
+      exponent++;
+    }
+  } else {
+    shortestDecimal(ieeeMantissa, ieeeExponent, &output, &exponent);
+  }
+
+  // 各位数字，value = 0.digits * 10^point
+  char digits[20];
+  int length = decimalLength(output);
+  for (int i = length - 1; i >= 0; i--) {
+    digits[i] = (char)('0' + output % 10);
+    output /= 10;
+  }
+  int point = length + exponent;
+
+  if (length <= point && point <= 21) {
+    // 整数：1234500
+    memcpy(buffer, digits, length);
+    memset(buffer + length, '0', point - length);
+    buffer += point;
+  } else if (0 < point && point <= 21) {
+    // 小数点在数字中间：123.45
+    memcpy(buffer, digits, point);
+    buffer[point] = '.';
+    memcpy(buffer + point + 1, digits + point, length - point);
+    buffer += length + 1;
+  } else if (-6 < point && point <= 0) {
+    // 小数点之后有前导的0：0.00012345
+    buffer[0] = '0';
+    buffer[1] = '.';
+    memset(buffer + 2, '0', -point);
+    memcpy(buffer + 2 - point, digits, length);
+    buffer += 2 - point + length;
+  } else {
+    // 科学计数法：1.2345e+21, 1e-7
+    *buffer++ = digits[0];
+    if (length > 1) {
+      *buffer++ = '.';
+      memcpy(buffer, digits + 1, length - 1);
+      buffer += length - 1;
+    }
+    int e = point - 1;
+    *buffer++ = 'e';
+    *buffer++ = e < 0 ? '-' : '+';
+    if (e < 0) e = -e;
+    if (e >= 100) *buffer++ = (char)('0' + e / 100);
+    if (e >= 10) *buffer++ = (char)('0' + e / 10 % 10);
+    *buffer++ = (char)('0' + e % 10);
+  }
+
+  *buffer = '\0';
+  return (int)(buffer - start);
+}
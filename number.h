@@ -0,0 +1,17 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// formatNumber最多写入的字符数(不包括结尾的'\0')，例如 -0.0000012345678901234567
+#define NUMBER_MAX_LENGTH 25
+
+// 解析数字字面量(digits ( "." digits )?)，结果是与十进制值最接近的double(正确舍入)
+double parseNumber(const char* start, int length);
+// 将数字格式化为能够精确还原该数字的最短的十进制表示，返回写入的字符数
+// 格式只由数字本身决定，与平台和C库无关：
+//   整数部分不超过21位时不使用科学计数法：3628800, 0.1, 0.000001
+//   其他情况使用科学计数法：1e+21, 1.5e-7
+int formatNumber(double value, char* buffer);
+
+#endif
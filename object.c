@@ -1,5 +1,9 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "memory.h"
 #include "object.h"
@@ -16,8 +20,15 @@ static Obj* allocateObject(size_t size, ObjType type) {
   object->isMarked = false;
 
   // 每次分配一个对象的内存，将其放入链表的头部
-  object->next = vm.objects;
-  vm.objects = object;
+  // 编译器在独立的堆中分配对象，编译结束之后再合并到vm.objects中(见memory.h)
+  Heap* heap = currentHeap();
+  if (heap != NULL) {
+    object->next = heap->objects;
+    heap->objects = object;
+  } else {
+    object->next = vm.objects;
+    vm.objects = object;
+  }
 
   // debug模式下，每次分配新的对象之后都打印该对象的内存信息
   #ifdef DEBUG_LOG_GC
@@ -32,7 +43,13 @@ ObjFunction* newFunction() {
 
   function->arity = 0;
   function->upvalueCount = 0;
+  function->captureCount = 0;
+  function->maxSlots = 0;
   function->name = NULL;
+  function->image = NULL;
+  function->imageIndex = 0;
+  function->lazySource = NULL;
+  function->lazyLine = 0;
   initChunk(&function->chunk);
 
   return function;
@@ -41,30 +58,41 @@ ObjFunction* newFunction() {
 ObjUpvalue* newUpvalue(Value* slot) {
   ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
   upvalue->location = slot;
+  upvalue->prev = NULL;
   upvalue->next = NULL;
   upvalue->closed = NIL_VAL;
   return upvalue;
 }
 
 ObjClosure* newClosure(ObjFunction* function) {
-  ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
-
+  // 先分配数组再分配闭包对象：分配数组时可能触发GC，
+  // 而此时还没有任何地方引用这个新的闭包对象，它会被错误的回收掉
   ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
   for (int i = 0; i < function->upvalueCount; i++) {                    
     upvalues[i] = NULL;                                                 
   }
 
+  Value* captured = ALLOCATE(Value, function->captureCount);
+  for (int i = 0; i < function->captureCount; i++) {
+    captured[i] = NIL_VAL;
+  }
+
+  ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
   closure->upvalues = upvalues;
   closure->upvalueCount = function->upvalueCount;
+  closure->captured = captured;
+  closure->capturedCount = function->captureCount;
   closure->function = function;
+  closure->module = NULL;
 
   return closure;
 }
 
 // 初始化一个内置函数
-ObjNative* newNative(NativeFn function) {
+ObjNative* newNative(NativeFn function, ObjString* name) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
+  native->name = name;
 
   return native;
 }
@@ -92,23 +120,167 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method) {
   return bound;
 }
 
-// 字符串hash方法
-static uint32_t hashString(const char* key, int length) {
-  uint32_t hash = 2166136261u;
+ObjModule* newModule(ObjString* name, ObjString* directory) {
+  ObjModule* module = ALLOCATE_OBJ(ObjModule, OBJ_MODULE);
+  module->name = name;
+  module->directory = directory;
+  initTable(&module->globals);
+  return module;
+}
+
+ObjStringBuilder* newStringBuilder() {
+  ObjStringBuilder* builder = ALLOCATE_OBJ(ObjStringBuilder, OBJ_STRING_BUILDER);
+  builder->chars = NULL;
+  builder->length = 0;
+  builder->capacity = 0;
+  return builder;
+}
+
+char* reserveStringBuilder(ObjStringBuilder* builder, int length) {
+  // 调用者保证builder->length + length不会超过INT_MAX
+  int needed = builder->length + length;
+  if (needed > builder->capacity) {
+    // 按倍数扩容，追加n个字节的均摊代价是O(n)
+    int capacity = builder->capacity;
+    while (capacity < needed) {
+      capacity = capacity > INT_MAX / 2 ? INT_MAX : GROW_CAPACITY(capacity);
+    }
+    builder->chars = GROW_ARRAY(builder->chars, char, builder->capacity, capacity);
+    builder->capacity = capacity;
+  }
+  return builder->chars + builder->length;
+}
+
+/*
+  字符串hash：wyhash(https://github.com/wangyi-fudan/wyhash)
+  每次读取8个字节，通过64位乘法的高低位异或混合，长字符串比逐个字节的FNV-1a快很多。
+  种子在每个进程启动时随机生成：构造出的大量hash值冲突的键(例如对象的属性名)
+  无法在不同的进程之间复用，不能让findEntry的线性探测退化成遍历整个表
+*/
+static const uint64_t hashSecret[4] = {
+  0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+};
+
+// 混合之后的种子，initHashSeed之前使用固定的种子
+static uint64_t hashSeed = 0xa0761d6478bd642full;
+
+// 计算a * b的128位结果，低64位写回a，高64位写回b
+static inline void hashMultiply(uint64_t* a, uint64_t* b) {
+  #ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t)*a * *b;
+    *a = (uint64_t)product;
+    *b = (uint64_t)(product >> 64);
+  #else
+    uint64_t aLow = (uint32_t)*a, aHigh = *a >> 32;
+    uint64_t bLow = (uint32_t)*b, bHigh = *b >> 32;
+    uint64_t lowLow = aLow * bLow;
+    uint64_t middle1 = aHigh * bLow + (lowLow >> 32);
+    uint64_t middle2 = aLow * bHigh + (uint32_t)middle1;
+    *b = aHigh * bHigh + (middle1 >> 32) + (middle2 >> 32);
+    *a = (middle2 << 32) | (uint32_t)lowLow;
+  #endif
+}
+
+// a * b的128位结果的高64位和低64位异或
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+  hashMultiply(&a, &b);
+  return a ^ b;
+}
+
+// 按机器字节序读取，hash值只在进程内部使用，不需要跨平台一致
+static inline uint64_t read64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
 
-  for (int i = 0; i < length; i++) {
-    hash ^= key[i];
-    hash *= 16777619;
+void initHashSeed() {
+  // 指定LOX_HASH_SEED时使用固定的种子，便于复现与hash顺序有关的问题
+  const char* fixed = getenv("LOX_HASH_SEED");
+  uint64_t seed = 0;
+  if (fixed != NULL) {
+    seed = strtoull(fixed, NULL, 0);
+  } else {
+    FILE* file = fopen("/dev/urandom", "rb");
+    if (file != NULL) {
+      if (fread(&seed, sizeof(seed), 1, file) != 1) seed = 0;
+      fclose(file);
+    }
+    // 读取不到随机数时用时间、进程号和栈地址代替
+    if (seed == 0) {
+      seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&seed;
+    }
   }
 
-  return hash;
+  hashSeed = seed ^ hashMix(seed ^ hashSecret[0], hashSecret[1]);
+}
+
+uint32_t hashString(const char* key, int length) {
+  const uint8_t* p = (const uint8_t*)key;
+  size_t remaining = (size_t)length;
+  uint64_t seed = hashSeed;
+  uint64_t a;
+  uint64_t b;
+
+  if (remaining <= 16) {
+    if (remaining >= 4) {
+      // 4到16个字节：读取开头和结尾(可能重叠)的各两个4字节
+      size_t middle = (remaining >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + middle);
+      b = (read32(p + remaining - 4) << 32) | read32(p + remaining - 4 - middle);
+    } else if (remaining > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[remaining >> 1] << 8) | p[remaining - 1];
+      b = 0;
+    } else {
+      a = 0;
+      b = 0;
+    }
+  } else {
+    // 较长的字符串每次处理48个字节，分三路独立地混合
+    if (remaining > 48) {
+      uint64_t seed1 = seed;
+      uint64_t seed2 = seed;
+      do {
+        seed = hashMix(read64(p) ^ hashSecret[1], read64(p + 8) ^ seed);
+        seed1 = hashMix(read64(p + 16) ^ hashSecret[2], read64(p + 24) ^ seed1);
+        seed2 = hashMix(read64(p + 32) ^ hashSecret[3], read64(p + 40) ^ seed2);
+        p += 48;
+        remaining -= 48;
+      } while (remaining > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (remaining > 16) {
+      seed = hashMix(read64(p) ^ hashSecret[1], read64(p + 8) ^ seed);
+      p += 16;
+      remaining -= 16;
+    }
+    // 最后16个字节(可能与前面重叠)
+    a = read64(p + remaining - 16);
+    b = read64(p + remaining - 8);
+  }
+
+  a ^= hashSecret[1];
+  b ^= seed;
+  hashMultiply(&a, &b);
+  uint64_t hash = hashMix(a ^ hashSecret[0] ^ (uint64_t)length, b ^ hashSecret[1]);
+  return (uint32_t)(hash ^ (hash >> 32));
 }
 
 // 分配一块内存空间以存储ObjString对象
 static ObjString* allocateString(const char* chars, int length) {
+  // 在独立的堆中分配时只在该堆中intern，合并时再intern到vm.strings中
+  Heap* heap = currentHeap();
+  Table* strings = heap != NULL ? &heap->strings : &vm.strings;
+
   // 首先查看缓存
   uint32_t hash = hashString(chars, length);
-  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+  ObjString* interned = tableFindString(strings, chars, length, hash);
   if (interned != NULL) return interned;
 
   // 生成新的字符串对象
@@ -116,10 +288,17 @@ static ObjString* allocateString(const char* chars, int length) {
   ObjString* string = (ObjString*)allocateObject(size, OBJ_STRING);
 
   string->hash = hash;
+  string->interned = true;
   memcpy(string->chars, chars, length);
   string->chars[length] = '\0';
   string->length = length;
 
+  // 独立的堆不会触发垃圾回收，也不能访问vm的栈
+  if (heap != NULL) {
+    tableSet(strings, string, NIL_VAL);
+    return string;
+  }
+
   // GC边界：同理tableSet扩容时可能会触发垃圾回收，因此在set之前需要将ObjString保持引用
   push(OBJ_VAL(string));
 
@@ -131,39 +310,190 @@ static ObjString* allocateString(const char* chars, int length) {
   return string;
 }
 
-// 连接两个字符串对象
-ObjString* concatenateString(ObjString* a, ObjString* b) {
-  int length = a->length + b->length;
+// 分配一个长度为length的(没有intern的)字符串对象，内容由调用者填写，hash在需要时才计算
+static ObjString* allocateRawString(int length) {
   size_t size = sizeof(ObjString) + sizeof(char) * (length + 1);
   ObjString* string = (ObjString*)allocateObject(size, OBJ_STRING);
-
-  memcpy(string->chars, a->chars, a->length);
-  memcpy(string->chars + a->length, b->chars, b->length);
-
   string->chars[length] = '\0';
   string->length = length;
-  string->hash = hashString(string->chars, length);
+  string->hash = 0;
+  string->interned = false;
+  return string;
+}
 
-  // 由于在lox中，字符串是不可变的，因此将所有的字符串对象保存在内存中，以便复用
-  // 每当生成一个新的字符串对象时，检查table中是否有该字符串，如果有就复用
-  ObjString* interned = tableFindString(&vm.strings, string->chars, length, string->hash);
-  if (interned != NULL) {
-    // 如果找到了缓存的字符串，将刚才创建的字符串对象回收
-    freeObject((Obj*)string);
-    return interned;
-  }
+ObjString* internString(ObjString* string) {
+  if (string->interned) return string;
 
-  // GC边界：同理tableSet扩容时可能会触发垃圾回收，因此在set之前需要将ObjString保持引用
-  push(OBJ_VAL(string));
+  ObjString* interned = tableFindString(&vm.strings, string->chars, string->length,
+                                        stringHash(string));
+  if (interned != NULL) return interned;
 
-  // 每次生成一个字符串的时候，都将string对象收集到hashTable中
+  // GC边界：tableSet扩容时可能会触发垃圾回收，因此在set之前需要将ObjString保持引用
+  push(OBJ_VAL(string));
   tableSet(&vm.strings, string, NIL_VAL);
-
   pop();
 
+  string->interned = true;
+  return string;
+}
+
+int textLength(Value text) {
+  if (IS_SHORT_STRING(text)) return SHORT_STRING_LENGTH(text);
+  if (IS_STRING_VIEW(text)) return AS_STRING_VIEW(text)->length;
+  return IS_STRING(text) ? AS_STRING(text)->length : AS_ROPE(text)->length;
+}
+
+void copyText(Value text, char* dest) {
+  // 从右向左复制：右边的部分直接继续处理，左边的部分压栈。
+  // 在循环中不断追加得到的rope总是向左延伸，这样栈的深度保持为常数
+  Value initial[16];
+  Value* stack = initial;
+  int count = 0;
+  int capacity = 16;
+  char* end = dest + textLength(text);
+
+  for (;;) {
+    if (IS_ROPE(text) && AS_ROPE(text)->flat == NULL) {
+      ObjRope* rope = AS_ROPE(text);
+      // 栈不通过reallocate分配，复制的过程中不会触发GC
+      if (count == capacity) {
+        capacity *= 2;
+        if (stack == initial) {
+          stack = (Value*)malloc(sizeof(Value) * capacity);
+          if (stack != NULL) memcpy(stack, initial, sizeof(initial));
+        } else {
+          stack = (Value*)realloc(stack, sizeof(Value) * capacity);
+        }
+        if (stack == NULL) exit(1);
+      }
+      stack[count++] = rope->left;
+      text = rope->right;
+      continue;
+    }
+
+    if (IS_SHORT_STRING(text)) {
+      end -= SHORT_STRING_LENGTH(text);
+      shortStringChars(text, end);
+    } else if (IS_STRING_VIEW(text)) {
+      ObjStringView* view = AS_STRING_VIEW(text);
+      end -= view->length;
+      memcpy(end, view->string->chars + view->start, view->length);
+    } else {
+      ObjString* string = IS_STRING(text) ? AS_STRING(text) : AS_ROPE(text)->flat;
+      end -= string->length;
+      memcpy(end, string->chars, string->length);
+    }
+
+    if (count == 0) break;
+    text = stack[--count];
+  }
+
+  if (stack != initial) free(stack);
+}
+
+ObjString* flattenRope(ObjRope* rope) {
+  if (rope->flat != NULL) return rope->flat;
+
+  // 分配时可能触发GC，此时rope(由调用者保证)以及它引用的各个部分都还是可以访问到的
+  ObjString* string = allocateRawString(rope->length);
+  copyText(OBJ_VAL(rope), string->chars);
+  rope->flat = string;
+
+  // 展开之后不再引用原来的各个部分，它们可以被回收
+  rope->left = NIL_VAL;
+  rope->right = NIL_VAL;
+  return rope->flat;
+}
+
+ObjString* flattenView(ObjStringView* view) {
+  if (view->start == 0 && view->length == view->string->length) return view->string;
+
+  // 分配时可能触发GC，此时view(由调用者保证)以及它引用的字符串都还是可以访问到的
+  ObjString* string = allocateRawString(view->length);
+  memcpy(string->chars, view->string->chars + view->start, view->length);
+  view->string = string;
+  view->start = 0;
   return string;
 }
 
+const char* textChars(Value text, char* buffer) {
+  if (IS_SHORT_STRING(text)) {
+    shortStringChars(text, buffer);
+    return buffer;
+  }
+  if (IS_STRING_VIEW(text)) {
+    ObjStringView* view = AS_STRING_VIEW(text);
+    return view->string->chars + view->start;
+  }
+  return IS_STRING(text) ? AS_STRING(text)->chars : flattenRope(AS_ROPE(text))->chars;
+}
+
+Value substring(Value text, int start, int length) {
+  if (length == textLength(text)) return text;
+
+  char buffer[8];
+  const char* chars = textChars(text, buffer);
+  if (length < VIEW_MIN_LENGTH) return newStringValue(chars + start, length);
+
+  // 这时text一定不是短字符串，rope已经在textChars中展开
+  ObjString* string;
+  if (IS_STRING_VIEW(text)) {
+    string = AS_STRING_VIEW(text)->string;
+    start += AS_STRING_VIEW(text)->start;
+  } else {
+    string = IS_STRING(text) ? AS_STRING(text) : AS_ROPE(text)->flat;
+  }
+
+  // text由调用者保持引用，分配时触发GC也不会回收它引用的字符串
+  ObjStringView* view = ALLOCATE_OBJ(ObjStringView, OBJ_STRING_VIEW);
+  view->length = length;
+  view->string = string;
+  view->start = start;
+  return OBJ_VAL(view);
+}
+
+ObjString* shortStringObject(Value value) {
+  char chars[8] = { 0 };
+  shortStringChars(value, chars);
+  return copyString(chars, SHORT_STRING_LENGTH(value));
+}
+
+// 连接两个字符串
+Value concatenateString(Value a, Value b) {
+  int aLength = textLength(a);
+  int bLength = textLength(b);
+  int length = aLength + bLength;
+
+  // 较长的结果只记录两个部分，展开推迟到真正需要内容的时候
+  if (length >= ROPE_MIN_LENGTH) {
+    if (aLength == 0) return b;
+    if (bLength == 0) return a;
+
+    // a和b由调用者保持引用(仍然在栈上)，分配时触发GC也不会被回收
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = length;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    return OBJ_VAL(rope);
+  }
+
+  // 很短的结果直接保存在Value中，不需要分配
+  if (length <= SHORT_STRING_MAX) {
+    char chars[8];
+    copyText(a, chars);
+    copyText(b, chars + aLength);
+    return shortStringValue(chars, length);
+  }
+
+  // 较短的结果直接复制，这时a和b都不是ObjRope(ObjRope不短于ROPE_MIN_LENGTH)
+  // 结果不intern：大部分连接的结果是临时的字符串，只会被打印或者比较
+  ObjString* string = allocateRawString(length);
+  copyText(a, string->chars);
+  copyText(b, string->chars + aLength);
+  return OBJ_VAL(string);
+}
+
 
 // @Depreacted
 ObjString* takeString(char* chars, int length) {
@@ -175,6 +505,18 @@ ObjString* copyString(const char* chars, int length) {
   return allocateString(chars, length);
 }
 
+Value copyStringValue(const char* chars, int length) {
+  if (length <= SHORT_STRING_MAX) return shortStringValue(chars, length);
+  return OBJ_VAL(copyString(chars, length));
+}
+
+Value newStringValue(const char* chars, int length) {
+  if (length <= SHORT_STRING_MAX) return shortStringValue(chars, length);
+  ObjString* string = allocateRawString(length);
+  memcpy(string->chars, chars, length);
+  return OBJ_VAL(string);
+}
+
 static void printFunction(ObjFunction* func) {
   // debug print
   if (func->name == NULL) {
@@ -213,6 +555,27 @@ void printObject(Value value) {
     // 在用户的角度，绑定方法和普通函数是一样的
     printFunction(AS_BOUND_METHOD(value)->method->function);
     break;
+  case OBJ_MODULE:
+    printf("<module %s>", AS_MODULE(value)->name->chars);
+    break;
+  case OBJ_ROPE: {
+    // printObject也用于GC和指令追踪的debug输出，这里不能展开(分配对象)，只复制到临时的缓冲区中
+    int length = AS_ROPE(value)->length;
+    char* chars = (char*)malloc(length);
+    if (chars == NULL) exit(1);
+    copyText(value, chars);
+    fwrite(chars, 1, length, stdout);
+    free(chars);
+    break;
+  }
+  case OBJ_STRING_BUILDER:
+    printf("<string builder>");
+    break;
+  case OBJ_STRING_VIEW: {
+    ObjStringView* view = AS_STRING_VIEW(value);
+    fwrite(view->string->chars + view->start, 1, view->length, stdout);
+    break;
+  }
   default:
     break;
   }
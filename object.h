@@ -1,6 +1,8 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include <string.h>
+
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
@@ -17,6 +19,13 @@
 #define IS_CLASS(value)     isObjType(value, OBJ_CLASS)
 #define IS_INSTANCE(value)  isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value)  isObjType(value, OBJ_BOUND_METHOD)
+#define IS_MODULE(value)    isObjType(value, OBJ_MODULE)
+#define IS_ROPE(value)      isObjType(value, OBJ_ROPE)
+#define IS_STRING_BUILDER(value)  isObjType(value, OBJ_STRING_BUILDER)
+#define IS_STRING_VIEW(value)     isObjType(value, OBJ_STRING_VIEW)
+// lox中的字符串值：短字符串(见value.h)、ObjString、还没有展开的字符串连接结果或者子串
+#define IS_TEXT(value)      (IS_SHORT_STRING(value) || IS_STRING(value) || IS_ROPE(value) || \
+                             IS_STRING_VIEW(value))
 
 // 对Obj进行断言得到ObjString
 #define AS_STRING(value)        ((ObjString*)AS_OBJ(value))
@@ -34,6 +43,14 @@
 #define AS_INSTANCE(value)      ((ObjInstance*)AS_OBJ(value))
 // 类的方法
 #define AS_BOUND_METHOD(value)      ((ObjBoundMethod*)AS_OBJ(value))
+// 模块
+#define AS_MODULE(value)        ((ObjModule*)AS_OBJ(value))
+// 字符串连接
+#define AS_ROPE(value)          ((ObjRope*)AS_OBJ(value))
+// 可变的字符串缓冲区
+#define AS_STRING_BUILDER(value)  ((ObjStringBuilder*)AS_OBJ(value))
+// 子串
+#define AS_STRING_VIEW(value)     ((ObjStringView*)AS_OBJ(value))
 
 // 对象的类型
 typedef enum {
@@ -45,6 +62,10 @@ typedef enum {
   OBJ_CLASS,
   OBJ_INSTANCE,
   OBJ_BOUND_METHOD,
+  OBJ_MODULE,
+  OBJ_ROPE,
+  OBJ_STRING_BUILDER,
+  OBJ_STRING_VIEW,
 } ObjType;
 
 // 相当于对象的base class，每个obj都有一个类型
@@ -61,8 +82,16 @@ typedef struct {
   Obj obj;
   int arity;        // 函数参数数量
   int upvalueCount; // 函数的闭包变量的个数
+  int captureCount; // 函数按值捕获的闭包变量的个数(见compiler.c中的resolveUpvalue)
+  int maxSlots;     // 函数执行时最多同时存在的局部变量个数，用于检查栈溢出
   Chunk chunk;      // 函数体对应的指令集
   ObjString* name;  // 函数名
+  // 来自字节码镜像并且常量还没有加载的函数，指向所在的镜像(见image.c)，否则为NULL
+  struct sImage* image;
+  int imageIndex;   // 函数在镜像中的下标
+  // 延迟编译的函数在编译之前，指向源码中参数列表的位置(见compiler.c中的lazyFunction)，否则为NULL
+  const char* lazySource;
+  int lazyLine;
 } ObjFunction;
 
 // 一个upvalue值，该值存在堆中，用于记录闭包变量
@@ -73,20 +102,39 @@ typedef struct sUpvalue {
   Value* location;
   // 用于stack中的值消失后，持久化保存该变量的值
   Value closed;
-  // 为了保证每一个闭包变量对应一个唯一的ObjUpvalue,
-  // 我们需要追踪所有的ObjUpvalue(按指针大小排序的单链表)，在新增之前，我们需要遍历该链表来确保没有一个相同的值存在
+  // 为了保证每一个闭包变量对应一个唯一的ObjUpvalue, vm中有一张按栈的位置索引的表(见vm.h)，
+  // 此外每个调用帧用一个双向链表记录该帧中还未close的ObjUpvalue，函数返回时只需要close这些值
+  struct sUpvalue* prev;
   struct sUpvalue* next;
 } ObjUpvalue;
 
 
+// 模块：import的文件执行之后得到的对象，模块中的全局变量保存在它自己的表中，
+// 在导入它的代码中通过 模块名.变量名 访问
+typedef struct {
+  Obj obj;
+  // import时的路径
+  ObjString* name;
+  // 模块文件所在的目录(绝对路径)，模块中相对路径的import相对于这个目录解析
+  ObjString* directory;
+  // 模块的全局变量
+  Table globals;
+} ObjModule;
+
 // 闭包函数
 typedef struct {
   Obj obj;
   ObjFunction* function;
+  // 闭包定义所在的模块，执行时在该模块的全局变量表中查找全局变量，NULL表示主脚本(vm.globals)
+  ObjModule* module;
   // 指向该闭包函数引用的upvalue数组
   ObjUpvalue** upvalues;
   // 数组的长度
   int upvalueCount;
+  // 按值捕获的闭包变量：这些变量在被捕获之后不会再被赋值，
+  // 因此在创建闭包时直接将值复制进来，不需要生成ObjUpvalue
+  Value* captured;
+  int capturedCount;
 } ObjClosure;
 
 // 定义一个NativeFn类型
@@ -97,6 +145,7 @@ typedef Value (*NativeFn)(int argCount, Value* args);
 typedef struct {
   Obj obj;
   NativeFn function;
+  ObjString* name;  // 内置函数的名字，堆快照通过名字找回对应的C函数
 } ObjNative;
 
 typedef struct sObjClass {
@@ -141,10 +190,64 @@ typedef struct {
 struct sObjString {
   Obj obj; // 基本类型
   int length; // 字符串长度
-  uint32_t hash; // 用于缓存字符串的hash值
+  uint32_t hash; // 用于缓存字符串的hash值，运行时生成的字符串在第一次需要时才计算，0表示还没有计算
+  /*
+    是否已经intern到vm.strings中：源码中的字面量和标识符在编译时intern，
+    运行时生成的字符串(例如连接的结果)不intern，省去每个临时字符串的hash计算和查表，
+    也不会让GC时需要扫描的vm.strings变大。只有在作为表的键存入时才需要通过internString intern
+  */
+  bool interned;
   char chars[]; // 字符串
 };
 
+// 结果不短于这个长度的字符串连接生成ObjRope，更短的直接复制成新的字符串
+#define ROPE_MIN_LENGTH 64
+
+/*
+  字符串连接的结果(rope)：只记录连接的两部分，不复制内容，也不计算hash和intern。
+  在循环中不断地用+拼接字符串时，每次连接都是O(1)的，也不会留下大量intern过的中间字符串，
+  直到真正需要内容时(打印、比较、作为表的键、传给内置函数)才通过flattenRope展开为ObjString
+*/
+typedef struct {
+  Obj obj;
+  int length;   // 展开之后的长度
+  // 连接的两部分(IS_TEXT的值)，展开之后置为nil，不再引用它们
+  Value left;
+  Value right;
+  // 展开得到的字符串，还没有展开时为NULL
+  ObjString* flat;
+} ObjRope;
+
+// 不短于这个长度的子串生成ObjStringView，更短的直接复制：复制的代价不比分配一个ObjStringView高，
+// 也不会让很短的子串引用着很长的字符串
+#define VIEW_MIN_LENGTH 16
+
+/*
+  子串(substring、split等内置函数的结果)：不复制内容，直接引用原来的字符串中的一段。
+  只有在需要一个ObjString时(例如作为表的键)才通过flattenView复制出来，复制之后改为引用复制的结果，
+  原来的字符串可以被回收
+*/
+typedef struct {
+  Obj obj;
+  int length;
+  // 引用的字符串，内容为string->chars[start, start + length)。
+  // 对子串再取子串时引用的是同一个字符串，不会形成链
+  ObjString* string;
+  int start;
+} ObjStringView;
+
+/*
+  StringBuilder()创建的可变字符串缓冲区：append等内置函数直接把内容追加到chars的末尾，
+  容量不够时按倍数扩容，只有toString时才生成一个字符串对象。
+  它不是字符串值(不满足IS_TEXT)，不能直接用+连接或者作为表的键
+*/
+typedef struct {
+  Obj obj;
+  char* chars;  // 不以'\0'结尾
+  int length;
+  int capacity;
+} ObjStringBuilder;
+
 // 内联函数：函数调用时会被直接替换为函数体，而不是新开一个函数栈
 // 从而避免频繁调用函数对栈内存的消耗
 // 关键字inline 必须与函数定义体放在一起才能使函数成为内联
@@ -152,12 +255,64 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
-// 从chars位置开始复制length长度的字符，并生成ObjString
+// 生成本进程的hash种子，需要在计算任何字符串的hash之前调用(见initVM)
+void initHashSeed();
+// 字符串的hash函数(带种子的wyhash)
+uint32_t hashString(const char* key, int length);
+
+// 字符串的hash值，没有计算过时先计算
+static inline uint32_t stringHash(ObjString* string) {
+  if (string->hash == 0) string->hash = hashString(string->chars, string->length);
+  return string->hash;
+}
+
+// 比较两个字符串的内容：两个都intern过时只需要比较地址，
+// 否则依次比较长度、(已经计算过的)hash和内容
+static inline bool isStringEqual(ObjString* a, ObjString* b) {
+  if (a == b) return true;
+  if (a->interned && b->interned) return false;
+  if (a->length != b->length) return false;
+  if (a->hash != 0 && b->hash != 0 && a->hash != b->hash) return false;
+  return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// 从chars位置开始复制length长度的字符，并生成(intern过的)ObjString
 ObjString* copyString(const char* chars, int length);
+// 源码中的字符串字面量的值：不超过SHORT_STRING_MAX时为短字符串，否则为copyString的结果
+Value copyStringValue(const char* chars, int length);
+// 运行时生成的字符串值：不超过SHORT_STRING_MAX时为短字符串，否则复制成(没有intern的)ObjString
+Value newStringValue(const char* chars, int length);
 // 将给定的chars生成ObjString
 ObjString* takeString(char* chars, int length);
-// 连接两个字符串对象，生成一个新的字符串对象
-ObjString* concatenateString(ObjString*, ObjString*);
+// 连接两个字符串值(IS_TEXT)：不超过SHORT_STRING_MAX的结果是短字符串，
+// 较短的结果直接生成(没有intern的)ObjString，较长的生成ObjRope。调用者保证结果的长度不超过INT_MAX
+Value concatenateString(Value a, Value b);
+// 返回与string内容相同的intern过的字符串，string还没有intern并且vm.strings中没有相同的字符串时，
+// string本身成为intern的字符串。作为表的键存入之前需要先intern。可能触发GC
+ObjString* internString(ObjString* string);
+// 字符串值的长度
+int textLength(Value text);
+// 将字符串值的内容复制到dest中(不分配对象，不会触发GC)，复制textLength(text)个字符
+void copyText(Value text, char* dest);
+// 展开ObjRope得到(没有intern的)字符串，结果缓存在rope中。可能触发GC，调用前rope需要能从根访问到
+ObjString* flattenRope(ObjRope* rope);
+// 子串对应的(没有intern的)ObjString，只有子串引用的是整个字符串时才不需要复制。可能触发GC
+ObjString* flattenView(ObjStringView* view);
+// 生成与短字符串内容相同的(intern过的)ObjString，可能触发GC
+ObjString* shortStringObject(Value value);
+// 字符串值对应的ObjString，可能触发GC
+static inline ObjString* asFlatString(Value value) {
+  if (IS_STRING(value)) return AS_STRING(value);
+  if (IS_ROPE(value)) return flattenRope(AS_ROPE(value));
+  if (IS_STRING_VIEW(value)) return flattenView(AS_STRING_VIEW(value));
+  return shortStringObject(value);
+}
+// 字符串值的连续内容(不以'\0'结尾)：短字符串复制到buffer(至少8个字节)中，rope先展开，子串不复制。
+// 可能触发GC，调用前text需要能从根访问到
+const char* textChars(Value text, char* buffer);
+// text中从start开始的length个字符，调用者保证范围合法：
+// 较长的结果是引用原来的内容的ObjStringView，较短的直接复制。可能触发GC，调用前text需要能从根访问到
+Value substring(Value text, int start, int length);
 
 
 // 初始化新的函数对象
@@ -165,7 +320,7 @@ ObjFunction* newFunction();
 // 初始化新的闭包函数对象
 ObjClosure* newClosure(ObjFunction* function);
 // 初始化native函数
-ObjNative* newNative(NativeFn function);
+ObjNative* newNative(NativeFn function, ObjString* name);
 // 初始化新的upvalue
 ObjUpvalue* newUpvalue(Value* slot);
 // 初始化新的Class对象
@@ -174,6 +329,13 @@ ObjClass* newClass(ObjString* name);
 ObjInstance* newInstance(ObjClass* klass);
 // 初始化一个新的绑定方法
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
+// 初始化一个新的模块
+ObjModule* newModule(ObjString* name, ObjString* directory);
+// 初始化一个空的字符串缓冲区
+ObjStringBuilder* newStringBuilder();
+// 保证缓冲区末尾至少还有length个字节的空间，返回写入的位置(长度由调用者增加)。
+// 扩容时可能触发GC，调用前builder需要能从根访问到
+char* reserveStringBuilder(ObjStringBuilder* builder, int length);
 
 void printObject(Value value);
 
@@ -0,0 +1,354 @@
+1 OP_CONSTANT OP_DEFINE_GLOBAL
+1 OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL
+6 OP_CONSTANT OP_SET_PROPERTY
+6 OP_CONSTANT OP_SET_PROPERTY OP_POP
+16666668 OP_CONSTANT OP_LESS
+16666668 OP_CONSTANT OP_LESS OP_JUMP_IF_FALSE
+1 OP_NIL OP_RETURN
+6 OP_POP OP_GET_LOCAL
+5 OP_POP OP_GET_LOCAL OP_CONSTANT
+1 OP_POP OP_GET_LOCAL OP_RETURN
+16666669 OP_POP OP_GET_GLOBAL
+16666667 OP_POP OP_GET_GLOBAL OP_GET_GLOBAL
+2 OP_POP OP_GET_GLOBAL OP_CALL
+16666667 OP_POP OP_LOOP
+16666667 OP_POP OP_LOOP OP_GET_GLOBAL
+6 OP_GET_LOCAL OP_CONSTANT
+6 OP_GET_LOCAL OP_CONSTANT OP_SET_PROPERTY
+100000002 OP_GET_LOCAL OP_GET_PROPERTY
+100000002 OP_GET_LOCAL OP_GET_PROPERTY OP_RETURN
+1 OP_GET_LOCAL OP_RETURN
+1 OP_GET_LOCAL OP_RETURN OP_DEFINE_GLOBAL
+16666668 OP_GET_GLOBAL OP_CONSTANT
+16666668 OP_GET_GLOBAL OP_CONSTANT OP_LESS
+16666667 OP_GET_GLOBAL OP_GET_GLOBAL
+16666667 OP_GET_GLOBAL OP_GET_GLOBAL OP_INVOKE
+1 OP_GET_GLOBAL OP_SUBTRACT
+1 OP_GET_GLOBAL OP_SUBTRACT OP_PRINT
+1 OP_GET_GLOBAL OP_PRINT
+1 OP_GET_GLOBAL OP_PRINT OP_NIL
+3 OP_GET_GLOBAL OP_CALL
+1 OP_GET_GLOBAL OP_CALL OP_GET_LOCAL
+1 OP_GET_GLOBAL OP_CALL OP_GET_GLOBAL
+1 OP_GET_GLOBAL OP_CALL OP_DEFINE_GLOBAL
+100000002 OP_GET_GLOBAL OP_INVOKE
+100000002 OP_GET_GLOBAL OP_INVOKE OP_GET_LOCAL
+1 OP_GET_GLOBAL OP_CLOSURE
+1 OP_GET_GLOBAL OP_CLOSURE OP_METHOD
+1 OP_DEFINE_GLOBAL OP_CONSTANT
+1 OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL
+3 OP_DEFINE_GLOBAL OP_GET_GLOBAL
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CLOSURE
+16666667 OP_SET_GLOBAL OP_POP
+16666667 OP_SET_GLOBAL OP_POP OP_LOOP
+100000002 OP_GET_PROPERTY OP_RETURN
+100000002 OP_GET_PROPERTY OP_RETURN OP_ADD
+6 OP_SET_PROPERTY OP_POP
+6 OP_SET_PROPERTY OP_POP OP_GET_LOCAL
+16666668 OP_LESS OP_JUMP_IF_FALSE
+16666668 OP_LESS OP_JUMP_IF_FALSE OP_POP
+83333335 OP_ADD OP_GET_GLOBAL
+83333335 OP_ADD OP_GET_GLOBAL OP_INVOKE
+16666667 OP_ADD OP_SET_GLOBAL
+16666667 OP_ADD OP_SET_GLOBAL OP_POP
+1 OP_SUBTRACT OP_PRINT
+1 OP_SUBTRACT OP_PRINT OP_GET_GLOBAL
+1 OP_PRINT OP_NIL
+1 OP_PRINT OP_NIL OP_RETURN
+1 OP_PRINT OP_GET_GLOBAL
+1 OP_PRINT OP_GET_GLOBAL OP_PRINT
+16666668 OP_JUMP_IF_FALSE OP_POP
+16666668 OP_JUMP_IF_FALSE OP_POP OP_GET_GLOBAL
+16666667 OP_LOOP OP_GET_GLOBAL
+16666667 OP_LOOP OP_GET_GLOBAL OP_CONSTANT
+1 OP_CALL OP_GET_LOCAL
+1 OP_CALL OP_GET_LOCAL OP_CONSTANT
+1 OP_CALL OP_GET_GLOBAL
+1 OP_CALL OP_GET_GLOBAL OP_SUBTRACT
+1 OP_CALL OP_DEFINE_GLOBAL
+1 OP_CALL OP_DEFINE_GLOBAL OP_GET_GLOBAL
+100000002 OP_INVOKE OP_GET_LOCAL
+100000002 OP_INVOKE OP_GET_LOCAL OP_GET_PROPERTY
+7 OP_CLOSURE OP_METHOD
+1 OP_CLOSURE OP_METHOD OP_POP
+6 OP_CLOSURE OP_METHOD OP_CLOSURE
+1 OP_RETURN OP_DEFINE_GLOBAL
+1 OP_RETURN OP_DEFINE_GLOBAL OP_CONSTANT
+100000002 OP_RETURN OP_ADD
+83333335 OP_RETURN OP_ADD OP_GET_GLOBAL
+16666667 OP_RETURN OP_ADD OP_SET_GLOBAL
+1 OP_CLASS OP_DEFINE_GLOBAL
+1 OP_CLASS OP_DEFINE_GLOBAL OP_GET_GLOBAL
+1 OP_METHOD OP_POP
+1 OP_METHOD OP_POP OP_GET_GLOBAL
+6 OP_METHOD OP_CLOSURE
+6 OP_METHOD OP_CLOSURE OP_METHOD
+1 OP_CONSTANT OP_CONSTANT
+1 OP_CONSTANT OP_CONSTANT OP_SET_LOCAL
+3 OP_CONSTANT OP_GET_LOCAL
+1 OP_CONSTANT OP_GET_LOCAL OP_CONSTANT
+1 OP_CONSTANT OP_GET_LOCAL OP_GET_PROPERTY
+1 OP_CONSTANT OP_GET_LOCAL OP_ADD
+1 OP_CONSTANT OP_SET_LOCAL
+1 OP_CONSTANT OP_SET_LOCAL OP_POP
+1 OP_CONSTANT OP_GET_GLOBAL
+1 OP_CONSTANT OP_GET_GLOBAL OP_ADD
+2 OP_CONSTANT OP_DEFINE_GLOBAL
+2 OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT
+1 OP_CONSTANT OP_GET_UPVALUE
+1 OP_CONSTANT OP_GET_UPVALUE OP_SUPER_INVOKE
+2 OP_CONSTANT OP_SET_PROPERTY
+2 OP_CONSTANT OP_SET_PROPERTY OP_POP
+9 OP_CONSTANT OP_LESS
+9 OP_CONSTANT OP_LESS OP_JUMP_IF_FALSE
+5 OP_CONSTANT OP_ADD
+3 OP_CONSTANT OP_ADD OP_SET_LOCAL
+2 OP_CONSTANT OP_ADD OP_SET_UPVALUE
+4 OP_CONSTANT OP_SUBTRACT
+4 OP_CONSTANT OP_SUBTRACT OP_CALL
+1 OP_CONSTANT OP_PRINT
+1 OP_CONSTANT OP_PRINT OP_CONSTANT
+2 OP_CONSTANT OP_CALL
+1 OP_CONSTANT OP_CALL OP_GET_LOCAL
+1 OP_CONSTANT OP_CALL OP_CLOSURE
+1 OP_CONSTANT OP_CLOSURE
+1 OP_CONSTANT OP_CLOSURE OP_GET_LOCAL
+1 OP_NIL OP_SET_PROPERTY
+1 OP_NIL OP_SET_PROPERTY OP_POP
+7 OP_NIL OP_RETURN
+6 OP_NIL OP_RETURN OP_POP
+1 OP_FALSE OP_JUMP_IF_FALSE
+1 OP_FALSE OP_JUMP_IF_FALSE OP_JUMP_IF_FALSE
+1 OP_POP OP_CONSTANT
+1 OP_POP OP_CONSTANT OP_PRINT
+4 OP_POP OP_NIL
+4 OP_POP OP_NIL OP_RETURN
+1 OP_POP OP_FALSE
+1 OP_POP OP_FALSE OP_JUMP_IF_FALSE
+3 OP_POP OP_POP
+1 OP_POP OP_POP OP_FALSE
+1 OP_POP OP_POP OP_POP
+1 OP_POP OP_POP OP_CLOSURE
+5 OP_POP OP_GET_LOCAL
+1 OP_POP OP_GET_LOCAL OP_GET_LOCAL
+4 OP_POP OP_GET_LOCAL OP_RETURN
+9 OP_POP OP_GET_GLOBAL
+2 OP_POP OP_GET_GLOBAL OP_CONSTANT
+2 OP_POP OP_GET_GLOBAL OP_GET_LOCAL
+1 OP_POP OP_GET_GLOBAL OP_GET_PROPERTY
+1 OP_POP OP_GET_GLOBAL OP_PRINT
+2 OP_POP OP_GET_GLOBAL OP_CALL
+1 OP_POP OP_GET_GLOBAL OP_INVOKE
+2 OP_POP OP_GET_UPVALUE
+2 OP_POP OP_GET_UPVALUE OP_PRINT
+3 OP_POP OP_JUMP
+3 OP_POP OP_JUMP OP_GET_LOCAL
+3 OP_POP OP_LOOP
+3 OP_POP OP_LOOP OP_GET_LOCAL
+1 OP_POP OP_CLOSURE
+1 OP_POP OP_CLOSURE OP_DEFINE_GLOBAL
+1 OP_POP OP_CLOSE_UPVALUE
+1 OP_POP OP_CLOSE_UPVALUE OP_GET_GLOBAL
+3 OP_POP OP_CLASS
+3 OP_POP OP_CLASS OP_DEFINE_GLOBAL
+17 OP_GET_LOCAL OP_CONSTANT
+1 OP_GET_LOCAL OP_CONSTANT OP_GET_UPVALUE
+9 OP_GET_LOCAL OP_CONSTANT OP_LESS
+3 OP_GET_LOCAL OP_CONSTANT OP_ADD
+4 OP_GET_LOCAL OP_CONSTANT OP_SUBTRACT
+1 OP_GET_LOCAL OP_NIL
+1 OP_GET_LOCAL OP_NIL OP_SET_PROPERTY
+3 OP_GET_LOCAL OP_GET_LOCAL
+1 OP_GET_LOCAL OP_GET_LOCAL OP_GET_LOCAL
+1 OP_GET_LOCAL OP_GET_LOCAL OP_SET_PROPERTY
+1 OP_GET_LOCAL OP_GET_LOCAL OP_ADD
+1 OP_GET_LOCAL OP_GET_PROPERTY
+1 OP_GET_LOCAL OP_GET_PROPERTY OP_ADD
+1 OP_GET_LOCAL OP_SET_PROPERTY
+1 OP_GET_LOCAL OP_SET_PROPERTY OP_POP
+2 OP_GET_LOCAL OP_ADD
+1 OP_GET_LOCAL OP_ADD OP_GET_LOCAL
+1 OP_GET_LOCAL OP_ADD OP_PRINT
+5 OP_GET_LOCAL OP_PRINT
+1 OP_GET_LOCAL OP_PRINT OP_CONSTANT
+1 OP_GET_LOCAL OP_PRINT OP_POP
+3 OP_GET_LOCAL OP_PRINT OP_LOOP
+5 OP_GET_LOCAL OP_RETURN
+2 OP_GET_LOCAL OP_RETURN OP_GET_GLOBAL
+2 OP_GET_LOCAL OP_RETURN OP_DEFINE_GLOBAL
+1 OP_GET_LOCAL OP_RETURN OP_ADD
+4 OP_SET_LOCAL OP_POP
+1 OP_SET_LOCAL OP_POP OP_GET_LOCAL
+3 OP_SET_LOCAL OP_POP OP_LOOP
+4 OP_GET_GLOBAL OP_CONSTANT
+2 OP_GET_GLOBAL OP_CONSTANT OP_SET_PROPERTY
+2 OP_GET_GLOBAL OP_CONSTANT OP_CALL
+1 OP_GET_GLOBAL OP_POP
+1 OP_GET_GLOBAL OP_POP OP_GET_GLOBAL
+4 OP_GET_GLOBAL OP_GET_LOCAL
+4 OP_GET_GLOBAL OP_GET_LOCAL OP_CONSTANT
+1 OP_GET_GLOBAL OP_GET_GLOBAL
+1 OP_GET_GLOBAL OP_GET_GLOBAL OP_INHERIT
+2 OP_GET_GLOBAL OP_GET_PROPERTY
+1 OP_GET_GLOBAL OP_GET_PROPERTY OP_GET_GLOBAL
+1 OP_GET_GLOBAL OP_GET_PROPERTY OP_ADD
+1 OP_GET_GLOBAL OP_ADD
+1 OP_GET_GLOBAL OP_ADD OP_SET_GLOBAL
+1 OP_GET_GLOBAL OP_SUBTRACT
+1 OP_GET_GLOBAL OP_SUBTRACT OP_PRINT
+1 OP_GET_GLOBAL OP_PRINT
+1 OP_GET_GLOBAL OP_PRINT OP_CONSTANT
+7 OP_GET_GLOBAL OP_CALL
+1 OP_GET_GLOBAL OP_CALL OP_CONSTANT
+1 OP_GET_GLOBAL OP_CALL OP_GET_GLOBAL
+2 OP_GET_GLOBAL OP_CALL OP_DEFINE_GLOBAL
+2 OP_GET_GLOBAL OP_CALL OP_GET_UPVALUE
+1 OP_GET_GLOBAL OP_CALL OP_INVOKE
+2 OP_GET_GLOBAL OP_INVOKE
+1 OP_GET_GLOBAL OP_INVOKE OP_CONSTANT
+1 OP_GET_GLOBAL OP_INVOKE OP_GET_UPVALUE
+3 OP_GET_GLOBAL OP_CLOSURE
+3 OP_GET_GLOBAL OP_CLOSURE OP_METHOD
+1 OP_GET_GLOBAL OP_INHERIT
+1 OP_GET_GLOBAL OP_INHERIT OP_GET_GLOBAL
+2 OP_DEFINE_GLOBAL OP_CONSTANT
+1 OP_DEFINE_GLOBAL OP_CONSTANT OP_GET_GLOBAL
+1 OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL
+10 OP_DEFINE_GLOBAL OP_GET_GLOBAL
+2 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_POP
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL
+3 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_INVOKE
+2 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CLOSURE
+1 OP_DEFINE_GLOBAL OP_CLOSURE
+1 OP_DEFINE_GLOBAL OP_CLOSURE OP_DEFINE_GLOBAL
+1 OP_SET_GLOBAL OP_POP
+1 OP_SET_GLOBAL OP_POP OP_GET_GLOBAL
+2 OP_GET_UPVALUE OP_CONSTANT
+2 OP_GET_UPVALUE OP_CONSTANT OP_ADD
+1 OP_GET_UPVALUE OP_GET_UPVALUE
+1 OP_GET_UPVALUE OP_GET_UPVALUE OP_SET_PROPERTY
+1 OP_GET_UPVALUE OP_SET_PROPERTY
+1 OP_GET_UPVALUE OP_SET_PROPERTY OP_POP
+2 OP_GET_UPVALUE OP_PRINT
+2 OP_GET_UPVALUE OP_PRINT OP_NIL
+1 OP_GET_UPVALUE OP_SUPER_INVOKE
+1 OP_GET_UPVALUE OP_SUPER_INVOKE OP_GET_LOCAL
+2 OP_SET_UPVALUE OP_POP
+2 OP_SET_UPVALUE OP_POP OP_GET_UPVALUE
+1 OP_GET_PROPERTY OP_GET_GLOBAL
+1 OP_GET_PROPERTY OP_GET_GLOBAL OP_GET_PROPERTY
+2 OP_GET_PROPERTY OP_ADD
+2 OP_GET_PROPERTY OP_ADD OP_PRINT
+5 OP_SET_PROPERTY OP_POP
+2 OP_SET_PROPERTY OP_POP OP_NIL
+1 OP_SET_PROPERTY OP_POP OP_GET_LOCAL
+2 OP_SET_PROPERTY OP_POP OP_GET_GLOBAL
+9 OP_LESS OP_JUMP_IF_FALSE
+9 OP_LESS OP_JUMP_IF_FALSE OP_POP
+1 OP_ADD OP_GET_LOCAL
+1 OP_ADD OP_GET_LOCAL OP_PRINT
+3 OP_ADD OP_SET_LOCAL
+3 OP_ADD OP_SET_LOCAL OP_POP
+1 OP_ADD OP_SET_GLOBAL
+1 OP_ADD OP_SET_GLOBAL OP_POP
+2 OP_ADD OP_SET_UPVALUE
+2 OP_ADD OP_SET_UPVALUE OP_POP
+3 OP_ADD OP_PRINT
+1 OP_ADD OP_PRINT OP_NIL
+1 OP_ADD OP_PRINT OP_GET_LOCAL
+1 OP_ADD OP_PRINT OP_CLASS
+2 OP_ADD OP_RETURN
+1 OP_ADD OP_RETURN OP_ADD
+1 OP_ADD OP_RETURN OP_PRINT
+1 OP_SUBTRACT OP_PRINT
+1 OP_SUBTRACT OP_PRINT OP_CLOSURE
+4 OP_SUBTRACT OP_CALL
+4 OP_SUBTRACT OP_CALL OP_GET_LOCAL
+3 OP_PRINT OP_CONSTANT
+1 OP_PRINT OP_CONSTANT OP_CONSTANT
+2 OP_PRINT OP_CONSTANT OP_GET_LOCAL
+3 OP_PRINT OP_NIL
+3 OP_PRINT OP_NIL OP_RETURN
+1 OP_PRINT OP_POP
+1 OP_PRINT OP_POP OP_POP
+1 OP_PRINT OP_GET_LOCAL
+1 OP_PRINT OP_GET_LOCAL OP_NIL
+1 OP_PRINT OP_GET_GLOBAL
+1 OP_PRINT OP_GET_GLOBAL OP_CALL
+3 OP_PRINT OP_LOOP
+3 OP_PRINT OP_LOOP OP_GET_LOCAL
+1 OP_PRINT OP_CLOSURE
+1 OP_PRINT OP_CLOSURE OP_DEFINE_GLOBAL
+1 OP_PRINT OP_CLASS
+1 OP_PRINT OP_CLASS OP_DEFINE_GLOBAL
+3 OP_JUMP OP_GET_LOCAL
+3 OP_JUMP OP_GET_LOCAL OP_PRINT
+10 OP_JUMP_IF_FALSE OP_POP
+1 OP_JUMP_IF_FALSE OP_POP OP_CONSTANT
+1 OP_JUMP_IF_FALSE OP_POP OP_POP
+3 OP_JUMP_IF_FALSE OP_POP OP_GET_LOCAL
+2 OP_JUMP_IF_FALSE OP_POP OP_GET_GLOBAL
+3 OP_JUMP_IF_FALSE OP_POP OP_JUMP
+1 OP_JUMP_IF_FALSE OP_JUMP_IF_FALSE
+1 OP_JUMP_IF_FALSE OP_JUMP_IF_FALSE OP_POP
+6 OP_LOOP OP_GET_LOCAL
+6 OP_LOOP OP_GET_LOCAL OP_CONSTANT
+1 OP_CALL OP_CONSTANT
+1 OP_CALL OP_CONSTANT OP_CLOSURE
+5 OP_CALL OP_GET_LOCAL
+5 OP_CALL OP_GET_LOCAL OP_CONSTANT
+1 OP_CALL OP_GET_GLOBAL
+1 OP_CALL OP_GET_GLOBAL OP_SUBTRACT
+2 OP_CALL OP_DEFINE_GLOBAL
+2 OP_CALL OP_DEFINE_GLOBAL OP_GET_GLOBAL
+2 OP_CALL OP_GET_UPVALUE
+2 OP_CALL OP_GET_UPVALUE OP_CONSTANT
+1 OP_CALL OP_INVOKE
+1 OP_CALL OP_INVOKE OP_GET_LOCAL
+1 OP_CALL OP_CLOSURE
+1 OP_CALL OP_CLOSURE OP_GET_LOCAL
+1 OP_INVOKE OP_CONSTANT
+1 OP_INVOKE OP_CONSTANT OP_GET_LOCAL
+1 OP_INVOKE OP_GET_LOCAL
+1 OP_INVOKE OP_GET_LOCAL OP_CONSTANT
+1 OP_INVOKE OP_GET_UPVALUE
+1 OP_INVOKE OP_GET_UPVALUE OP_GET_UPVALUE
+1 OP_SUPER_INVOKE OP_GET_LOCAL
+1 OP_SUPER_INVOKE OP_GET_LOCAL OP_PRINT
+2 OP_CLOSURE OP_GET_LOCAL
+1 OP_CLOSURE OP_GET_LOCAL OP_GET_LOCAL
+1 OP_CLOSURE OP_GET_LOCAL OP_RETURN
+3 OP_CLOSURE OP_DEFINE_GLOBAL
+2 OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL
+1 OP_CLOSURE OP_DEFINE_GLOBAL OP_CLOSURE
+5 OP_CLOSURE OP_METHOD
+3 OP_CLOSURE OP_METHOD OP_POP
+2 OP_CLOSURE OP_METHOD OP_CLOSURE
+1 OP_CLOSE_UPVALUE OP_GET_GLOBAL
+1 OP_CLOSE_UPVALUE OP_GET_GLOBAL OP_CALL
+6 OP_RETURN OP_POP
+2 OP_RETURN OP_POP OP_NIL
+2 OP_RETURN OP_POP OP_GET_GLOBAL
+2 OP_RETURN OP_POP OP_CLASS
+2 OP_RETURN OP_GET_GLOBAL
+2 OP_RETURN OP_GET_GLOBAL OP_GET_LOCAL
+2 OP_RETURN OP_DEFINE_GLOBAL
+2 OP_RETURN OP_DEFINE_GLOBAL OP_GET_GLOBAL
+2 OP_RETURN OP_ADD
+2 OP_RETURN OP_ADD OP_RETURN
+1 OP_RETURN OP_PRINT
+1 OP_RETURN OP_PRINT OP_GET_GLOBAL
+4 OP_CLASS OP_DEFINE_GLOBAL
+4 OP_CLASS OP_DEFINE_GLOBAL OP_GET_GLOBAL
+1 OP_INHERIT OP_GET_GLOBAL
+1 OP_INHERIT OP_GET_GLOBAL OP_CLOSURE
+3 OP_METHOD OP_POP
+1 OP_METHOD OP_POP OP_GET_GLOBAL
+1 OP_METHOD OP_POP OP_CLOSE_UPVALUE
+1 OP_METHOD OP_POP OP_CLASS
+2 OP_METHOD OP_CLOSURE
+2 OP_METHOD OP_CLOSURE OP_METHOD
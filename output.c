@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "number.h"
+#include "object.h"
+#include "output.h"
+
+// 超过这个长度的字符串不复制到缓冲区中，而是和缓冲区中已有的内容一起用writev写出
+#define OUTPUT_DIRECT_THRESHOLD (4 * 1024)
+
+void initOutput(Output* output, int fd) {
+  output->fd = fd;
+  output->data = (char*)malloc(OUTPUT_CAPACITY);
+  output->count = 0;
+}
+
+void freeOutput(Output* output) {
+  flushOutput(output);
+  free(output->data);
+  output->data = NULL;
+}
+
+// 将若干段内容全部写出，处理被信号中断和只写出了一部分的情况
+// 写入失败时(例如管道已经关闭)直接丢弃剩下的内容
+static void writeAll(int fd, struct iovec* parts, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, parts, count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+
+    while (count > 0 && (size_t)written >= parts->iov_len) {
+      written -= parts->iov_len;
+      parts++;
+      count--;
+    }
+    if (count > 0) {
+      parts->iov_base = (char*)parts->iov_base + written;
+      parts->iov_len -= written;
+    }
+  }
+}
+
+// 写出缓冲区中的内容以及紧跟在后面的chars
+static void writeThrough(Output* output, const char* chars, int length) {
+  // 其他地方(例如REPL的提示符)通过stdio写入标准输出，先写出它们
+  if (output->fd == STDOUT_FILENO) fflush(stdout);
+
+  struct iovec parts[2];
+  int count = 0;
+  if (output->count > 0) {
+    parts[count].iov_base = output->data;
+    parts[count].iov_len = output->count;
+    count++;
+  }
+  if (length > 0) {
+    parts[count].iov_base = (void*)chars;
+    parts[count].iov_len = length;
+    count++;
+  }
+  writeAll(output->fd, parts, count);
+  output->count = 0;
+}
+
+void flushOutput(Output* output) {
+  if (output->count > 0) writeThrough(output, NULL, 0);
+}
+
+void writeOutput(Output* output, const char* chars, int length) {
+  if (output->count + length <= OUTPUT_CAPACITY) {
+    memcpy(output->data + output->count, chars, length);
+    output->count += length;
+    return;
+  }
+
+  if (length >= OUTPUT_DIRECT_THRESHOLD) {
+    writeThrough(output, chars, length);
+    return;
+  }
+
+  // 先填满缓冲区再写出，剩下的部分(小于阈值)放入清空之后的缓冲区
+  int part = OUTPUT_CAPACITY - output->count;
+  memcpy(output->data + output->count, chars, part);
+  output->count = OUTPUT_CAPACITY;
+  flushOutput(output);
+  memcpy(output->data, chars + part, length - part);
+  output->count = length - part;
+}
+
+static void writeCString(Output* output, const char* chars) {
+  writeOutput(output, chars, (int)strlen(chars));
+}
+
+static void writeFunction(Output* output, ObjFunction* function) {
+  if (function->name == NULL) {
+    writeCString(output, "<script>");
+    return;
+  }
+
+  writeCString(output, "<fn ");
+  writeOutput(output, function->name->chars, function->name->length);
+  writeCString(output, ">");
+}
+
+static void writeObject(Output* output, Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+      writeOutput(output, AS_STRING(value)->chars, AS_STRING(value)->length);
+      break;
+    case OBJ_FUNCTION:
+      writeFunction(output, AS_FUNCTION(value));
+      break;
+    case OBJ_CLOSURE:
+      writeFunction(output, AS_CLOSURE(value)->function);
+      break;
+    case OBJ_UPVALUE:
+      writeCString(output, "upvalue");
+      break;
+    case OBJ_NATIVE:
+      writeCString(output, "<native fn>");
+      break;
+    case OBJ_CLASS:
+      writeOutput(output, AS_CLASS(value)->name->chars, AS_CLASS(value)->name->length);
+      break;
+    case OBJ_INSTANCE: {
+      ObjString* name = AS_INSTANCE(value)->klass->name;
+      writeOutput(output, name->chars, name->length);
+      writeCString(output, " instance");
+      break;
+    }
+    case OBJ_BOUND_METHOD:
+      writeFunction(output, AS_BOUND_METHOD(value)->method->function);
+      break;
+    case OBJ_MODULE:
+      writeCString(output, "<module ");
+      writeOutput(output, AS_MODULE(value)->name->chars, AS_MODULE(value)->name->length);
+      writeCString(output, ">");
+      break;
+    case OBJ_ROPE: {
+      // 打印时展开rope，展开的结果被缓存，再次打印时不需要重新复制
+      ObjString* string = flattenRope(AS_ROPE(value));
+      writeOutput(output, string->chars, string->length);
+      break;
+    }
+    case OBJ_STRING_BUILDER:
+      writeCString(output, "<string builder>");
+      break;
+    case OBJ_STRING_VIEW: {
+      ObjStringView* view = AS_STRING_VIEW(value);
+      writeOutput(output, view->string->chars + view->start, view->length);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void writeOutputValue(Output* output, Value value) {
+  if (IS_BOOL(value)) {
+    writeCString(output, AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    writeCString(output, "nil");
+  } else if (IS_NUMBER(value)) {
+    // 数字直接格式化到缓冲区中
+    if (OUTPUT_CAPACITY - output->count < NUMBER_MAX_LENGTH + 1) flushOutput(output);
+    output->count += formatNumber(AS_NUMBER(value), output->data + output->count);
+  } else if (IS_SHORT_STRING(value)) {
+    char chars[8];
+    shortStringChars(value, chars);
+    writeOutput(output, chars, SHORT_STRING_LENGTH(value));
+  } else if (IS_OBJ(value)) {
+    writeObject(output, value);
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "value.h"
+
+// 输出缓冲区的大小，写满之后写入文件描述符
+#define OUTPUT_CAPACITY (64 * 1024)
+
+/*
+  print语句的输出缓冲区：值直接格式化到缓冲区中，不经过stdio，
+  在缓冲区写满、执行结束、运行时错误以及调用flush()时才写入文件描述符
+*/
+typedef struct {
+  // 输出的文件描述符，默认为标准输出，可以通过环境变量LOX_OUTPUT_FD指定
+  int fd;
+  char* data;
+  int count;
+} Output;
+
+void initOutput(Output* output, int fd);
+// 写出剩余的内容并释放缓冲区
+void freeOutput(Output* output);
+// 写出缓冲区中的内容，写标准输出之前会先写出stdio中的内容，保证输出的顺序
+void flushOutput(Output* output);
+void writeOutput(Output* output, const char* chars, int length);
+// 将值格式化到缓冲区中，格式与printValue相同。字符串连接的结果会被展开，可能触发GC
+void writeOutputValue(Output* output, Value value);
+
+#endif
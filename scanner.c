@@ -4,21 +4,11 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-  // 当前scanner起始位置，随着scan不断前进
-  const char* start;
-  // 代表当前位置，由current-start可以得到字符长度
-  const char* current;
-  int line;
-} Scanner;
-
-Scanner scanner;
-
 // 初始化scanner
-void initScanner(const char* source) {
-  scanner.start = source;
-  scanner.current = source;
-  scanner.line = 1;
+void initScanner(Scanner* scanner, const char* source) {
+  scanner->start = source;
+  scanner->current = source;
+  scanner->line = 1;
 }
 
 static bool isAlpha(char c) {
@@ -31,205 +21,334 @@ static bool isDigit(char c) {
   return c >= '0' && c <= '9';
 }
 
-static bool isAtEnd() {
-  return *scanner.current == '\0';
+/*
+  批量跳过一类字符，返回第一个不属于这一类的字符(源码末尾的'\0'不属于任何一类)
+  lines不为NULL时同时统计跳过的换行符的数量
+*/
+#if defined(SCANNER_SIMD) && defined(__SSE2__)
+
+#include <emmintrin.h>
+
+// 每次读取对齐的16个字节：对齐的读取不会跨越内存页，因此越过源码末尾的'\0'读取是安全的，
+// 但是ASan会把它当作越界访问，所以这些函数不做ASan检查
+#if defined(__GNUC__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+// 字符类：返回16个字节中属于这一类的字节的位掩码
+typedef unsigned (*CharClass)(__m128i chunk);
+
+static inline unsigned charMask(__m128i chunk, char c) {
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+}
+
+// 只有有符号的比较，大于等于0x80的字节都是负数，不会落在任何ASCII范围内
+static inline unsigned rangeMask(__m128i chunk, char low, char high) {
+  __m128i above = _mm_cmpgt_epi8(chunk, _mm_set1_epi8((char)(low - 1)));
+  __m128i below = _mm_cmplt_epi8(chunk, _mm_set1_epi8((char)(high + 1)));
+  return (unsigned)_mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static inline unsigned spaceClass(__m128i chunk) {
+  return charMask(chunk, ' ') | charMask(chunk, '\t') |
+         charMask(chunk, '\r') | charMask(chunk, '\n');
+}
+
+static inline unsigned identifierClass(__m128i chunk) {
+  // 或上0x20之后大写字母变为小写字母，其他字符不会因此落入a-z中
+  __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+  return rangeMask(lower, 'a', 'z') | rangeMask(chunk, '0', '9') | charMask(chunk, '_');
+}
+
+static inline unsigned digitClass(__m128i chunk) {
+  return rangeMask(chunk, '0', '9');
+}
+
+// 注释直到行尾
+static inline unsigned commentClass(__m128i chunk) {
+  return ~(charMask(chunk, '\n') | charMask(chunk, '\0'));
+}
+
+// 字符串直到下一个引号
+static inline unsigned stringClass(__m128i chunk) {
+  return ~(charMask(chunk, '"') | charMask(chunk, '\0'));
+}
+
+NO_SANITIZE_ADDRESS
+static inline const char* skipClass(const char* p, CharClass inClass, int* lines) {
+  const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+  // 第一个块中p之前的字节不算
+  unsigned valid = (0xffffu << (p - block)) & 0xffffu;
+
+  for (;;) {
+    __m128i chunk = _mm_load_si128((const __m128i*)block);
+    unsigned outside = ~inClass(chunk) & valid;
+
+    if (lines != NULL) {
+      unsigned newlines = charMask(chunk, '\n') & valid;
+      // 只统计第一个不属于这一类的字符之前的换行符
+      if (outside != 0) newlines &= (outside & -outside) - 1;
+      *lines += __builtin_popcount(newlines);
+    }
+    if (outside != 0) return block + __builtin_ctz(outside);
+
+    block += 16;
+    valid = 0xffffu;
+  }
+}
+
+// 大多数token之间没有空白或者只有一个空格，标识符和数字也很短，
+// 先逐个判断开头的字符，只有较长的一段字符才批量判断
+static const char* skipSpaces(const char* p, int* lines) {
+  if (*p == ' ') p++;
+  if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return p;
+  return skipClass(p, spaceClass, lines);
+}
+
+static const char* skipComment(const char* p) {
+  return skipClass(p, commentClass, NULL);
+}
+
+static const char* skipIdentifier(const char* p) {
+  if (!isAlpha(*p) && !isDigit(*p)) return p;
+  return skipClass(p + 1, identifierClass, NULL);
+}
+
+static const char* skipDigits(const char* p) {
+  if (!isDigit(*p)) return p;
+  return skipClass(p + 1, digitClass, NULL);
+}
+
+static const char* skipStringBody(const char* p, int* lines) {
+  return skipClass(p, stringClass, lines);
+}
+
+#else
+
+static const char* skipSpaces(const char* p, int* lines) {
+  for (;; p++) {
+    if (*p == '\n') {
+      (*lines)++;
+    } else if (*p != ' ' && *p != '\r' && *p != '\t') {
+      return p;
+    }
+  }
+}
+
+static const char* skipComment(const char* p) {
+  while (*p != '\n' && *p != '\0') p++;
+  return p;
+}
+
+static const char* skipIdentifier(const char* p) {
+  while (isAlpha(*p) || isDigit(*p)) p++;
+  return p;
+}
+
+static const char* skipDigits(const char* p) {
+  while (isDigit(*p)) p++;
+  return p;
+}
+
+static const char* skipStringBody(const char* p, int* lines) {
+  for (; *p != '"' && *p != '\0'; p++) {
+    if (*p == '\n') (*lines)++;
+  }
+  return p;
+}
+
+#endif
+
+static bool isAtEnd(Scanner* scanner) {
+  return *scanner->current == '\0';
 }
 
 // 消费一个字符，将current指向下一个字符
-static char advance() {
-  scanner.current++;
-  return scanner.current[-1];
+static char advance(Scanner* scanner) {
+  scanner->current++;
+  return scanner->current[-1];
 }
 
 // 前瞻一个字符
-static char peek() {
-  return *scanner.current;
+static char peek(Scanner* scanner) {
+  return *scanner->current;
 }
 
 // 前瞻两个字符
-static char peekNext() {
-  if (isAtEnd()) return '\0';
-  return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+  if (isAtEnd(scanner)) return '\0';
+  return scanner->current[1];
 }
 
 // 前瞻一个字符，如果匹配，则消费它
-static bool match(char expected) {
-  if (isAtEnd()) return false;
-  if (*scanner.current != expected) return false;
+static bool match(Scanner* scanner, char expected) {
+  if (isAtEnd(scanner)) return false;
+  if (*scanner->current != expected) return false;
 
-  scanner.current++;
+  scanner->current++;
   return true;
 }
 
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
   Token token;
   token.type = type;
   // token的起始位置
-  token.start = scanner.start;
+  token.start = scanner->start;
   // token的长度
-  token.length = (int)(scanner.current - scanner.start);
-  token.line = scanner.line;
+  token.length = (int)(scanner->current - scanner->start);
+  token.line = scanner->line;
+  token.string = NULL;
 
   return token;
 }
 
 // 错误字符
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
   Token token;
   token.type = TOKEN_ERROR;
   token.start = message;
   token.length = (int)strlen(message);
-  token.line = scanner.line;
+  token.line = scanner->line;
+  token.string = NULL;
 
   return token;
 }
 
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
   for (;;) {
-    char c = peek();
-    switch (c) {
-      case ' ':
-      // soft enter
-      case '\r':
-      // tab
-      case '\t':
-        advance();
-        break;
-      // new line
-      case '\n':
-        scanner.line++;
-        advance();
-        break;
-      case '/':
-        if (peekNext() == '/') {
-          // A comment goes until the end of the line.
-          while (peek() != '\n' && !isAtEnd()) advance();
-        } else {
-          return;
-        }
-        break;
-      default:
-        return;
+    // 空格、tab、回车和换行
+    scanner->current = skipSpaces(scanner->current, &scanner->line);
+    if (peek(scanner) == '/' && peekNext(scanner) == '/') {
+      // A comment goes until the end of the line.
+      scanner->current = skipComment(scanner->current);
+    } else {
+      return;
     }
   }
 }
 
-static TokenType checkKeyword(int start, int length,
+static TokenType checkKeyword(Scanner* scanner, int start, int length,
     const char* rest, TokenType type) {
-  if (scanner.current - scanner.start == start + length &&
-      memcmp(scanner.start + start, rest, length) == 0) {
+  if (scanner->current - scanner->start == start + length &&
+      memcmp(scanner->start + start, rest, length) == 0) {
     return type;
   }
 
   return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifierType()
+static TokenType identifierType(Scanner* scanner)
 {
-  switch (scanner.start[0]) {
-    case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+  switch (scanner->start[0]) {
+    case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+    case 'c': return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+    case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-          case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-          case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
+      if (scanner->current - scanner->start > 1) {
+        switch (scanner->start[1]) {
+          case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+          case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+          case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
         }
       }
       break;
-    case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-    case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+    case 'i':
+      if (scanner->current - scanner->start > 1) {
+        switch (scanner->start[1]) {
+          case 'f': return checkKeyword(scanner, 2, 0, "", TOKEN_IF);
+          case 'm': return checkKeyword(scanner, 2, 4, "port", TOKEN_IMPORT);
+        }
+      }
+      break;
+    case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+    case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+    case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+    case 'r': return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+    case 's': return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
     case 't':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-          case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+      if (scanner->current - scanner->start > 1) {
+        switch (scanner->start[1]) {
+          case 'h': return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
+          case 'r': return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
         }
       }
       break;
-    case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+    case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+    case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
   }
 
   return TOKEN_IDENTIFIER;
 }
 
-static Token identifier() {
-  while (isAlpha(peek()) || isDigit(peek())) advance();
+static Token identifier(Scanner* scanner) {
+  scanner->current = skipIdentifier(scanner->current);
 
-  return makeToken(identifierType());
+  return makeToken(scanner, identifierType(scanner));
 }
 
-static Token number() {
-  while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+  scanner->current = skipDigits(scanner->current);
 
   // Look for a fractional part.
-  if (peek() == '.' && isDigit(peekNext())) {
+  if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
     // Consume the ".".
-    advance();
+    advance(scanner);
 
-    while (isDigit(peek())) advance();
+    scanner->current = skipDigits(scanner->current);
   }
 
-  return makeToken(TOKEN_NUMBER);
+  return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static Token string() {
-  while (peek() != '"' && !isAtEnd()) {
-    if (peek() == '\n') scanner.line++;
-    advance();
-  }
+static Token string(Scanner* scanner) {
+  scanner->current = skipStringBody(scanner->current, &scanner->line);
 
-  if (isAtEnd()) return errorToken("Unterminated string.");
+  if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
   // The closing quote.
-  advance();
-  return makeToken(TOKEN_STRING);
+  advance(scanner);
+  return makeToken(scanner, TOKEN_STRING);
 }
 
-Token scanToken() {
+Token scanToken(Scanner* scanner) {
   // 跳过所有的空格和注释
-  skipWhitespace();
+  skipWhitespace(scanner);
 
   // 重置start
-  scanner.start = scanner.current;
+  scanner->start = scanner->current;
 
-  if (isAtEnd()) return makeToken(TOKEN_EOF);
+  if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
   
-  char c = advance();
+  char c = advance(scanner);
   
-  if (isAlpha(c)) return identifier();
-  if (isDigit(c)) return number();
+  if (isAlpha(c)) return identifier(scanner);
+  if (isDigit(c)) return number(scanner);
 
   switch (c) {
-    case '(': return makeToken(TOKEN_LEFT_PAREN);
-    case ')': return makeToken(TOKEN_RIGHT_PAREN);
-    case '{': return makeToken(TOKEN_LEFT_BRACE);
-    case '}': return makeToken(TOKEN_RIGHT_BRACE);
-    case ';': return makeToken(TOKEN_SEMICOLON);
-    case ',': return makeToken(TOKEN_COMMA);
-    case '.': return makeToken(TOKEN_DOT);
-    case '-': return makeToken(TOKEN_MINUS);
-    case '+': return makeToken(TOKEN_PLUS);
-    case '/': return makeToken(TOKEN_SLASH);
-    case '*': return makeToken(TOKEN_STAR);
+    case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+    case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+    case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+    case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+    case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+    case ',': return makeToken(scanner, TOKEN_COMMA);
+    case '.': return makeToken(scanner, TOKEN_DOT);
+    case '-': return makeToken(scanner, TOKEN_MINUS);
+    case '+': return makeToken(scanner, TOKEN_PLUS);
+    case '/': return makeToken(scanner, TOKEN_SLASH);
+    case '*': return makeToken(scanner, TOKEN_STAR);
     case '!':
-      return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+      return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
-      return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+      return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
-      return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+      return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
-      return makeToken(match('=') ?
+      return makeToken(scanner, match(scanner, '=') ?
                        TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-    case '"': return string();
+    case '"': return string(scanner);
   }
 
-  return errorToken("Unexpected character.");
+  return errorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
@@ -20,7 +20,7 @@ typedef enum {
 
   // Keywords.
   TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-  TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
+  TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_IMPORT, TOKEN_NIL, TOKEN_OR,
   TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
   TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
@@ -33,9 +33,21 @@ typedef struct {
   const char* start;
   int length;
   int line;
+  // 标识符intern之后的字符串，由编译器在读取token时填入，词法分析器总是将其置为NULL
+  struct sObjString* string;
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+typedef struct {
+  // 当前scanner起始位置，随着scan不断前进
+  const char* start;
+  // 代表当前位置，由current-start可以得到字符长度
+  const char* current;
+  int line;
+} Scanner;
+
+// scanner的所有状态都保存在Scanner中，不同的Scanner之间互不影响(可以在多个线程中同时使用)
+// 复制一个Scanner就相当于保存了它的位置，编译器借此向前预读一段源码，然后回到原来的位置继续
+void initScanner(Scanner* scanner, const char* source);
+Token scanToken(Scanner* scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+// -------------------- Two-Way -------------------------
+
+#define BYTE_SET_ADD(set, byte) ((set)[(byte) / 64] |= (uint64_t)1 << ((byte) % 64))
+#define BYTE_SET_HAS(set, byte) (((set)[(byte) / 64] >> ((byte) % 64)) & 1)
+
+// needle按字节顺序(reverse为true时按相反的顺序)最大的后缀，返回它的起始位置，period为对应的周期
+static size_t maximalSuffix(const uint8_t* needle, size_t length, bool reverse, size_t* period) {
+  // ip是当前最大后缀的起始位置减一，从-1开始
+  size_t ip = (size_t)-1;
+  size_t jp = 0;
+  size_t k = 1;
+  size_t p = 1;
+  while (jp + k < length) {
+    uint8_t a = needle[ip + k];
+    uint8_t b = needle[jp + k];
+    if (a == b) {
+      if (k == p) {
+        jp += p;
+        k = 1;
+      } else {
+        k++;
+      }
+    } else if (reverse ? a < b : a > b) {
+      jp += k;
+      k = 1;
+      p = jp - ip;
+    } else {
+      ip = jp++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+  return ip + 1;
+}
+
+/*
+  Crochemore-Perrin的Two-Way算法：在needle的临界分解(critical factorization)处分成两半，
+  先从左到右比较右半部分，失配时按失配的位置移动；右半部分匹配之后再比较左半部分，失配时按周期移动。
+  对于有周期的needle，移动一个周期之后已经匹配过的前缀(mem)不需要重新比较，总的比较次数不超过2 * length。
+  另外记录needle中每个字节最后出现的位置，与needle末尾对齐的字节不匹配时直接跳过(同Horspool)
+*/
+static int twoWay(const uint8_t* haystack, size_t length, const uint8_t* needle, size_t needleLength) {
+  uint64_t byteSet[4] = { 0 };
+  size_t shift[256];
+  for (size_t i = 0; i < needleLength; i++) {
+    BYTE_SET_ADD(byteSet, needle[i]);
+    shift[needle[i]] = i + 1;
+  }
+
+  // 两种顺序下的最大后缀中靠后的一个就是临界分解的位置
+  size_t period;
+  size_t reversePeriod;
+  size_t split = maximalSuffix(needle, needleLength, false, &period);
+  size_t reverseSplit = maximalSuffix(needle, needleLength, true, &reversePeriod);
+  if (reverseSplit > split) {
+    split = reverseSplit;
+    period = reversePeriod;
+  }
+
+  size_t remembered;
+  if (memcmp(needle, needle + period, split) == 0) {
+    // needle以period为周期：移动一个周期之后，前needleLength - period个字节仍然是匹配的
+    remembered = needleLength - period;
+  } else {
+    // 没有周期时移动的距离只需要保证不跳过任何匹配，此时split不为0
+    remembered = 0;
+    period = (split - 1 > needleLength - split ? split - 1 : needleLength - split) + 1;
+  }
+
+  size_t position = 0;
+  size_t mem = 0;
+  for (;;) {
+    if (length - position < needleLength) return -1;
+
+    uint8_t tail = haystack[position + needleLength - 1];
+    if (!BYTE_SET_HAS(byteSet, tail)) {
+      position += needleLength;
+      mem = 0;
+      continue;
+    }
+    size_t skip = needleLength - shift[tail];
+    if (skip != 0) {
+      position += skip < mem ? mem : skip;
+      mem = 0;
+      continue;
+    }
+
+    // 右半部分
+    size_t k = split > mem ? split : mem;
+    while (k < needleLength && needle[k] == haystack[position + k]) k++;
+    if (k < needleLength) {
+      position += k - split + 1;
+      mem = 0;
+      continue;
+    }
+
+    // 左半部分
+    k = split;
+    while (k > mem && needle[k - 1] == haystack[position + k - 1]) k--;
+    if (k <= mem) return (int)position;
+    position += period;
+    mem = remembered;
+  }
+}
+
+// -------------------- 筛选候选位置 -------------------------
+
+// 验证候选位置比较的字节数超过已经扫描的长度的这个倍数时，说明候选位置太多，改用Two-Way
+#define CANDIDATE_WORK_RATIO 4
+#define CANDIDATE_WORK_SLACK 1024
+
+// 从start开始用Two-Way查找
+static int twoWayFrom(const char* haystack, int length, const char* needle, int needleLength,
+                      int start) {
+  int found = twoWay((const uint8_t*)haystack + start, (size_t)(length - start),
+                     (const uint8_t*)needle, (size_t)needleLength);
+  return found < 0 ? -1 : found + start;
+}
+
+// needle不短于2个字节：先找首尾两个字节都匹配的位置，再比较中间的部分
+static int findCandidates(const char* haystack, int length, const char* needle, int needleLength) {
+  // 最后一个可能匹配的起始位置
+  int last = length - needleLength;
+  long long work = 0;
+  int i = 0;
+
+#ifdef __SSE2__
+  // 每次检查16个起始位置：分别加载与needle首字节和尾字节对齐的16个字节，两者都相等的位置才是候选位置
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i final = _mm_set1_epi8(needle[needleLength - 1]);
+  for (; i + 15 <= last; i += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i*)(haystack + i));
+    __m128i tail = _mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1));
+    __m128i match = _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, final));
+    unsigned mask = (unsigned)_mm_movemask_epi8(match);
+    while (mask != 0) {
+      int position = i + __builtin_ctz(mask);
+      if (memcmp(haystack + position + 1, needle + 1, needleLength - 2) == 0) return position;
+      work += needleLength;
+      mask &= mask - 1;
+    }
+    if (work > CANDIDATE_WORK_RATIO * (long long)i + CANDIDATE_WORK_SLACK) {
+      return twoWayFrom(haystack, length, needle, needleLength, i + 16);
+    }
+  }
+#endif
+
+  // 剩下的位置(没有SSE2时是全部位置)：用memchr找首字节，C库的memchr通常也是向量化的
+  while (i <= last) {
+    const char* found = (const char*)memchr(haystack + i, needle[0], last - i + 1);
+    if (found == NULL) return -1;
+    int position = (int)(found - haystack);
+    if (haystack[position + needleLength - 1] == needle[needleLength - 1] &&
+        memcmp(haystack + position + 1, needle + 1, needleLength - 2) == 0) {
+      return position;
+    }
+    work += needleLength;
+    i = position + 1;
+    if (work > CANDIDATE_WORK_RATIO * (long long)i + CANDIDATE_WORK_SLACK) {
+      return twoWayFrom(haystack, length, needle, needleLength, i);
+    }
+  }
+  return -1;
+}
+
+int findText(const char* haystack, int length, const char* needle, int needleLength) {
+  if (needleLength == 0) return 0;
+  if (needleLength > length) return -1;
+
+  if (needleLength == 1) {
+    const char* found = (const char*)memchr(haystack, needle[0], length);
+    return found == NULL ? -1 : (int)(found - haystack);
+  }
+  return findCandidates(haystack, length, needle, needleLength);
+}
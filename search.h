@@ -0,0 +1,11 @@
+#ifndef clox_search_h
+#define clox_search_h
+
+#include "common.h"
+
+// 在haystack的前length个字节中查找needle第一次出现的位置，找不到时返回-1。needleLength为0时返回0
+// 单个字节用memchr；较短的needle先用SIMD按首尾两个字节筛选候选位置，
+// 候选位置过多(例如重复的内容)时改用Two-Way算法，最坏情况下也是线性的
+int findText(const char* haystack, int length, const char* needle, int needleLength);
+
+#endif
@@ -0,0 +1,768 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "image.h"
+#include "memory.h"
+#include "object.h"
+#include "snapshot.h"
+#include "vm.h"
+
+/*
+  快照文件格式(所有整数均为本机字节序)：
+
+  SnapshotHeader
+  对象记录 * objectCount    uint8 类型 | uint32 记录的字节数 | 内容
+  根对象                    全局变量表 | 已导入的模块表 | 主脚本的目录 | 栈 | 调用帧
+
+  对象之间的引用都保存为对象的下标(NO_OBJECT表示NULL)，Value保存为uint8标签加上内容。
+  恢复时分两遍：第一遍分配所有的对象，第二遍填充对象之间的引用。
+*/
+
+#define SNAPSHOT_MAGIC "LOXS"
+#define SNAPSHOT_VERSION 6
+#define NO_OBJECT UINT32_MAX
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t fingerprint;
+  uint32_t objectCount;
+  uint64_t objectsSize;
+  uint64_t rootsSize;
+} SnapshotHeader;
+
+typedef enum {
+  SNAPSHOT_NIL,
+  SNAPSHOT_BOOL,
+  SNAPSHOT_NUMBER,
+  SNAPSHOT_OBJ,
+  SNAPSHOT_SHORT_STRING,  // 短字符串(见value.h)：长度和内容
+} ValueTag;
+
+// -------------------- 写入 -------------------------
+
+typedef struct {
+  uint8_t* bytes;
+  int count;
+  int capacity;
+} Buffer;
+
+typedef struct {
+  // 按下标排列的所有对象
+  Obj** objects;
+  int objectCount;
+  int objectCapacity;
+  // 对象 -> 下标 的开放寻址哈希表
+  Obj** keys;
+  int* indexes;
+  int tableCapacity;
+
+  Buffer objectRecords;
+  Buffer roots;
+} SnapshotWriter;
+
+// 在缓冲区末尾预留size个字节，返回它们的位置，由调用者填写
+static uint8_t* reserveBytes(Buffer* buffer, size_t size) {
+  if (buffer->capacity < buffer->count + (int)size) {
+    int oldCapacity = buffer->capacity;
+    int capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < buffer->count + (int)size) capacity = GROW_CAPACITY(capacity);
+    buffer->bytes = GROW_ARRAY(buffer->bytes, uint8_t, oldCapacity, capacity);
+    buffer->capacity = capacity;
+  }
+  uint8_t* bytes = buffer->bytes + buffer->count;
+  buffer->count += (int)size;
+  return bytes;
+}
+
+static void writeBytes(Buffer* buffer, const void* bytes, size_t size) {
+  memcpy(reserveBytes(buffer, size), bytes, size);
+}
+
+static void writeByte(Buffer* buffer, uint8_t byte) {
+  writeBytes(buffer, &byte, sizeof(byte));
+}
+
+static void writeInt(Buffer* buffer, int32_t value) {
+  writeBytes(buffer, &value, sizeof(value));
+}
+
+static uint32_t hashPointer(Obj* object) {
+  uint64_t hash = (uint64_t)(uintptr_t)object * 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(hash >> 32);
+}
+
+static void growObjectTable(SnapshotWriter* writer) {
+  int oldCapacity = writer->tableCapacity;
+  int capacity = GROW_CAPACITY(oldCapacity);
+  Obj** keys = ALLOCATE(Obj*, capacity);
+  int* indexes = ALLOCATE(int, capacity);
+  for (int i = 0; i < capacity; i++) keys[i] = NULL;
+
+  for (int i = 0; i < oldCapacity; i++) {
+    if (writer->keys[i] == NULL) continue;
+    uint32_t slot = hashPointer(writer->keys[i]) & (capacity - 1);
+    while (keys[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+    keys[slot] = writer->keys[i];
+    indexes[slot] = writer->indexes[i];
+  }
+
+  FREE_ARRAY(Obj*, writer->keys, oldCapacity);
+  FREE_ARRAY(int, writer->indexes, oldCapacity);
+  writer->keys = keys;
+  writer->indexes = indexes;
+  writer->tableCapacity = capacity;
+}
+
+// 返回对象的下标，第一次遇到的对象追加到对象数组的末尾，稍后写入它的记录
+static uint32_t objectIndex(SnapshotWriter* writer, Obj* object) {
+  if (object == NULL) return NO_OBJECT;
+
+  if ((writer->objectCount + 1) * 2 > writer->tableCapacity) {
+    growObjectTable(writer);
+  }
+
+  uint32_t slot = hashPointer(object) & (writer->tableCapacity - 1);
+  while (writer->keys[slot] != NULL) {
+    if (writer->keys[slot] == object) return writer->indexes[slot];
+    slot = (slot + 1) & (writer->tableCapacity - 1);
+  }
+
+  if (writer->objectCapacity < writer->objectCount + 1) {
+    int oldCapacity = writer->objectCapacity;
+    writer->objectCapacity = GROW_CAPACITY(oldCapacity);
+    writer->objects = GROW_ARRAY(writer->objects, Obj*,
+        oldCapacity, writer->objectCapacity);
+  }
+
+  writer->keys[slot] = object;
+  writer->indexes[slot] = writer->objectCount;
+  writer->objects[writer->objectCount] = object;
+  return writer->objectCount++;
+}
+
+static void writeRef(SnapshotWriter* writer, Buffer* buffer, Obj* object) {
+  uint32_t index = objectIndex(writer, object);
+  writeBytes(buffer, &index, sizeof(index));
+}
+
+static void writeValue(SnapshotWriter* writer, Buffer* buffer, Value value) {
+  if (IS_NIL(value)) {
+    writeByte(buffer, SNAPSHOT_NIL);
+  } else if (IS_BOOL(value)) {
+    writeByte(buffer, SNAPSHOT_BOOL);
+    writeByte(buffer, AS_BOOL(value));
+  } else if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    writeByte(buffer, SNAPSHOT_NUMBER);
+    writeBytes(buffer, &number, sizeof(number));
+  } else if (IS_SHORT_STRING(value)) {
+    char chars[8];
+    shortStringChars(value, chars);
+    writeByte(buffer, SNAPSHOT_SHORT_STRING);
+    writeByte(buffer, (uint8_t)SHORT_STRING_LENGTH(value));
+    writeBytes(buffer, chars, SHORT_STRING_LENGTH(value));
+  } else {
+    writeByte(buffer, SNAPSHOT_OBJ);
+    writeRef(writer, buffer, AS_OBJ(value));
+  }
+}
+
+static void writeTable(SnapshotWriter* writer, Buffer* buffer, Table* table) {
+  // table->count中包括了删除之后留下的墓碑，只写入有效的条目
+  int count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key != NULL) count++;
+  }
+  writeInt(buffer, count);
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (entry->key == NULL) continue;
+    writeRef(writer, buffer, (Obj*)entry->key);
+    writeValue(writer, buffer, entry->value);
+  }
+}
+
+static bool writeObject(SnapshotWriter* writer, Obj* object) {
+  Buffer* buffer = &writer->objectRecords;
+  // 字符串连接的结果和子串作为普通的字符串写入，恢复时得到intern过的字符串
+  bool text = object->type == OBJ_ROPE || object->type == OBJ_STRING_VIEW;
+  writeByte(buffer, text ? OBJ_STRING : object->type);
+  // 先占位，写完内容之后再回填记录的字节数
+  int sizeOffset = buffer->count;
+  writeInt(buffer, 0);
+
+  switch (object->type) {
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      writeInt(buffer, string->length);
+      writeBytes(buffer, string->chars, string->length);
+      break;
+    }
+    case OBJ_ROPE: {
+      // 不展开rope(写快照的过程中不分配对象)，直接把内容复制到记录中
+      int length = ((ObjRope*)object)->length;
+      writeInt(buffer, length);
+      copyText(OBJ_VAL(object), (char*)reserveBytes(buffer, length));
+      break;
+    }
+    case OBJ_STRING_VIEW: {
+      ObjStringView* view = (ObjStringView*)object;
+      writeInt(buffer, view->length);
+      writeBytes(buffer, view->string->chars + view->start, view->length);
+      break;
+    }
+    case OBJ_STRING_BUILDER: {
+      ObjStringBuilder* builder = (ObjStringBuilder*)object;
+      writeInt(buffer, builder->length);
+      // 空的缓冲区还没有分配chars
+      if (builder->length > 0) writeBytes(buffer, builder->chars, builder->length);
+      break;
+    }
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)object;
+      // 延迟编译的函数可能还没有编译，来自字节码镜像的函数可能还没有加载常量
+      if (function->lazySource != NULL && !compileLazyFunction(function)) return false;
+      if (function->image != NULL && !loadImageFunction(function)) return false;
+
+      writeInt(buffer, function->arity);
+      writeInt(buffer, function->upvalueCount);
+      writeInt(buffer, function->captureCount);
+      writeInt(buffer, function->maxSlots);
+      writeRef(writer, buffer, (Obj*)function->name);
+      Chunk* chunk = &function->chunk;
+      writeInt(buffer, chunk->count);
+      writeBytes(buffer, chunk->code, chunk->count);
+      writeInt(buffer, chunk->lineCount);
+      writeBytes(buffer, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+      writeInt(buffer, chunk->constants.count);
+      for (int i = 0; i < chunk->constants.count; i++) {
+        writeValue(writer, buffer, chunk->constants.values[i]);
+      }
+      break;
+    }
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*)object;
+      writeRef(writer, buffer, (Obj*)closure->function);
+      writeRef(writer, buffer, (Obj*)closure->module);
+      writeInt(buffer, closure->upvalueCount);
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        writeRef(writer, buffer, (Obj*)closure->upvalues[i]);
+      }
+      writeInt(buffer, closure->capturedCount);
+      for (int i = 0; i < closure->capturedCount; i++) {
+        writeValue(writer, buffer, closure->captured[i]);
+      }
+      break;
+    }
+    case OBJ_UPVALUE: {
+      // 还未close的闭包变量保存它在栈中的位置
+      ObjUpvalue* upvalue = (ObjUpvalue*)object;
+      bool open = upvalue->location != &upvalue->closed;
+      writeByte(buffer, open);
+      if (open) {
+        writeInt(buffer, (int32_t)(upvalue->location - vm.stack));
+      } else {
+        writeValue(writer, buffer, upvalue->closed);
+      }
+      break;
+    }
+    case OBJ_NATIVE:
+      writeRef(writer, buffer, (Obj*)((ObjNative*)object)->name);
+      break;
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)object;
+      writeRef(writer, buffer, (Obj*)klass->name);
+      writeTable(writer, buffer, &klass->methods);
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      writeRef(writer, buffer, (Obj*)instance->klass);
+      writeTable(writer, buffer, &instance->fields);
+      break;
+    }
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod* bound = (ObjBoundMethod*)object;
+      writeValue(writer, buffer, bound->receiver);
+      writeRef(writer, buffer, (Obj*)bound->method);
+      break;
+    }
+    case OBJ_MODULE: {
+      ObjModule* module = (ObjModule*)object;
+      writeRef(writer, buffer, (Obj*)module->name);
+      writeRef(writer, buffer, (Obj*)module->directory);
+      writeTable(writer, buffer, &module->globals);
+      break;
+    }
+  }
+
+  int32_t size = buffer->count - sizeOffset - (int)sizeof(int32_t);
+  memcpy(buffer->bytes + sizeOffset, &size, sizeof(size));
+  return true;
+}
+
+bool writeSnapshot(const char* path, Value* stackTop) {
+  SnapshotWriter writer;
+  memset(&writer, 0, sizeof(writer));
+
+  // 根对象：全局变量，模块，主脚本的目录，栈中的值和调用帧，遇到的对象依次编号
+  writeTable(&writer, &writer.roots, &vm.globals);
+  writeTable(&writer, &writer.roots, &vm.modules);
+  writeRef(&writer, &writer.roots, (Obj*)vm.scriptDirectory);
+  writeInt(&writer.roots, (int32_t)(stackTop - vm.stack));
+  for (Value* slot = vm.stack; slot < stackTop; slot++) {
+    writeValue(&writer, &writer.roots, *slot);
+  }
+  writeInt(&writer.roots, vm.frameCount);
+  for (int i = 0; i < vm.frameCount; i++) {
+    CallFrame* frame = &vm.frames[i];
+    writeRef(&writer, &writer.roots, (Obj*)frame->closure);
+    writeInt(&writer.roots, (int32_t)(frame->ip - frame->closure->function->chunk.code));
+    writeInt(&writer.roots, (int32_t)(frame->slots - vm.stack));
+  }
+
+  // 广度优先的写入所有对象，写入时新遇到的对象会追加到数组末尾
+  bool success = true;
+  for (int i = 0; i < writer.objectCount && success; i++) {
+    success = writeObject(&writer, writer.objects[i]);
+  }
+
+  FILE* file = success ? fopen(path, "wb") : NULL;
+  if (file != NULL) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.fingerprint = instructionSetFingerprint();
+    header.objectCount = writer.objectCount;
+    header.objectsSize = writer.objectRecords.count;
+    header.rootsSize = writer.roots.count;
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(writer.objectRecords.bytes, 1, writer.objectRecords.count, file);
+    fwrite(writer.roots.bytes, 1, writer.roots.count, file);
+    if (ferror(file)) success = false;
+    if (fclose(file) != 0) success = false;
+  } else {
+    success = false;
+  }
+
+  FREE_ARRAY(Obj*, writer.objects, writer.objectCapacity);
+  FREE_ARRAY(Obj*, writer.keys, writer.tableCapacity);
+  FREE_ARRAY(int, writer.indexes, writer.tableCapacity);
+  FREE_ARRAY(uint8_t, writer.objectRecords.bytes, writer.objectRecords.capacity);
+  FREE_ARRAY(uint8_t, writer.roots.bytes, writer.roots.capacity);
+  return success;
+}
+
+// -------------------- 恢复 -------------------------
+
+// 已经恢复的对象，下标与快照中的下标一致
+static Obj** restored = NULL;
+static uint32_t restoredCount = 0;
+
+typedef struct {
+  const uint8_t* current;
+  const uint8_t* end;
+  // 读取越界或者数据不合法时置为true
+  bool error;
+} Reader;
+
+static const uint8_t* readBytes(Reader* reader, size_t size) {
+  if (reader->error || (size_t)(reader->end - reader->current) < size) {
+    reader->error = true;
+    return NULL;
+  }
+  const uint8_t* bytes = reader->current;
+  reader->current += size;
+  return bytes;
+}
+
+static uint8_t readByte(Reader* reader) {
+  const uint8_t* byte = readBytes(reader, 1);
+  return byte == NULL ? 0 : *byte;
+}
+
+static int32_t readInt(Reader* reader) {
+  int32_t value = 0;
+  const uint8_t* bytes = readBytes(reader, sizeof(value));
+  if (bytes != NULL) memcpy(&value, bytes, sizeof(value));
+  if (value < 0) reader->error = true;
+  return value;
+}
+
+// 读取一个对象引用并重定位为指针，type为-1时不检查对象的类型
+static Obj* readRef(Reader* reader, int type) {
+  uint32_t index = NO_OBJECT;
+  const uint8_t* bytes = readBytes(reader, sizeof(index));
+  if (bytes != NULL) memcpy(&index, bytes, sizeof(index));
+  if (index == NO_OBJECT) return NULL;
+
+  Obj* object = index < restoredCount ? restored[index] : NULL;
+  if (object == NULL || (type != -1 && object->type != (ObjType)type)) {
+    reader->error = true;
+    return NULL;
+  }
+  return object;
+}
+
+static Value readValue(Reader* reader) {
+  switch (readByte(reader)) {
+    case SNAPSHOT_NIL: return NIL_VAL;
+    case SNAPSHOT_BOOL: return BOOL_VAL(readByte(reader) != 0);
+    case SNAPSHOT_NUMBER: {
+      double number = 0;
+      const uint8_t* bytes = readBytes(reader, sizeof(number));
+      if (bytes != NULL) memcpy(&number, bytes, sizeof(number));
+      return NUMBER_VAL(number);
+    }
+    case SNAPSHOT_OBJ: {
+      Obj* object = readRef(reader, -1);
+      if (object == NULL) reader->error = true;
+      return object == NULL ? NIL_VAL : OBJ_VAL(object);
+    }
+    case SNAPSHOT_SHORT_STRING: {
+      int length = readByte(reader);
+      const uint8_t* chars = readBytes(reader, length);
+      if (chars == NULL || length > SHORT_STRING_MAX) {
+        reader->error = true;
+        return NIL_VAL;
+      }
+      return copyStringValue((const char*)chars, length);
+    }
+    default:
+      reader->error = true;
+      return NIL_VAL;
+  }
+}
+
+static void readTable(Reader* reader, Table* table) {
+  int count = readInt(reader);
+  for (int i = 0; i < count && !reader->error; i++) {
+    ObjString* key = (ObjString*)readRef(reader, OBJ_STRING);
+    Value value = readValue(reader);
+    if (key == NULL) reader->error = true;
+    if (!reader->error) tableSet(table, key, value);
+  }
+}
+
+// 第一遍：分配对象。闭包和内置函数依赖于其他对象，在第二轮(late为true)中分配
+static void allocateRecord(Reader* reader, uint32_t index, ObjType type, bool late) {
+  switch (type) {
+    case OBJ_STRING: {
+      if (late) return;
+      int length = readInt(reader);
+      const uint8_t* chars = readBytes(reader, length);
+      if (chars != NULL) restored[index] = (Obj*)copyString((const char*)chars, length);
+      return;
+    }
+    case OBJ_FUNCTION: {
+      if (late) return;
+      ObjFunction* function = newFunction();
+      restored[index] = (Obj*)function;
+      function->arity = readInt(reader);
+      function->upvalueCount = readInt(reader);
+      function->captureCount = readInt(reader);
+      function->maxSlots = readInt(reader);
+      readBytes(reader, sizeof(uint32_t));
+      // 这些数量决定了创建闭包时分配的数组大小，不能超过编译器的限制
+      if (function->upvalueCount > UINT8_COUNT || function->captureCount > UINT8_COUNT ||
+          function->maxSlots > UINT16_COUNT) {
+        reader->error = true;
+      }
+      int count = readInt(reader);
+      const uint8_t* code = readBytes(reader, count);
+      int lineCount = readInt(reader);
+      const uint8_t* lines = readBytes(reader, sizeof(LineStart) * (size_t)lineCount);
+      if (reader->error) return;
+
+      Chunk* chunk = &function->chunk;
+      chunk->code = ALLOCATE(uint8_t, count);
+      chunk->capacity = count;
+      memcpy(chunk->code, code, count);
+      chunk->count = count;
+      chunk->lines = ALLOCATE(LineStart, lineCount);
+      memcpy(chunk->lines, lines, sizeof(LineStart) * lineCount);
+      chunk->lineCount = lineCount;
+      chunk->lineCapacity = lineCount;
+      return;
+    }
+    case OBJ_CLOSURE: {
+      if (!late) return;
+      ObjFunction* function = (ObjFunction*)readRef(reader, OBJ_FUNCTION);
+      if (function != NULL) restored[index] = (Obj*)newClosure(function);
+      return;
+    }
+    case OBJ_NATIVE: {
+      if (!late) return;
+      // 内置函数按名字找回刚刚初始化的vm中定义的同名函数
+      ObjString* name = (ObjString*)readRef(reader, OBJ_STRING);
+      Value native;
+      if (name != NULL && tableGet(&vm.natives, name, &native)) {
+        restored[index] = AS_OBJ(native);
+      }
+      return;
+    }
+    case OBJ_UPVALUE:
+      if (!late) restored[index] = (Obj*)newUpvalue(NULL);
+      return;
+    case OBJ_CLASS:
+      if (!late) restored[index] = (Obj*)newClass(NULL);
+      return;
+    case OBJ_INSTANCE:
+      if (!late) restored[index] = (Obj*)newInstance(NULL);
+      return;
+    case OBJ_BOUND_METHOD:
+      if (!late) restored[index] = (Obj*)newBoundMethod(NIL_VAL, NULL);
+      return;
+    case OBJ_MODULE:
+      if (!late) restored[index] = (Obj*)newModule(NULL, NULL);
+      return;
+    case OBJ_STRING_BUILDER: {
+      if (late) return;
+      ObjStringBuilder* builder = newStringBuilder();
+      restored[index] = (Obj*)builder;
+      int length = readInt(reader);
+      const uint8_t* chars = readBytes(reader, length);
+      if (chars == NULL || length == 0) return;
+      memcpy(reserveStringBuilder(builder, length), chars, length);
+      builder->length = length;
+      return;
+    }
+    case OBJ_ROPE:
+    case OBJ_STRING_VIEW:
+      // 字符串连接的结果和子串总是作为字符串写入，不会出现在快照中
+      break;
+  }
+
+  reader->error = true;
+}
+
+// 第二遍：填充对象之间的引用
+static void fillRecord(Reader* reader, Obj* object) {
+  switch (object->type) {
+    case OBJ_STRING:
+    case OBJ_NATIVE:
+    case OBJ_ROPE:
+    case OBJ_STRING_BUILDER:
+    case OBJ_STRING_VIEW:
+      break;
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)object;
+      readBytes(reader, sizeof(int32_t) * 4);
+      function->name = (ObjString*)readRef(reader, OBJ_STRING);
+      int count = readInt(reader);
+      readBytes(reader, count);
+      int lineCount = readInt(reader);
+      readBytes(reader, sizeof(LineStart) * (size_t)lineCount);
+      int constantCount = readInt(reader);
+      for (int i = 0; i < constantCount && !reader->error; i++) {
+        // 常量都已经在restored中，写入数组时触发GC也不会被回收
+        writeValueArray(&function->chunk.constants, readValue(reader));
+      }
+      break;
+    }
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*)object;
+      readRef(reader, OBJ_FUNCTION);
+      closure->module = (ObjModule*)readRef(reader, OBJ_MODULE);
+      if (readInt(reader) != closure->upvalueCount) reader->error = true;
+      for (int i = 0; i < closure->upvalueCount && !reader->error; i++) {
+        closure->upvalues[i] = (ObjUpvalue*)readRef(reader, OBJ_UPVALUE);
+      }
+      if (readInt(reader) != closure->capturedCount) reader->error = true;
+      for (int i = 0; i < closure->capturedCount && !reader->error; i++) {
+        closure->captured[i] = readValue(reader);
+      }
+      break;
+    }
+    case OBJ_UPVALUE: {
+      // 还未close的闭包变量在恢复栈之后再链接到对应的调用帧中
+      ObjUpvalue* upvalue = (ObjUpvalue*)object;
+      if (readByte(reader)) {
+        int slot = readInt(reader);
+        if (slot >= STACK_MAX) reader->error = true;
+        upvalue->location = reader->error ? &upvalue->closed : vm.stack + slot;
+      } else {
+        upvalue->closed = readValue(reader);
+        upvalue->location = &upvalue->closed;
+      }
+      break;
+    }
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)object;
+      klass->name = (ObjString*)readRef(reader, OBJ_STRING);
+      readTable(reader, &klass->methods);
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      instance->klass = (ObjClass*)readRef(reader, OBJ_CLASS);
+      if (instance->klass == NULL) reader->error = true;
+      readTable(reader, &instance->fields);
+      break;
+    }
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod* bound = (ObjBoundMethod*)object;
+      bound->receiver = readValue(reader);
+      bound->method = (ObjClosure*)readRef(reader, OBJ_CLOSURE);
+      if (bound->method == NULL) reader->error = true;
+      break;
+    }
+    case OBJ_MODULE: {
+      ObjModule* module = (ObjModule*)object;
+      module->name = (ObjString*)readRef(reader, OBJ_STRING);
+      if (module->name == NULL) reader->error = true;
+      module->directory = (ObjString*)readRef(reader, OBJ_STRING);
+      readTable(reader, &module->globals);
+      break;
+    }
+  }
+}
+
+// 依次处理每一条对象记录，pass为0、1时分配对象，为2时填充引用
+static bool readObjects(const uint8_t* bytes, size_t size, int pass) {
+  Reader records = { bytes, bytes + size, false };
+  for (uint32_t i = 0; i < restoredCount; i++) {
+    ObjType type = (ObjType)readByte(&records);
+    int32_t recordSize = readInt(&records);
+    const uint8_t* start = readBytes(&records, recordSize);
+    if (records.error) return false;
+
+    Reader reader = { start, start + recordSize, false };
+    if (pass < 2) {
+      allocateRecord(&reader, i, type, pass == 1);
+      // 第二轮结束时所有的对象都应该已经分配好了
+      if (pass == 1 && restored[i] == NULL) return false;
+    } else {
+      if (restored[i]->type != type) return false;
+      fillRecord(&reader, restored[i]);
+    }
+    if (reader.error) return false;
+  }
+  return records.current == records.end;
+}
+
+// 恢复全局变量、模块、主脚本的目录、栈和调用帧
+static bool readRoots(Reader* reader) {
+  readTable(reader, &vm.globals);
+  readTable(reader, &vm.modules);
+  vm.scriptDirectory = (ObjString*)readRef(reader, OBJ_STRING);
+
+  // 栈中还需要留出位置存放snapshot()的返回值
+  int stackCount = readInt(reader);
+  if (stackCount >= STACK_MAX) return false;
+  for (int i = 0; i < stackCount && !reader->error; i++) {
+    vm.stack[i] = readValue(reader);
+    vm.stackTop = vm.stack + i + 1;
+  }
+
+  int frameCount = readInt(reader);
+  if (frameCount == 0 || frameCount > FRAMES_MAX) return false;
+  for (int i = 0; i < frameCount && !reader->error; i++) {
+    CallFrame* frame = &vm.frames[i];
+    frame->closure = (ObjClosure*)readRef(reader, OBJ_CLOSURE);
+    int ip = readInt(reader);
+    int slots = readInt(reader);
+    if (frame->closure == NULL || ip > frame->closure->function->chunk.count ||
+        slots > stackCount) {
+      return false;
+    }
+    frame->ip = frame->closure->function->chunk.code + ip;
+    frame->slots = vm.stack + slots;
+    frame->openUpvalues = NULL;
+    frame->globals = frame->closure->module == NULL
+        ? &vm.globals : &frame->closure->module->globals;
+    vm.frameCount = i + 1;
+  }
+
+  if (reader->error || reader->current != reader->end) return false;
+
+  // 将还未close的闭包变量放回索引，并链接到它所在的调用帧中
+  for (uint32_t i = 0; i < restoredCount; i++) {
+    if (restored[i]->type != OBJ_UPVALUE) continue;
+    ObjUpvalue* upvalue = (ObjUpvalue*)restored[i];
+    if (upvalue->location == &upvalue->closed) continue;
+    if (upvalue->location >= vm.stackTop) return false;
+
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    while (frame > vm.frames && frame->slots > upvalue->location) frame--;
+    vm.openUpvalues[upvalue->location - vm.stack] = upvalue;
+    upvalue->next = frame->openUpvalues;
+    if (frame->openUpvalues != NULL) frame->openUpvalues->prev = upvalue;
+    frame->openUpvalues = upvalue;
+  }
+
+  // snapshot()调用的返回值
+  push(BOOL_VAL(true));
+  return true;
+}
+
+static uint8_t* readSnapshotFile(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  long fileSize = ftell(file);
+  rewind(file);
+
+  // 一次读入整个快照
+  uint8_t* buffer = fileSize > 0 ? (uint8_t*)malloc(fileSize) : NULL;
+  if (buffer != NULL && fread(buffer, 1, fileSize, file) < (size_t)fileSize) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(file);
+
+  *size = (size_t)fileSize;
+  return buffer;
+}
+
+bool restoreSnapshot(const char* path) {
+  size_t size;
+  uint8_t* buffer = readSnapshotFile(path, &size);
+  if (buffer == NULL) return false;
+
+  SnapshotHeader header;
+  bool success = size >= sizeof(header);
+  if (success) {
+    memcpy(&header, buffer, sizeof(header));
+    success = memcmp(header.magic, SNAPSHOT_MAGIC, 4) == 0 &&
+              header.version == SNAPSHOT_VERSION &&
+              header.fingerprint == instructionSetFingerprint() &&
+              header.objectsSize <= size - sizeof(header) &&
+              header.rootsSize == size - sizeof(header) - header.objectsSize &&
+              header.objectCount <= header.objectsSize;
+  }
+
+  if (success) {
+    const uint8_t* objects = buffer + sizeof(header);
+    restored = ALLOCATE(Obj*, header.objectCount);
+    for (uint32_t i = 0; i < header.objectCount; i++) restored[i] = NULL;
+    restoredCount = header.objectCount;
+
+    success = readObjects(objects, header.objectsSize, 0) &&
+              readObjects(objects, header.objectsSize, 1) &&
+              readObjects(objects, header.objectsSize, 2);
+    if (success) {
+      Reader roots = { objects + header.objectsSize, buffer + size, false };
+      success = readRoots(&roots);
+    }
+
+    FREE_ARRAY(Obj*, restored, restoredCount);
+    restored = NULL;
+    restoredCount = 0;
+  }
+
+  free(buffer);
+  return success;
+}
+
+void markSnapshotRoots() {
+  for (uint32_t i = 0; i < restoredCount; i++) {
+    markObject(restored[i]);
+  }
+}
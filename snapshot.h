@@ -0,0 +1,25 @@
+#ifndef clox_snapshot_h
+#define clox_snapshot_h
+
+#include "common.h"
+#include "value.h"
+
+/*
+  堆快照：clox --snapshot out.img script.lox 执行脚本直到调用内置函数snapshot()，
+  然后将所有可以到达的对象(全局变量、类、闭包、实例、字符串等)连同栈和调用帧一起写入快照文件。
+
+  clox --from-snapshot out.img 一次读入整个快照，重新分配所有对象并将对象之间的引用(快照中的下标)
+  重定位为新的指针，然后从snapshot()调用返回的地方继续执行，不需要再执行一遍初始化的代码。
+  恢复之后snapshot()返回true，正常执行时返回false。
+*/
+
+// 写入快照，stackTop之上的值(snapshot()本身和它的参数)不会写入
+bool writeSnapshot(const char* path, Value* stackTop);
+
+// 从快照中恢复堆、栈和调用帧，并压入snapshot()的返回值，之后调用resume()继续执行
+bool restoreSnapshot(const char* path);
+
+// 恢复的过程中已经分配的对象也是根对象
+void markSnapshotRoots();
+
+#endif
@@ -0,0 +1,17 @@
+// 由superinstructions.py根据以下指令频率统计生成，请勿手动修改：
+// opcodes.profile
+#ifndef clox_superinstructions_h
+#define clox_superinstructions_h
+
+// SUPERINSTRUCTION(超级指令, 子指令个数, 子指令1, 子指令2, 子指令3)
+#define SUPERINSTRUCTIONS(SUPERINSTRUCTION) \
+  SUPERINSTRUCTION(OP_ADD_SET_GLOBAL_POP, 3, OP_ADD, OP_SET_GLOBAL, OP_POP) \
+  SUPERINSTRUCTION(OP_CONSTANT_SET_PROPERTY_POP, 3, OP_CONSTANT, OP_SET_PROPERTY, OP_POP) \
+  SUPERINSTRUCTION(OP_GET_GLOBAL_CONSTANT_LESS, 3, OP_GET_GLOBAL, OP_CONSTANT, OP_LESS) \
+  SUPERINSTRUCTION(OP_GET_LOCAL_CONSTANT_LESS, 3, OP_GET_LOCAL, OP_CONSTANT, OP_LESS) \
+  SUPERINSTRUCTION(OP_POP_GET_GLOBAL_GET_GLOBAL, 3, OP_POP, OP_GET_GLOBAL, OP_GET_GLOBAL) \
+  SUPERINSTRUCTION(OP_ADD_GET_GLOBAL, 2, OP_ADD, OP_GET_GLOBAL, 0) \
+  SUPERINSTRUCTION(OP_GET_LOCAL_CONSTANT, 2, OP_GET_LOCAL, OP_CONSTANT, 0) \
+  SUPERINSTRUCTION(OP_GET_LOCAL_GET_PROPERTY, 2, OP_GET_LOCAL, OP_GET_PROPERTY, 0) \
+
+#endif
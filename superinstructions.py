@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+根据指令频率统计文件生成超级指令(superinstructions)。
+
+1. 在common.h中开启DEBUG_PROFILE_OPCODES，编译clox，运行有代表性的脚本，
+   每次运行都会把相邻指令的执行次数追加写入opcodes.profile。
+2. 运行 `python3 superinstructions.py opcodes.profile [更多统计文件...]`，
+   该脚本会挑选出执行次数最多的指令序列，生成：
+   - superinstructions.h: 超级指令的操作码以及编译器使用的匹配表
+   - vm.c中 BEGIN/END GENERATED SUPERINSTRUCTIONS 之间的执行代码
+3. 关闭DEBUG_PROFILE_OPCODES，重新编译clox。
+"""
+
+import argparse
+import os
+import sys
+from collections import Counter
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# 可以被合并的指令以及vm.c中对应的执行体宏。
+# 这些指令都不会改变控制流，并且指令长度固定。
+FUSABLE = {
+    "OP_CONSTANT": "EXEC_CONSTANT",
+    "OP_NIL": "EXEC_NIL",
+    "OP_TRUE": "EXEC_TRUE",
+    "OP_FALSE": "EXEC_FALSE",
+    "OP_POP": "EXEC_POP",
+    "OP_GET_LOCAL": "EXEC_GET_LOCAL",
+    "OP_SET_LOCAL": "EXEC_SET_LOCAL",
+    "OP_GET_UPVALUE": "EXEC_GET_UPVALUE",
+    "OP_SET_UPVALUE": "EXEC_SET_UPVALUE",
+    "OP_GET_CAPTURED": "EXEC_GET_CAPTURED",
+    "OP_DEFINE_GLOBAL": "EXEC_DEFINE_GLOBAL",
+    "OP_GET_GLOBAL": "EXEC_GET_GLOBAL",
+    "OP_SET_GLOBAL": "EXEC_SET_GLOBAL",
+    "OP_GET_PROPERTY": "EXEC_GET_PROPERTY",
+    "OP_SET_PROPERTY": "EXEC_SET_PROPERTY",
+    "OP_ADD": "EXEC_ADD",
+    "OP_SUBTRACT": "EXEC_SUBTRACT",
+    "OP_MULTIPLY": "EXEC_MULTIPLY",
+    "OP_DIVIDE": "EXEC_DIVIDE",
+    "OP_GREATER": "EXEC_GREATER",
+    "OP_LESS": "EXEC_LESS",
+    "OP_EQUAL": "EXEC_EQUAL",
+    "OP_NOT": "EXEC_NOT",
+    "OP_NEGATE": "EXEC_NEGATE",
+    "OP_PRINT": "EXEC_PRINT",
+}
+
+BEGIN_MARKER = "// BEGIN GENERATED SUPERINSTRUCTIONS"
+END_MARKER = "// END GENERATED SUPERINSTRUCTIONS"
+
+
+def read_profiles(paths):
+    counts = Counter()
+    for path in paths:
+        with open(path) as f:
+            for lineno, line in enumerate(f, 1):
+                fields = line.split()
+                if not fields:
+                    continue
+                if len(fields) not in (3, 4):
+                    sys.exit("%s:%d: malformed line" % (path, lineno))
+                counts[tuple(fields[1:])] += int(fields[0])
+    return counts
+
+
+def select(counts, limit):
+    counts = Counter({ops: count for ops, count in counts.items()
+                      if all(op in FUSABLE for op in ops)})
+    chosen = []
+    while counts and len(chosen) < limit:
+        # 每合并一条指令就能节省一次指令分发
+        ops = min(counts, key=lambda o: (-counts[o] * (len(o) - 1), o))
+        if counts[ops] <= 0:
+            break
+        chosen.append(ops)
+        # 被三元组覆盖的执行次数不会再由其中的二元组节省
+        if len(ops) == 3:
+            for pair in (ops[:2], ops[1:]):
+                if pair in counts:
+                    counts[pair] -= counts[ops]
+        del counts[ops]
+    # 编译器按顺序匹配，因此较长的序列必须排在前面
+    chosen.sort(key=lambda ops: (-len(ops), ops))
+    return chosen
+
+
+def opcode_name(ops):
+    return "OP_" + "_".join(op[len("OP_"):] for op in ops)
+
+
+def write_header(chosen, sources):
+    lines = [
+        "// 由superinstructions.py根据以下指令频率统计生成，请勿手动修改：",
+        "// " + ", ".join(sources),
+        "#ifndef clox_superinstructions_h",
+        "#define clox_superinstructions_h",
+        "",
+        "// SUPERINSTRUCTION(超级指令, 子指令个数, 子指令1, 子指令2, 子指令3)",
+        "#define SUPERINSTRUCTIONS(SUPERINSTRUCTION) \\",
+    ]
+    for ops in chosen:
+        padded = list(ops) + ["0"] * (3 - len(ops))
+        lines.append("  SUPERINSTRUCTION(%s, %d, %s) \\"
+                     % (opcode_name(ops), len(ops), ", ".join(padded)))
+    lines.append("")
+    lines.append("#endif")
+    with open(os.path.join(HERE, "superinstructions.h"), "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def write_handlers(chosen):
+    path = os.path.join(HERE, "vm.c")
+    with open(path) as f:
+        source = f.read()
+
+    begin = source.index(BEGIN_MARKER)
+    begin = source.index("\n", begin) + 1
+    end = source.index(END_MARKER)
+    end = source.rindex("\n", 0, end) + 1
+
+    cases = []
+    for ops in chosen:
+        cases.append("      case %s: {" % opcode_name(ops))
+        for i, op in enumerate(ops):
+            if i > 0:
+                # 跳过子指令的操作码
+                cases.append("        ip++;")
+            cases.append("        %s();" % FUSABLE[op])
+        cases.append("        break;")
+        cases.append("      }")
+
+    generated = "".join(line + "\n" for line in cases)
+    with open(path, "w") as f:
+        f.write(source[:begin] + generated + source[end:])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("profiles", nargs="+", help="opcodes.profile files")
+    parser.add_argument("-n", "--count", type=int, default=8,
+                        help="number of superinstructions (default: 8)")
+    args = parser.parse_args()
+
+    chosen = select(read_profiles(args.profiles), args.count)
+    write_header(chosen, [os.path.basename(p) for p in args.profiles])
+    write_handlers(chosen)
+    for ops in chosen:
+        print("%s = %s" % (opcode_name(ops), " + ".join(ops)))
+
+
+if __name__ == "__main__":
+    main()
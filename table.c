@@ -21,9 +21,30 @@ void freeTable(Table* table) {
   initTable(table);
 }
 
+// 用运行时生成的没有intern的字符串查找：地址不同时还需要比较内容
+// 不内联：保持findEntry足够小，可以内联到tableGet和tableSet中
+__attribute__((noinline))
+static Entry* findEntryByContent(Entry* entries, int capacity, ObjString* key) {
+  uint32_t index = stringHash(key) & (capacity - 1);
+  Entry* tombstone = NULL;
+  for (;;) {
+    Entry* entry = &entries[index];
+    if (entry->key == NULL) {
+      if (IS_NIL(entry->value)) {
+        return tombstone != NULL ? tombstone : entry;
+      } else {
+        if (tombstone == NULL) tombstone = entry;
+      }
+    } else if (isStringEqual(entry->key, key)) {
+      return entry;
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
 // 找到key所在的位置，如果key不存在，找到一个僵尸位或者空位
-static Entry* findEntry(Entry* entries, int capacity,
-                        ObjString* key) {
+static inline Entry* findEntry(Entry* entries, int capacity,
+                               ObjString* key) {
 
   /* 
     NOTE: 在实际的lox程序中涉及到大量的属性和方法读取，在我们的哈希表中就会有大量的取模操作，而这个操作会极大的影响性能。
@@ -31,6 +52,8 @@ static Entry* findEntry(Entry* entries, int capacity,
     一个简单的优化策略就是将取模操作转化为位操作：例如 229 % 64 === 229 & 63 === 37
    */
   
+  if (!key->interned) return findEntryByContent(entries, capacity, key);
+
 	// hash值为较大的正数，用取模的值为数组的下标
   // uint32_t index = key->hash % capacity;
   uint32_t index = key->hash & (capacity - 1);
@@ -50,7 +73,7 @@ static Entry* findEntry(Entry* entries, int capacity,
         // 缓存僵尸位
         if (tombstone == NULL) tombstone = entry;
       }
-      // lox中的字符串都做了缓存处理，字面相同的字符串必然指向同一个内存地址，因此可以直接比较
+      // 表中的键都做了缓存处理(intern)，字面相同的字符串必然指向同一个内存地址，因此可以直接比较
     } else if (entry->key == key) {
       return entry;
     }
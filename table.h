@@ -21,6 +21,7 @@ void initTable(Table* table);
 void freeTable(Table* table);
 
 // table methods
+// 存入的键必须是intern过的字符串(见object.h中的internString)，查找和删除时可以使用任意字符串
 bool tableSet(Table* table, ObjString* key, Value value);
 bool tableGet(Table* table, ObjString* key, Value* value);
 bool tableDelete(Table* table, ObjString* key);
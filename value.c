@@ -3,6 +3,7 @@
 
 #include "object.h"
 #include "memory.h"
+#include "number.h"
 #include "value.h"
 
 void initValueArray(ValueArray* array) {
@@ -28,6 +29,13 @@ void freeValueArray(ValueArray* array) {
   initValueArray(array);       
 }
 
+// 打印数字：最短并且能够精确还原的十进制表示，不同平台上的输出完全相同
+static void printNumber(double number) {
+  char buffer[NUMBER_MAX_LENGTH + 1];
+  formatNumber(number, buffer);
+  fputs(buffer, stdout);
+}
+
 void printValue(Value value) {
   #ifdef NAN_BOXING                             
     if (IS_BOOL(value)) {                       
@@ -35,7 +43,11 @@ void printValue(Value value) {
     } else if (IS_NIL(value)) {                 
       printf("nil");                            
     } else if (IS_NUMBER(value)) {              
-      printf("%g", AS_NUMBER(value));           
+      printNumber(AS_NUMBER(value));
+    } else if (IS_SHORT_STRING(value)) {
+      char chars[8];
+      shortStringChars(value, chars);
+      fwrite(chars, 1, SHORT_STRING_LENGTH(value), stdout);
     } else if (IS_OBJ(value)) {                 
       printObject(value);                       
     }                                           
@@ -43,12 +55,35 @@ void printValue(Value value) {
     switch (value.type) {
       case VAL_BOOL:   printf(AS_BOOL(value) ? "true" : "false"); break;
       case VAL_NIL:    printf("nil"); break;
-      case VAL_NUMBER: printf("%f", AS_NUMBER(value)); break;
+      case VAL_NUMBER: printNumber(AS_NUMBER(value)); break;
       case VAL_OBJ:    printObject(value); break;
     }
   #endif
 }
 
+// 运行时生成的字符串、字符串连接的结果(ObjRope)和子串没有intern，地址不同时需要比较内容
+static bool isTextEqual(Value a, Value b) {
+  if (!IS_TEXT(a) || !IS_TEXT(b)) return false;
+  int length = textLength(a);
+  if (textLength(b) != length) return false;
+
+  // 短字符串(以及同样短的其他字符串)直接复制出来比较，不需要分配
+  if (length <= SHORT_STRING_MAX) {
+    char aChars[8];
+    char bChars[8];
+    copyText(a, aChars);
+    copyText(b, bChars);
+    return memcmp(aChars, bChars, length) == 0;
+  }
+  // 子串直接比较它引用的内容，不需要复制出来
+  if (IS_STRING_VIEW(a) || IS_STRING_VIEW(b)) {
+    char aBuffer[8];
+    char bBuffer[8];
+    return memcmp(textChars(a, aBuffer), textChars(b, bBuffer), length) == 0;
+  }
+  return isStringEqual(asFlatString(a), asFlatString(b));
+}
+
 // 为什么不直接用内存比较：由于各个平台在存储Struct的时候内存偏移量不一致
 bool isEuqal(Value a, Value b) {
   #ifdef NAN_BOXING
@@ -56,7 +91,8 @@ bool isEuqal(Value a, Value b) {
     // c中的double类型就实现了IEEE754, 我们需要将数字转为double类型进行对比既可
     if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
     // 由于我们的Value被表示成了uint64_t类型，所以只需要直接比较该值既可判断是否相等
-    return a == b;
+    if (a == b) return true;
+    return isTextEqual(a, b);
   #else
     // 这里使用类型和值进行比较
     if (a.type != b.type) return false;
@@ -66,7 +102,8 @@ bool isEuqal(Value a, Value b) {
       case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
       case VAL_OBJ: {
         // 由于同一个字符串的对象被收集到对象池中，因此只要内存地址相同，则一定是同一个字符串
-        return AS_OBJ(a) == AS_OBJ(b);
+        if (AS_OBJ(a) == AS_OBJ(b)) return true;
+        return isTextEqual(a, b);
       }
     }
   #endif
@@ -74,9 +74,38 @@ typedef struct sObjString ObjString;
   // 用位运算来判断v的具体位数的值，从而判断他的类型
   #define IS_NUMBER(v)    (((v) & QNAN) != QNAN)
   #define IS_NIL(v)       ((v) == NIL_VAL)
-  #define IS_BOOL(v)      (((v) & FALSE_VAL) == FALSE_VAL)
+  // true和false只有最低位不同，不能只检查TAG_FALSE的两位：短字符串的内容中也可能有这两位
+  #define IS_BOOL(v)      (((v) | 1) == TRUE_VAL)
   #define IS_OBJ(v)       (((v) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
+  /*
+    短字符串：不超过5个字节的字符串直接保存在Value中，不分配ObjString，也不需要GC追踪。
+    正负标记位为0，分数位的第49位为1(nil、true和false的这一位为0)，
+    第40~42位为长度，第0~39位依次为各个字节，没有用到的字节为0。
+    长度不超过SHORT_STRING_MAX的字符串值总是使用这种表示，因此相同的短字符串的Value也完全相同
+  */
+  #define TAG_SHORT_STRING ((uint64_t)0x0002000000000000)
+  #define SHORT_STRING_MAX 5
+  #define IS_SHORT_STRING(v) \
+    (((v) & (SIGN_BIT | QNAN | TAG_SHORT_STRING)) == (QNAN | TAG_SHORT_STRING))
+  #define SHORT_STRING_LENGTH(v) ((int)(((v) >> 40) & 0x7))
+
+  static inline Value shortStringValue(const char* chars, int length) {
+    uint64_t bits = QNAN | TAG_SHORT_STRING | ((uint64_t)length << 40);
+    for (int i = 0; i < length; i++) {
+      bits |= (uint64_t)(uint8_t)chars[i] << (i * 8);
+    }
+    return bits;
+  }
+
+  // 将短字符串的内容复制到dest中，复制SHORT_STRING_LENGTH(value)个字节
+  static inline void shortStringChars(Value value, char* dest) {
+    int length = SHORT_STRING_LENGTH(value);
+    for (int i = 0; i < length; i++) {
+      dest[i] = (char)(value >> (i * 8));
+    }
+  }
+
 #else
   typedef enum {
     VAL_BOOL,
@@ -114,6 +143,13 @@ typedef struct sObjString ObjString;
   #define AS_BOOL(value)    ((value).as.boolean)
   #define AS_NUMBER(value)  ((value).as.number)
   #define AS_OBJ(value)     ((value).as.obj)
+
+  // 没有NaN boxing时没有短字符串，所有的字符串都是ObjString
+  #define SHORT_STRING_MAX (-1)
+  #define IS_SHORT_STRING(value) false
+  #define SHORT_STRING_LENGTH(value) 0
+  static inline Value shortStringValue(const char* chars, int length) { return NIL_VAL; }
+  static inline void shortStringChars(Value value, char* dest) {}
 #endif
 
 typedef struct {     
@@ -126,6 +162,7 @@ void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
+// 字符串按内容比较。比较字符串连接的结果时可能需要展开(见object.h中的ObjRope)，会触发GC，a和b需要能从根访问到
 bool isEuqal(Value a, Value b);
 
 #endif
\ No newline at end of file
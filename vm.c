@@ -1,13 +1,23 @@
+// realpath是POSIX的函数，在-std=c99等严格的模式下需要显式声明需要的标准，否则会被隐式声明为返回int
+#define _XOPEN_SOURCE 700
+
+#include <limits.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "debug.h"
 #include "memory.h"
 #include "object.h"
 #include "compiler.h"
+#include "image.h"
+#include "number.h"
+#include "search.h"
+#include "snapshot.h"
 #include "value.h"
 #include "vm.h"
 
@@ -23,22 +33,26 @@ static Value clockNative(int argCount, Value* args) {
 }
 
 static void resetStack() {
+  // 清空还未close的闭包变量的索引
+  for (int i = 0; i < vm.frameCount; i++) {
+    for (ObjUpvalue* upvalue = vm.frames[i].openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+      vm.openUpvalues[upvalue->location - vm.stack] = NULL;
+    }
+  }
+
   // 将栈顶指向数组初始的第一个位置为清空栈
   vm.stackTop = vm.stack;
   vm.frameCount = 0;
-  vm.openUpvalues = NULL;
 }
 
-// c的可变长参数函数
-static void runtimeError(const char* format, ...) {
-  // 定义一个va_list类型的变量，变量是指向参数的指针。
-  va_list args;
-  // va_start初始化刚定义的变量，第二个参数是最后一个显式声明的参数。
-  va_start(args, format);
+// 输出错误信息和调用栈，然后清空栈
+static void reportError(const char* format, va_list args) {
+  // 先写出之前print的内容，错误信息才会出现在它们之后
+  flushOutput(&vm.output);
+
   // 将args已format的形式写入到stderr中
   vfprintf(stderr, format, args);
-  // va_end将变量args重置为NULL。
-  va_end(args);
   fputs("\n", stderr);
 
   // 简单写入出错的行数
@@ -53,10 +67,9 @@ static void runtimeError(const char* format, ...) {
     ObjFunction* function = frame->closure->function;
     // -1 because the IP is sitting on the next instruction to be
     // executed.
-    // FIXME: restore register ip into frame's ip
     size_t instruction = frame->ip - function->chunk.code - 1;
     fprintf(stderr, "[line %d] in ",
-            function->chunk.lines[instruction]);
+            getLine(&function->chunk, (int)instruction));
     if (function->name == NULL) {
       fprintf(stderr, "script\n");
     } else {
@@ -67,12 +80,229 @@ static void runtimeError(const char* format, ...) {
   resetStack();
 }
 
+// c的可变长参数函数
+static void runtimeError(const char* format, ...) {
+  // 定义一个va_list类型的变量，变量是指向参数的指针。
+  va_list args;
+  // va_start初始化刚定义的变量，第二个参数是最后一个显式声明的参数。
+  va_start(args, format);
+  reportError(format, args);
+  // va_end将变量args重置为NULL。
+  va_end(args);
+}
+
+// 内置函数报告了运行时错误，callValue在内置函数返回之后检查并中止执行
+static bool nativeFailed = false;
+
+// 内置函数中的运行时错误：报告错误并清空栈，返回值会被忽略
+static Value nativeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  reportError(format, args);
+  va_end(args);
+  nativeFailed = true;
+  return NIL_VAL;
+}
+
+// 检查内置函数的参数个数
+static bool checkArity(int argCount, int arity) {
+  if (argCount == arity) return true;
+  nativeError("Expected %d arguments but got %d.", arity, argCount);
+  return false;
+}
+
+// 快照的标记：在--snapshot模式下，将当前的整个堆写入快照文件然后退出。
+// 从快照中恢复之后程序从这里继续执行并返回true，正常执行时什么都不做，返回false
+static Value snapshotNative(int argCount, Value* args) {
+  if (vm.snapshotPath == NULL) return BOOL_VAL(false);
+
+  // snapshot()本身和它的参数不写入快照，恢复时直接压入返回值
+  flushOutput(&vm.output);
+  if (!writeSnapshot(vm.snapshotPath, args - 1)) {
+    fprintf(stderr, "Could not write snapshot \"%s\".\n", vm.snapshotPath);
+    exit(74);
+  }
+  exit(0);
+}
+
+// 立即写出print缓冲区中的内容
+static Value flushNative(int argCount, Value* args) {
+  flushOutput(&vm.output);
+  return NIL_VAL;
+}
+
+// StringBuilder(): 创建一个空的字符串缓冲区(见object.h中的ObjStringBuilder)
+static Value stringBuilderNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 0)) return NIL_VAL;
+  return OBJ_VAL(newStringBuilder());
+}
+
+// append(builder, text): 将字符串追加到缓冲区的末尾，返回builder本身
+static Value appendNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 2)) return NIL_VAL;
+  if (!IS_STRING_BUILDER(args[0]) || !IS_TEXT(args[1])) {
+    return nativeError("append() expects a string builder and a string.");
+  }
+
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+  int length = textLength(args[1]);
+  if (length > INT_MAX - builder->length) return nativeError("String too long.");
+  // 扩容时builder和text都还在栈上。rope直接逐段复制，不需要先展开
+  copyText(args[1], reserveStringBuilder(builder, length));
+  builder->length += length;
+  return args[0];
+}
+
+// appendNumber(builder, number): 将数字按print的格式追加到缓冲区的末尾，返回builder本身
+static Value appendNumberNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 2)) return NIL_VAL;
+  if (!IS_STRING_BUILDER(args[0]) || !IS_NUMBER(args[1])) {
+    return nativeError("appendNumber() expects a string builder and a number.");
+  }
+
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+  if (builder->length > INT_MAX - (NUMBER_MAX_LENGTH + 1)) return nativeError("String too long.");
+  // 直接格式化到缓冲区中，不生成中间的字符串
+  char* dest = reserveStringBuilder(builder, NUMBER_MAX_LENGTH + 1);
+  builder->length += formatNumber(AS_NUMBER(args[1]), dest);
+  return args[0];
+}
+
+// length(value): 字符串或者字符串缓冲区的长度
+static Value lengthNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 1)) return NIL_VAL;
+  if (IS_STRING_BUILDER(args[0])) return NUMBER_VAL(AS_STRING_BUILDER(args[0])->length);
+  if (IS_TEXT(args[0])) return NUMBER_VAL(textLength(args[0]));
+  return nativeError("length() expects a string or a string builder.");
+}
+
+// toString(builder): 用缓冲区当前的内容生成一个字符串，缓冲区本身不变，可以继续追加
+static Value toStringNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 1)) return NIL_VAL;
+  if (!IS_STRING_BUILDER(args[0])) return nativeError("toString() expects a string builder.");
+
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+  return newStringValue(builder->chars, builder->length);
+}
+
+// 字符串内置函数的下标参数：必须是min到max之间的整数
+static bool indexArgument(Value value, int min, int max, int* index) {
+  if (!IS_NUMBER(value)) {
+    nativeError("Index must be a number.");
+    return false;
+  }
+  double number = AS_NUMBER(value);
+  if (!(number >= min && number <= max)) {
+    nativeError("Index out of range.");
+    return false;
+  }
+  if (number != (int)number) {
+    nativeError("Index must be an integer.");
+    return false;
+  }
+  *index = (int)number;
+  return true;
+}
+
+// substring(text, start, end): text中[start, end)的部分，较长的结果不复制内容(见object.h中的ObjStringView)
+static Value substringNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 3)) return NIL_VAL;
+  if (!IS_TEXT(args[0])) return nativeError("substring() expects a string.");
+
+  int length = textLength(args[0]);
+  int start;
+  int end;
+  if (!indexArgument(args[1], 0, length, &start) || !indexArgument(args[2], start, length, &end)) {
+    return NIL_VAL;
+  }
+  return substring(args[0], start, end - start);
+}
+
+// indexOf(text, needle[, from]): needle从from(默认为0)开始第一次出现的位置，找不到时返回-1
+static Value indexOfNative(int argCount, Value* args) {
+  if (argCount != 2 && argCount != 3) {
+    return nativeError("Expected 2 or 3 arguments but got %d.", argCount);
+  }
+  if (!IS_TEXT(args[0]) || !IS_TEXT(args[1])) return nativeError("indexOf() expects two strings.");
+
+  int length = textLength(args[0]);
+  int from = 0;
+  if (argCount == 3 && !indexArgument(args[2], 0, length, &from)) return NIL_VAL;
+
+  // 展开needle时触发GC不会影响text的内容：对象不会被移动，text还在栈上
+  char textBuffer[8];
+  char needleBuffer[8];
+  const char* chars = textChars(args[0], textBuffer);
+  const char* needle = textChars(args[1], needleBuffer);
+  int found = findText(chars + from, length - from, needle, textLength(args[1]));
+  return NUMBER_VAL(found < 0 ? -1 : found + from);
+}
+
+// startsWith(text, prefix)
+static Value startsWithNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 2)) return NIL_VAL;
+  if (!IS_TEXT(args[0]) || !IS_TEXT(args[1])) return nativeError("startsWith() expects two strings.");
+
+  int length = textLength(args[1]);
+  if (length > textLength(args[0])) return BOOL_VAL(false);
+  char textBuffer[8];
+  char prefixBuffer[8];
+  const char* chars = textChars(args[0], textBuffer);
+  const char* prefix = textChars(args[1], prefixBuffer);
+  return BOOL_VAL(memcmp(chars, prefix, length) == 0);
+}
+
+// charAt(text, index): 第index个字节组成的字符串
+static Value charAtNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 2)) return NIL_VAL;
+  if (!IS_TEXT(args[0])) return nativeError("charAt() expects a string.");
+
+  int index;
+  if (!indexArgument(args[1], 0, textLength(args[0]) - 1, &index)) return NIL_VAL;
+  char buffer[8];
+  return newStringValue(textChars(args[0], buffer) + index, 1);
+}
+
+/*
+  split(text, separator, index): 用separator分隔text之后的第index段(从0开始)，段数不够时返回nil。
+  语言中还没有数组，因此每次只取出一段，依次递增index直到返回nil就可以遍历所有的段。
+  和substring一样，较长的结果不复制内容
+*/
+static Value splitNative(int argCount, Value* args) {
+  if (!checkArity(argCount, 3)) return NIL_VAL;
+  if (!IS_TEXT(args[0]) || !IS_TEXT(args[1])) return nativeError("split() expects two strings.");
+
+  int separatorLength = textLength(args[1]);
+  if (separatorLength == 0) return nativeError("Separator must not be empty.");
+  int index;
+  if (!indexArgument(args[2], 0, INT_MAX, &index)) return NIL_VAL;
+
+  int length = textLength(args[0]);
+  char textBuffer[8];
+  char separatorBuffer[8];
+  const char* chars = textChars(args[0], textBuffer);
+  const char* separator = textChars(args[1], separatorBuffer);
+
+  // 跳过前index段
+  int start = 0;
+  for (int i = 0; i < index; i++) {
+    int found = findText(chars + start, length - start, separator, separatorLength);
+    if (found < 0) return NIL_VAL;
+    start += found + separatorLength;
+  }
+
+  int end = findText(chars + start, length - start, separator, separatorLength);
+  end = end < 0 ? length : start + end;
+  return substring(args[0], start, end - start);
+}
+
 // 定义一个内置函数
 static void defineNative(const char* name, NativeFn function) {
   // Note: push, pop操作是为了垃圾回收
   push(OBJ_VAL(copyString(name, (int)strlen(name))));
-  push(OBJ_VAL(newNative(function)));
-  // 将其插入全局变量中
+  push(OBJ_VAL(newNative(function, AS_STRING(vm.stack[0]))));
+  // 将其插入内置函数表和全局变量中
+  tableSet(&vm.natives, AS_STRING(vm.stack[0]), vm.stack[1]);
   tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
   pop();
   pop();
@@ -87,24 +317,20 @@ static bool toBool(Value value) {
   return true;
 }
 
-static void concatenate() {
-  ObjString* b = AS_STRING(peek(0));
-  ObjString* a = AS_STRING(peek(1));
+// 连接栈顶的两个字符串，结果的长度超出int的范围时返回false
+static bool concatenate() {
+  // rope让反复倍增一个字符串的代价很低，几十次连接之后长度就会溢出
+  if (textLength(peek(1)) > INT_MAX - textLength(peek(0))) return false;
 
-  // 把a和b的字符串拷贝到一个新的字符串中
-  // int length = a->length + b->length;
-  // char* chars = ALLOCATE(char, length + 1);
-  // memcpy(chars, a->chars, a->length);
-  // memcpy(chars + a->length, b->chars, b->length);
-  // chars[length] = '\0';  
-
-  ObjString* result = concatenateString(a, b);
+  // a和b在连接完成之前留在栈上：分配新对象时可能触发GC
+  Value result = concatenateString(peek(1), peek(0));
 
   // GC edge-case:
   pop();
   pop();
 
-  push(OBJ_VAL(result));
+  push(result);
+  return true;
 }
 
 static bool call(ObjClosure* closure, int argCount) {
@@ -115,8 +341,27 @@ static bool call(ObjClosure* closure, int argCount) {
     return false;
   }
 
+  // 延迟编译的函数，在第一次调用时才编译函数体
+  if (closure->function->lazySource != NULL) {
+    // 编译错误直接写入stderr，先写出之前print的内容
+    flushOutput(&vm.output);
+    if (!compileLazyFunction(closure->function)) {
+      runtimeError("Could not compile function '%s'.", closure->function->name->chars);
+      return false;
+    }
+  }
+
+  // 来自字节码镜像的函数，在第一次调用时才加载常量
+  if (closure->function->image != NULL && !loadImageFunction(closure->function)) {
+    runtimeError("Corrupt bytecode image.");
+    return false;
+  }
+
   // 函数堆栈溢出校验，也就是著名的stack overflow
-  if (vm.frameCount == FRAMES_MAX) {
+  // 局部变量可以超过255个，因此除了调用帧的个数，还需要检查栈中是否还能放下该函数的局部变量(以及运算的临时值)
+  // 延迟编译的函数在编译之后才知道maxSlots，因此放在编译和加载之后
+  if (vm.frameCount == FRAMES_MAX ||
+      vm.stackTop + closure->function->maxSlots + UINT8_COUNT > vm.stack + STACK_MAX) {
     runtimeError("Stack overflow.");
     return false;
   }
@@ -126,6 +371,8 @@ static bool call(ObjClosure* closure, int argCount) {
   // 初始化
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
+  frame->openUpvalues = NULL;
+  frame->globals = closure->module == NULL ? &vm.globals : &closure->module->globals;
 
   // 减去参数的位置和函数自身占用的位置，则将其重置为函数调用开始的位置(见 vm.h 说明)
   frame->slots = vm.stackTop - argCount - 1;
@@ -160,6 +407,11 @@ static bool callValue(Value callee, int argCount) {
         NativeFn native = AS_NATIVE(callee);
         // 执行native函数
         Value result = (*native)(argCount, vm.stackTop - argCount);
+        // 出错时栈已经被清空
+        if (nativeFailed) {
+          nativeFailed = false;
+          return false;
+        }
         // native函数不存在执行帧，因此直接将多余的参数和函数本身丢弃，然后将返回值push到栈中
         vm.stackTop -= argCount + 1;
         push(result);
@@ -195,6 +447,19 @@ static bool invoke(ObjString* name, int argCount) {
   // 此时的栈顶应该是[instance, ...arguments];
   Value receiver = peek(argCount);
 
+  // 模块的成员就是模块的全局变量，例如：math.sqrt(2)
+  if (IS_MODULE(receiver)) {
+    ObjModule* module = AS_MODULE(receiver);
+    Value value;
+    if (!tableGet(&module->globals, name, &value)) {
+      runtimeError("Undefined variable '%s' in module '%s'.",
+                   name->chars, module->name->chars);
+      return false;
+    }
+    vm.stackTop[-argCount - 1] = value;
+    return callValue(value, argCount);
+  }
+
   if (!IS_INSTANCE(receiver)) {
     runtimeError("Only instances have methods.");
     return false;
@@ -213,7 +478,7 @@ static bool invoke(ObjString* name, int argCount) {
 }
 
 // 新建一个ObjUpvalue*
-static ObjUpvalue* captureUpvalue(Value* local) {
+static ObjUpvalue* captureUpvalue(CallFrame* frame, Value* local) {
   /* 
     Note: 如果直接新建，在下面这种情况下，每个a会在f和g中创建两个ObjUpvalue, 这破坏了ObjUpvalue的唯一性
     fun main{
@@ -227,53 +492,49 @@ static ObjUpvalue* captureUpvalue(Value* local) {
     }
    */
 
-  // 因此每次创建新的ObjUpvalue之前，都必须循环链表来查找是否已经有了一个指向同样Value的ObjUpvalue
-  ObjUpvalue* preUpvalue = NULL;
-  ObjUpvalue* upvalue = vm.openUpvalues;
-  /* 
-    三种情况退出while：
-    1. upvalue指向地址和我们查找的地址一致, 代表我们已经找到了一个可以复用的值
-    2. 已经到了链表尾部，遍历了所有的值都没有找到
-    3. 找到一个Upvalue指向的地址小于我们寻找的地址，因为我们的链表是有序的(地址从大到小), 
-      则代表之后循环的upvalue的地址只会更小，那么说明已经不存在一个可以复用的值了。
-  */
-  while (upvalue != NULL && upvalue->location > local) {
-    preUpvalue = upvalue;
-    upvalue = upvalue->next;
-  }
-
+  // 因此每次创建新的ObjUpvalue之前，都要按栈中的位置查找是否已经有了一个指向同样Value的ObjUpvalue
+  ObjUpvalue** slot = &vm.openUpvalues[local - vm.stack];
   // 复用upvalue
-  if (upvalue != NULL && upvalue->location == local) {
-    return upvalue;
-  }
+  if (*slot != NULL) return *slot;
 
   // 创建一个新的ObjUpvalue
   ObjUpvalue* createdUpvalue = newUpvalue(local);
-  // 修复链表, 将新创建的值放入 preUpvalue 和 upvalue 之间
-  createdUpvalue->next = upvalue;
-  if (preUpvalue == NULL) {
-    // 如果整个链表只有一个值，那直接插入头部
-    vm.openUpvalues = createdUpvalue;
-  } else {
-    preUpvalue->next = createdUpvalue;
-  }
+  *slot = createdUpvalue;
+
+  // 插入当前调用帧的链表头部
+  createdUpvalue->next = frame->openUpvalues;
+  if (frame->openUpvalues != NULL) frame->openUpvalues->prev = createdUpvalue;
+  frame->openUpvalues = createdUpvalue;
 
   return createdUpvalue;
 }
 
-// close也就是持久化所有大于等于last位置的闭包变量
-// 并将其从链表中去除（因为持久化之后该变量也就从stack中消失了，不能用于复用了）
-static void closeUpvalues(Value* last) {
-  while (vm.openUpvalues != NULL &&
-    vm.openUpvalues->location >= last) {
-      ObjUpvalue* upvalue = vm.openUpvalues;
-      // 将Value的值存入一个新的closed字段，这个字段随着Obj对象一起保存在堆内存中，持久存在
-      upvalue->closed = *upvalue->location;
-      // 然后将location指向closed, 这样即使原来的stack中的值不存在了
-      // 依然可以通过location来获取该值
-      upvalue->location = &upvalue->closed;
-      vm.openUpvalues = upvalue->next;
-    }
+// close也就是持久化该闭包变量
+// 并将其从索引和链表中去除（因为持久化之后该变量也就从stack中消失了，不能用于复用了）
+static void closeUpvalue(CallFrame* frame, ObjUpvalue* upvalue) {
+  vm.openUpvalues[upvalue->location - vm.stack] = NULL;
+
+  // 将Value的值存入一个新的closed字段，这个字段随着Obj对象一起保存在堆内存中，持久存在
+  upvalue->closed = *upvalue->location;
+  // 然后将location指向closed, 这样即使原来的stack中的值不存在了
+  // 依然可以通过location来获取该值
+  upvalue->location = &upvalue->closed;
+
+  if (upvalue->prev != NULL) {
+    upvalue->prev->next = upvalue->next;
+  } else {
+    frame->openUpvalues = upvalue->next;
+  }
+  if (upvalue->next != NULL) upvalue->next->prev = upvalue->prev;
+  upvalue->prev = NULL;
+  upvalue->next = NULL;
+}
+
+// 函数返回时close该调用帧中所有的闭包变量
+static void closeFrameUpvalues(CallFrame* frame) {
+  while (frame->openUpvalues != NULL) {
+    closeUpvalue(frame, frame->openUpvalues);
+  }
 }
 
 static void defineMethod(ObjString* name) {
@@ -301,22 +562,180 @@ static bool bindMethod(ObjClass* klass, ObjString* name) {
   return true;
 }
 
+// 读取模块的源码，失败时返回NULL
+static char* readModuleFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  long fileSize = ftell(file);
+  rewind(file);
+
+  char* buffer = fileSize >= 0 ? (char*)malloc(fileSize + 1) : NULL;
+  if (buffer != NULL) {
+    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    buffer[bytesRead] = '\0';
+  }
+  fclose(file);
+  return buffer;
+}
+
+// 文件所在的目录：path为绝对路径，返回最后一个'/'之前的部分(根目录下的文件为"/")
+static ObjString* directoryOf(const char* path) {
+  const char* slash = strrchr(path, '/');
+  int length = slash == NULL ? 0 : (slash == path ? 1 : (int)(slash - path));
+  return copyString(path, length);
+}
+
+void setScriptPath(const char* path) {
+  char* resolved = realpath(path, NULL);
+  vm.scriptDirectory = resolved == NULL ? NULL : directoryOf(resolved);
+  free(resolved);
+}
+
+// 将import的路径解析为绝对路径，失败(例如文件不存在)时返回NULL，返回的字符串需要调用者free
+// 相对路径相对于执行import的代码所在的文件的目录：模块中为模块的目录，主脚本中为主脚本的目录
+static char* resolveModulePath(ObjString* path) {
+  ObjModule* importer = vm.frames[vm.frameCount - 1].closure->module;
+  ObjString* directory = importer != NULL ? importer->directory : vm.scriptDirectory;
+  if (path->chars[0] == '/' || directory == NULL) return realpath(path->chars, NULL);
+
+  size_t length = directory->length + 1 + path->length + 1;
+  char* joined = (char*)malloc(length);
+  snprintf(joined, length, "%s/%s", directory->chars, path->chars);
+  char* resolved = realpath(joined, NULL);
+  free(joined);
+  return resolved;
+}
+
+/*
+  导入模块，执行之后栈顶为[module, 模块顶级函数的返回值]。
+
+  每个文件在进程中只编译执行一次：第一次导入时编译(或者读取字节码缓存)，新建一个模块对象，
+  然后像调用函数一样进入模块的顶级函数，模块中定义的全局变量都保存在模块自己的全局变量表中；
+  之后再导入同一个文件时直接返回同一个模块对象。
+  模块在执行之前就已经登记，循环导入时得到的是还没有执行完的模块。
+*/
+static bool importModule(ObjString* path) {
+  // 用解析之后的绝对路径判断是否是同一个文件，同一个相对路径在不同的目录中导入的是不同的文件
+  char* resolved = resolveModulePath(path);
+  if (resolved == NULL) {
+    runtimeError("Could not open module '%s'.", path->chars);
+    return false;
+  }
+  push(OBJ_VAL(copyString(resolved, (int)strlen(resolved))));
+  Value module;
+  if (tableGet(&vm.modules, AS_STRING(peek(0)), &module)) {
+    free(resolved);
+    pop();
+    push(module);
+    push(NIL_VAL);
+    return true;
+  }
+  push(OBJ_VAL(directoryOf(resolved)));
+
+  // 模块中的编译错误直接写入stderr，先写出之前print的内容
+  flushOutput(&vm.output);
+  char* source = readModuleFile(resolved);
+  // 模块总是完整编译的，编译之后就不再需要源码
+  ObjFunction* function = source == NULL ? NULL : compileWithCache(resolved, source, false);
+  free(source);
+  free(resolved);
+  if (function == NULL) {
+    runtimeError("Could not load module '%s'.", path->chars);
+    return false;
+  }
+  push(OBJ_VAL(function));
+
+  ObjModule* imported = newModule(path, AS_STRING(peek(1)));
+  push(OBJ_VAL(imported));
+  // 每个模块都能访问内置函数
+  tableAddAll(&vm.natives, &imported->globals);
+  tableSet(&vm.modules, AS_STRING(peek(3)), OBJ_VAL(imported));
+
+  ObjClosure* closure = newClosure(function);
+  closure->module = imported;
+
+  // 将栈中的[绝对路径, 目录, function, module]替换为[module, closure]，然后调用模块的顶级函数
+  vm.stackTop -= 4;
+  push(OBJ_VAL(imported));
+  push(OBJ_VAL(closure));
+  return call(closure, 0);
+}
+
+#ifdef DEBUG_PROFILE_OPCODES
+// 最近执行过的两条指令，-1表示还没有执行过指令
+static int profilePrevious[2] = { -1, -1 };
+// 相邻两条、三条指令的执行次数
+static uint64_t profilePairs[OP_COUNT][OP_COUNT];
+static uint64_t profileTriples[OP_COUNT][OP_COUNT][OP_COUNT];
+
+// 记录一条即将执行的指令
+static void profileInstruction(uint8_t instruction) {
+  if (profilePrevious[1] != -1) {
+    profilePairs[profilePrevious[1]][instruction]++;
+    if (profilePrevious[0] != -1) {
+      profileTriples[profilePrevious[0]][profilePrevious[1]][instruction]++;
+    }
+  }
+  profilePrevious[0] = profilePrevious[1];
+  profilePrevious[1] = instruction;
+}
+
+// 将统计结果追加写入文件(默认为opcodes.profile，可以用环境变量LOX_PROFILE指定)
+// 每行的格式为：次数 指令1 指令2 [指令3]
+static void writeOpcodeProfile() {
+  const char* path = getenv("LOX_PROFILE");
+  if (path == NULL) path = "opcodes.profile";
+
+  FILE* file = fopen(path, "a");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open profile \"%s\".\n", path);
+    return;
+  }
+
+  for (int a = 0; a < OP_COUNT; a++) {
+    for (int b = 0; b < OP_COUNT; b++) {
+      if (profilePairs[a][b] == 0) continue;
+      fprintf(file, "%llu %s %s\n", (unsigned long long)profilePairs[a][b],
+              opcodeName(a), opcodeName(b));
+
+      for (int c = 0; c < OP_COUNT; c++) {
+        if (profileTriples[a][b][c] == 0) continue;
+        fprintf(file, "%llu %s %s %s\n",
+                (unsigned long long)profileTriples[a][b][c],
+                opcodeName(a), opcodeName(b), opcodeName(c));
+      }
+    }
+  }
+
+  fclose(file);
+}
+#endif
+
 static InterpretResult run() {
   CallFrame* frame = &vm.frames[vm.frameCount - 1];
   // 因为在执行过程中，读写ip是一个高频操作，
   // 使用register指令让编译器尽可能的将ip放入寄存器，加快ip的读写速度
   register uint8_t* ip = frame->ip;
+  // OP_WIDE前缀为下一条指令的操作数提供的高位字节，读取操作数之后清零
+  uint32_t wide = 0;
+  uint32_t arg;
 
   // 从当前函数的调用栈读取一个字节的指令
   #define READ_BYTE() (*ip++)
+  // 出错时先将寄存器中的ip写回调用帧，runtimeError根据调用帧的ip打印出错的行数
+  #define RUNTIME_ERROR(...) (frame->ip = ip, runtimeError(__VA_ARGS__))
   // 位运算
   #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
-  #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+  // 读取一个可以被OP_WIDE扩展的操作数(常量的index，局部变量的位置)
+  #define READ_ARG() (arg = wide | READ_BYTE(), wide = 0, arg)
+  #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_ARG()])
   #define READ_STRING() AS_STRING(READ_CONSTANT())
   #define BINARY_OP(valueType, op) \
     do { \
       if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-        runtimeError("Operands must be numbers."); \
+        RUNTIME_ERROR("Operands must be numbers."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
       \
@@ -325,6 +744,149 @@ static InterpretResult run() {
       push(valueType(a op b)); \
     } while (false) // do while用于加一个块级作用域包裹代码块
 
+  /*
+    可以被合并为超级指令的指令的执行体，普通指令和超级指令(见chunk.h)共享同一份实现。
+    注意：这些宏中不能使用break，否则会提前跳出超级指令中后续子指令的执行
+  */
+  #define EXEC_CONSTANT() push(READ_CONSTANT())
+  #define EXEC_NIL()      push(NIL_VAL)
+  #define EXEC_TRUE()     push(BOOL_VAL(true))
+  #define EXEC_FALSE()    push(BOOL_VAL(false))
+  #define EXEC_POP()      pop()
+  /* 在locals中的位置 = 在slots中的位置，直接将该值push在stack中供后续表达式使用 */
+  #define EXEC_GET_LOCAL() push(frame->slots[READ_ARG()])
+  /* 直接将slots的值进行替换，也就完成了赋值。
+     在赋值表达式中，并不需要pop(), 因为在compile赋值表达式的时候，默认插入了一个OP_POP指令 */
+  #define EXEC_SET_LOCAL() (frame->slots[READ_ARG()] = peek(0))
+  /* 在upvalues中的location也就是stack中的Value的指针，用*取值，推入栈中 */
+  #define EXEC_GET_UPVALUE() push(*frame->closure->upvalues[READ_BYTE()]->location)
+  /* 在upvalues中的location也就是stack中的Value的指针，对其进行赋值 */
+  #define EXEC_SET_UPVALUE() (*frame->closure->upvalues[READ_BYTE()]->location = peek(0))
+  /* 按值捕获的闭包变量直接保存在闭包对象中 */
+  #define EXEC_GET_CAPTURED() push(frame->closure->captured[READ_BYTE()])
+  /* 从栈中取出放入table中 */
+  #define EXEC_DEFINE_GLOBAL() \
+    do { \
+      ObjString* name = READ_STRING(); \
+      tableSet(frame->globals, name, peek(0)); \
+      pop(); \
+    } while (false)
+  /* 类似于constant, 从table中取到之后推入栈中，待其他的表达式使用 */
+  #define EXEC_GET_GLOBAL() \
+    do { \
+      ObjString* name = READ_STRING(); \
+      Value value; \
+      if (!tableGet(frame->globals, name, &value)) { \
+        RUNTIME_ERROR("Undefined variable '%s'.", name->chars); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      push(value); \
+    } while (false)
+  #define EXEC_SET_GLOBAL() \
+    do { \
+      ObjString* name = READ_STRING(); \
+      Value value; \
+      if (!tableGet(frame->globals, name, &value)) { \
+        RUNTIME_ERROR("Undefined variable '%s'.", name->chars); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      tableSet(frame->globals, name, peek(0)); \
+    } while (false)
+  /* 此时的实例在栈顶，先在fields中寻找，然后在methods中寻找；模块则在模块的全局变量中寻找 */
+  #define EXEC_GET_PROPERTY() \
+    do { \
+      if (IS_MODULE(peek(0))) { \
+        /* 模块的属性就是模块的全局变量 */ \
+        ObjModule* module = AS_MODULE(peek(0)); \
+        ObjString* name = READ_STRING(); \
+        Value value; \
+        if (!tableGet(&module->globals, name, &value)) { \
+          RUNTIME_ERROR("Undefined variable '%s' in module '%s'.", \
+                        name->chars, module->name->chars); \
+          return INTERPRET_RUNTIME_ERROR; \
+        } \
+        pop(); \
+        push(value); \
+      } else if (!IS_INSTANCE(peek(0))) { \
+        RUNTIME_ERROR("Only instances have properties."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } else { \
+        ObjInstance* instance = AS_INSTANCE(peek(0)); \
+        ObjString* name = READ_STRING(); \
+        Value value; \
+        if (tableGet(&instance->fields, name, &value)) { \
+          pop(); \
+          push(value); \
+        } else { \
+          /* bindMethod在找不到方法时会报告错误 */ \
+          frame->ip = ip; \
+          if (!bindMethod(instance->klass, name)) return INTERPRET_RUNTIME_ERROR; \
+        } \
+      } \
+    } while (false)
+  /* 此时的实例在栈顶后一位，待赋值的参数在栈顶。
+     赋值之后将实例出栈，重新将赋值的值入栈待使用，例如：print obj.foo = "bar"; */
+  #define EXEC_SET_PROPERTY() \
+    do { \
+      if (!IS_INSTANCE(peek(1))) { \
+        RUNTIME_ERROR("Only instances have properties."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      ObjInstance* instance = AS_INSTANCE(peek(1)); \
+      tableSet(&instance->fields, READ_STRING(), peek(0)); \
+      Value value = pop(); \
+      pop(); \
+      push(value); \
+    } while (false)
+  /* 支持字符串相加 */
+  /* 先判断数字：字符串有三种表示(见object.h中的IS_TEXT)，判断的代价更高 */
+  #define EXEC_ADD() \
+    do { \
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) { \
+        double b = AS_NUMBER(pop()); \
+        double a = AS_NUMBER(pop()); \
+        push(NUMBER_VAL(a + b)); \
+      } else if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) { \
+        if (!concatenate()) { \
+          RUNTIME_ERROR("String too long."); \
+          return INTERPRET_RUNTIME_ERROR; \
+        } \
+      } else { \
+        RUNTIME_ERROR("Operands must be numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+    } while (false)
+  #define EXEC_SUBTRACT() BINARY_OP(NUMBER_VAL, -)
+  #define EXEC_MULTIPLY() BINARY_OP(NUMBER_VAL, *)
+  #define EXEC_DIVIDE()   BINARY_OP(NUMBER_VAL, /)
+  #define EXEC_GREATER()  BINARY_OP(BOOL_VAL, >)
+  #define EXEC_LESS()     BINARY_OP(BOOL_VAL, <)
+  /* 将比较后的结果转为Value写入内存 */
+  /* 比较字符串连接的结果时可能触发GC，比较完成之后再出栈 */
+  #define EXEC_EQUAL() \
+    do { \
+      bool equal = isEuqal(peek(1), peek(0)); \
+      vm.stackTop -= 2; \
+      push(BOOL_VAL(equal)); \
+    } while (false)
+  /* 对栈顶的数取反，然后写入栈中 */
+  #define EXEC_NOT() push(BOOL_VAL(!toBool(pop())))
+  /* 类型检测之后取负数写入内存 */
+  #define EXEC_NEGATE() \
+    do { \
+      if (!IS_NUMBER(peek(0))) { \
+        RUNTIME_ERROR("Operand must be a number"); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      push(NUMBER_VAL(-AS_NUMBER(pop()))); \
+    } while (false)
+  #define EXEC_PRINT() \
+    do { \
+      writeOutputValue(&vm.output, peek(0)); \
+      pop(); \
+      writeOutput(&vm.output, "\n", 1); \
+    } while (false)
+
   // 按序执行每个指令
   for(;;) {
     #ifdef DEBUG_TRACE_EXECUTION
@@ -340,55 +902,28 @@ static InterpretResult run() {
       disassembleInstruction(&frame->closure->function->chunk, (int)(ip - frame->closure->function->chunk.code));
     #endif
 
+    #ifdef DEBUG_PROFILE_OPCODES
+      profileInstruction(*ip);
+    #endif
+
     uint8_t instruction;
     switch (instruction = READ_BYTE()) {
-      case OP_NEGATE: {
-        // 类型检测
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        // 取负数写入内存
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
-        break;
-      }
-      case OP_NOT: {
-        // 对栈顶的数取反，然后写入栈中
-        push(BOOL_VAL(!toBool(pop())));
-        break;
-      }
-      case OP_ADD: {
-        // 支持字符串相加
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-          concatenate();
-        } else {
-          BINARY_OP(NUMBER_VAL, +);
-        }
-        break;
-      }
-      case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-      case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-      case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-
-      case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-      case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-      case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        // 将比较后的结果转为Value写入内存
-        push(BOOL_VAL(isEuqal(a, b)));
-        break;
-      }
-      case OP_PRINT: {
-        printValue(pop());
-        printf("\n");
-        break;
-      }
+      case OP_NEGATE:   EXEC_NEGATE(); break;
+      case OP_NOT:      EXEC_NOT(); break;
+      case OP_ADD:      EXEC_ADD(); break;
+      case OP_SUBTRACT: EXEC_SUBTRACT(); break;
+      case OP_MULTIPLY: EXEC_MULTIPLY(); break;
+      case OP_DIVIDE:   EXEC_DIVIDE(); break;
+
+      case OP_GREATER:  EXEC_GREATER(); break;
+      case OP_LESS:     EXEC_LESS(); break;
+      case OP_EQUAL:    EXEC_EQUAL(); break;
+      case OP_PRINT:    EXEC_PRINT(); break;
       case OP_RETURN: {
         Value result = pop();
         
         // 当一个函数执行完之后，其中所有的闭包变量都应该被close(也就是持久化)
-        closeUpvalues(frame->slots);
+        closeFrameUpvalues(frame);
 
         // 函数出栈
         vm.frameCount--;
@@ -409,85 +944,29 @@ static InterpretResult run() {
         ip = frame->ip;
         break;
       }
-      case OP_POP: {
-        pop();
-        break;
-      }
-      case OP_GET_UPVALUE: {
-        // 在upvalues中的位置
-        uint8_t slot = READ_BYTE();
-        // 在upvalues中的location也就是stack中的Value的指针，用*取值，推入栈中
-        push(*frame->closure->upvalues[slot]->location);
-        break;
-      }
-      case OP_SET_UPVALUE: {
-        // 在upvalues中的位置
-        uint8_t slot = READ_BYTE();
-        // 在upvalues中的location也就是stack中的Value的指针，对其进行赋值
-        *frame->closure->upvalues[slot]->location = peek(0);
-        break;
-      }
+      case OP_POP:          EXEC_POP(); break;
+      case OP_GET_UPVALUE:  EXEC_GET_UPVALUE(); break;
+      case OP_SET_UPVALUE:  EXEC_SET_UPVALUE(); break;
+      case OP_GET_CAPTURED: EXEC_GET_CAPTURED(); break;
       case OP_CLOSE_UPVALUE: {
         // 将这个闭包变量(此时在栈中的位置为vm.stackTop - 1)放入堆中，方便持久使用
-        closeUpvalues(vm.stackTop - 1);
+        // 如果捕获该变量的闭包并没有被执行到(例如在未执行的if分支中)，则不存在对应的ObjUpvalue
+        ObjUpvalue* upvalue = vm.openUpvalues[vm.stackTop - 1 - vm.stack];
+        if (upvalue != NULL) closeUpvalue(frame, upvalue);
         // 利用完之后，将其正常地从stack中移除
         pop();
         break;
       }
-      case OP_GET_LOCAL: {
-        // 在locals中的位置 = 在slots中的位置
-        uint8_t slot = READ_BYTE();
-        // 直接将该值push在stack中供后续表达式使用
-        push(frame->slots[slot]);
-        break;
-      }
-      case OP_SET_LOCAL: {
-        // 在locals中的位置 = 在slots中的位置
-        uint8_t slot = READ_BYTE();
-        // 直接将slots的值进行替换，也就完成了赋值
-        frame->slots[slot] = peek(0);
-
-        // 在赋值表达式中，并不需要pop(), 因为在compile赋值表达式的时候，默认插入了一个OP_POP指令
-        break;
-      }
-      case OP_DEFINE_GLOBAL: {
-        // 从栈中去除放入table中
-        ObjString* name = READ_STRING();
-        tableSet(&vm.globals, name, peek(0));
-        pop();
-        break;
-      }
-      case OP_GET_GLOBAL: {
-        // 类似于constant, 从table中取到之后推入栈中，待其他的表达式使用
-        ObjString* name = READ_STRING();
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(value);
-        break;
-      }
-      case OP_SET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        } else {
-          tableSet(&vm.globals, name, peek(0));
-        }
-        break;
-      }
+      case OP_GET_LOCAL:    EXEC_GET_LOCAL(); break;
+      case OP_SET_LOCAL:    EXEC_SET_LOCAL(); break;
+      case OP_DEFINE_GLOBAL: EXEC_DEFINE_GLOBAL(); break;
+      case OP_GET_GLOBAL:   EXEC_GET_GLOBAL(); break;
+      case OP_SET_GLOBAL:   EXEC_SET_GLOBAL(); break;
       // 读出来写入内存
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
-      }
-      case OP_NIL: push(NIL_VAL); break;
-      case OP_FALSE: push(BOOL_VAL(false)); break;
-      case OP_TRUE: push(BOOL_VAL(true)); break;
+      case OP_CONSTANT: EXEC_CONSTANT(); break;
+      case OP_NIL:      EXEC_NIL(); break;
+      case OP_FALSE:    EXEC_FALSE(); break;
+      case OP_TRUE:     EXEC_TRUE(); break;
 
       // logic control flow
       case OP_JUMP_IF_FALSE: {
@@ -513,16 +992,40 @@ static InterpretResult run() {
         ip -= offset;
         break;
       }
+      // 跳转距离超过两个字节的跳转指令，操作数为跳转距离在常量数组中的位置
+      case OP_JUMP_IF_FALSE_FAR: {
+        uint32_t offset = (uint32_t)AS_NUMBER(
+            frame->closure->function->chunk.constants.values[READ_SHORT()]);
+        if (!toBool(peek(0))) ip += offset;
+        break;
+      }
+      case OP_JUMP_FAR: {
+        uint32_t offset = (uint32_t)AS_NUMBER(
+            frame->closure->function->chunk.constants.values[READ_SHORT()]);
+        ip += offset;
+        break;
+      }
+      case OP_LOOP_FAR: {
+        uint32_t offset = (uint32_t)AS_NUMBER(
+            frame->closure->function->chunk.constants.values[READ_SHORT()]);
+        ip -= offset;
+        break;
+      }
+      case OP_WIDE: {
+        // 累积高位字节，下一条指令通过READ_ARG()读取完整的操作数
+        wide = (wide | READ_BYTE()) << 8;
+        break;
+      }
       case OP_CALL: {
         // 读出参数的个数, 此时栈中[callee, arg1, arg2]
         // 直到参数的个数，就知道函数在栈中的位置
         uint16_t argCount = READ_BYTE();
         // 往frames中push一个调用帧
+        // 保存当前函数的ip位置
+        frame->ip = ip;
         if (!callValue(peek(argCount), argCount)) {
           return INTERPRET_RUNTIME_ERROR;
         }
-        // 保存当前函数的ip位置
-        frame->ip = ip;
         // 将frame替换成当前需要执行的callee的调用帧，下次循环的时候就进入了函数的真正执行
         frame = &vm.frames[vm.frameCount - 1];
         // 将ip指向新的函数调用的ip地址
@@ -533,12 +1036,25 @@ static InterpretResult run() {
         ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
         // 将函数包装到一个闭包对象中入栈
         ObjClosure* closure = newClosure(function);
+        // 闭包属于定义它的模块
+        closure->module = frame->closure->module;
         push(OBJ_VAL(closure));
 
         // 将该闭包函数所有的upvalues(编译时)写入runtime对应的closure对象中的upvalues数组(runtime)
-        for (int i = 0; i < closure->upvalueCount; i++) {
-          uint8_t isLocal = READ_BYTE();
-          uint8_t index = READ_BYTE();
+        for (int i = 0; i < closure->upvalueCount + closure->capturedCount; i++) {
+          uint8_t flags = READ_BYTE();
+          uint16_t index = READ_BYTE();
+          if (flags & UPVALUE_WIDE) index = (uint16_t)(index << 8 | READ_BYTE());
+          bool isLocal = flags & UPVALUE_LOCAL;
+
+          // 按值捕获的变量：直接复制当前的值
+          // 注意闭包此时已经入栈，因此局部函数引用自身时(该局部变量的位置就是栈顶)复制到的就是闭包本身
+          if (i >= closure->upvalueCount) {
+            int capture = i - closure->upvalueCount;
+            closure->captured[capture] = isLocal
+                ? frame->slots[index] : frame->closure->captured[index];
+            continue;
+          }
 
           // 如果该upvalue引用的是一个stack中的值，则需要新建一个ObjUpvalue值用于在stack中的值释放之后使用
           // 相反，如果该upvalue引用的是另一个upvalue，那么它引用的肯定是当前父环境的upvalue，直接复用其地址，相当于不用新建一个ObjUpvalue
@@ -546,7 +1062,7 @@ static InterpretResult run() {
           // Note: 这是很重要的一点，必须保证每一个闭包变量对应的是唯一的一个ObjUpvalue, 
           // 不然当多个闭包函数对同一个变量进行引用以及分别赋值的时候，不会发生错乱，从而保证他们始终都引用的是同一个闭包变量
           if (isLocal) {
-            closure->upvalues[i] = captureUpvalue(frame->slots + index);
+            closure->upvalues[i] = captureUpvalue(frame, frame->slots + index);
           } else {
             closure->upvalues[i] = frame->closure->upvalues[index];
           }
@@ -563,7 +1079,7 @@ static InterpretResult run() {
         Value superClass = peek(1);
 
         if (!IS_CLASS(superClass)) {
-          runtimeError("Superclass must be a class.");
+          RUNTIME_ERROR("Superclass must be a class.");
           return INTERPRET_RUNTIME_ERROR;
         }
 
@@ -581,6 +1097,8 @@ static InterpretResult run() {
         // 从栈顶读取父类并出栈
         ObjClass* superclass = AS_CLASS(pop());
         // 找到该方法并将其绑定在栈顶的实例上，然后入栈供下一步调用
+        // 保存当前函数的ip位置
+        frame->ip = ip;
         if (!bindMethod(superclass, name)) {
           return INTERPRET_RUNTIME_ERROR;
         }
@@ -593,12 +1111,12 @@ static InterpretResult run() {
       case OP_INVOKE: {
         ObjString* method = READ_STRING();
         int argCount = READ_BYTE();
+        // 保存当前函数的ip位置
+        frame->ip = ip;
         if (!invoke(method, argCount)) {
           return INTERPRET_RUNTIME_ERROR;
         }
 
-        // 保存当前函数的ip位置
-        frame->ip = ip;
         // 将frame替换成当前需要执行的callee的调用帧，下次循环的时候就进入了函数的真正执行
         frame = &vm.frames[vm.frameCount - 1];
         // 将ip指向新的函数调用的ip地址
@@ -613,75 +1131,131 @@ static InterpretResult run() {
         // 从栈顶读取父类并出栈
         ObjClass* superClass = AS_CLASS(pop());
         // 这里不再生成一个绑定方法，而是直接调用该方法
+        // 保存当前函数的ip位置
+        frame->ip = ip;
         if (!invokeFromClass(superClass, method, argCount)) {
           return INTERPRET_RUNTIME_ERROR;
         }
-        // 保存当前函数的ip位置
-        frame->ip = ip;
         // 将frame替换成当前需要执行的callee的调用帧，下次循环的时候就进入了函数的真正执行
         frame = &vm.frames[vm.frameCount - 1];
         // 将ip指向新的函数调用的ip地址
         ip = frame->ip;
         break;
       }
-      case OP_GET_PROPERTY: {
-        // 判断是否在实例对象上进行读取属性操作
-        if (!IS_INSTANCE(peek(0))) {
-          runtimeError("Only instances have properties.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-
-        // 此时的实例在栈顶
-        ObjInstance* instance = AS_INSTANCE(peek(0));
-        // 属性名
-        ObjString* name = READ_STRING();
-
-        Value value;
-        if (tableGet(&instance->fields, name, &value)) {
-          pop(); // 将实例出栈（不再需要了）
-          push(value); // 将属性值入栈待使用
-          break;
-        }
-
-        // 在methods中寻找, 如果没找到，直接报
-        if (!bindMethod(instance->klass, name)) {
-          // TOFIX: 暂时将读取未定义的属性视为一个runtimeError
-          runtimeError("Undefined property '%s'.", name->chars);
+      case OP_GET_PROPERTY: EXEC_GET_PROPERTY(); break;
+      case OP_SET_PROPERTY: EXEC_SET_PROPERTY(); break;
+      case OP_IMPORT: {
+        ObjString* path = READ_STRING();
+        // 保存当前函数的ip位置
+        frame->ip = ip;
+        if (!importModule(path)) {
           return INTERPRET_RUNTIME_ERROR;
         }
+        // 第一次导入时进入模块顶级函数的调用帧
+        frame = &vm.frames[vm.frameCount - 1];
+        ip = frame->ip;
         break;
       }
-      case OP_SET_PROPERTY: {
-        // 判断是否在实例对象上进行读取属性操作
-        if (!IS_INSTANCE(peek(1))) {
-          runtimeError("Only instances have properties.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
 
-        // 此时的实例在栈顶后一位
-        ObjInstance* instance = AS_INSTANCE(peek(1));         
-        // 待赋值的参数在栈顶
-        tableSet(&instance->fields, READ_STRING(), peek(0));
-
-        // 将赋值的值取出
-        Value value = pop();
-        // 将实例出栈（不再需要了）
-        pop();
-        // 重新将赋值的值入栈待使用，例如：print obj.foo = "bar";
-        push(value);
+      // BEGIN GENERATED SUPERINSTRUCTIONS: 由superinstructions.py生成，请勿手动修改
+      case OP_ADD_SET_GLOBAL_POP: {
+        EXEC_ADD();
+        ip++;
+        EXEC_SET_GLOBAL();
+        ip++;
+        EXEC_POP();
+        break;
+      }
+      case OP_CONSTANT_SET_PROPERTY_POP: {
+        EXEC_CONSTANT();
+        ip++;
+        EXEC_SET_PROPERTY();
+        ip++;
+        EXEC_POP();
+        break;
+      }
+      case OP_GET_GLOBAL_CONSTANT_LESS: {
+        EXEC_GET_GLOBAL();
+        ip++;
+        EXEC_CONSTANT();
+        ip++;
+        EXEC_LESS();
         break;
       }
+      case OP_GET_LOCAL_CONSTANT_LESS: {
+        EXEC_GET_LOCAL();
+        ip++;
+        EXEC_CONSTANT();
+        ip++;
+        EXEC_LESS();
+        break;
+      }
+      case OP_POP_GET_GLOBAL_GET_GLOBAL: {
+        EXEC_POP();
+        ip++;
+        EXEC_GET_GLOBAL();
+        ip++;
+        EXEC_GET_GLOBAL();
+        break;
+      }
+      case OP_ADD_GET_GLOBAL: {
+        EXEC_ADD();
+        ip++;
+        EXEC_GET_GLOBAL();
+        break;
+      }
+      case OP_GET_LOCAL_CONSTANT: {
+        EXEC_GET_LOCAL();
+        ip++;
+        EXEC_CONSTANT();
+        break;
+      }
+      case OP_GET_LOCAL_GET_PROPERTY: {
+        EXEC_GET_LOCAL();
+        ip++;
+        EXEC_GET_PROPERTY();
+        break;
+      }
+      // END GENERATED SUPERINSTRUCTIONS
     }
   }
 
   #undef READ_BYTE
+  #undef RUNTIME_ERROR
   #undef READ_SHORT
+  #undef READ_ARG
   #undef READ_CONSTANT
   #undef READ_STRING
   #undef BINARY_OP
+  #undef EXEC_CONSTANT
+  #undef EXEC_NIL
+  #undef EXEC_TRUE
+  #undef EXEC_FALSE
+  #undef EXEC_POP
+  #undef EXEC_GET_LOCAL
+  #undef EXEC_SET_LOCAL
+  #undef EXEC_GET_UPVALUE
+  #undef EXEC_SET_UPVALUE
+  #undef EXEC_GET_CAPTURED
+  #undef EXEC_DEFINE_GLOBAL
+  #undef EXEC_GET_GLOBAL
+  #undef EXEC_SET_GLOBAL
+  #undef EXEC_GET_PROPERTY
+  #undef EXEC_SET_PROPERTY
+  #undef EXEC_ADD
+  #undef EXEC_SUBTRACT
+  #undef EXEC_MULTIPLY
+  #undef EXEC_DIVIDE
+  #undef EXEC_GREATER
+  #undef EXEC_LESS
+  #undef EXEC_EQUAL
+  #undef EXEC_NOT
+  #undef EXEC_NEGATE
+  #undef EXEC_PRINT
 }
 
 void initVM() {
+  initHashSeed();
   resetStack();
   vm.objects = NULL;
   vm.bytesAllocated = 0;
@@ -690,31 +1264,64 @@ void initVM() {
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
+  vm.snapshotPath = NULL;
+  const char* outputFd = getenv("LOX_OUTPUT_FD");
+  initOutput(&vm.output, outputFd != NULL ? atoi(outputFd) : STDOUT_FILENO);
   initTable(&vm.strings);
   initTable(&vm.globals);
+  initTable(&vm.natives);
+  initTable(&vm.modules);
+  vm.scriptDirectory = NULL;
 
   // 由于我们的所有字符串都是持久化了的，所以这里也把init持久化
   vm.initString = copyString("init", 4);
 
   // 在初始化vm的时候，注入我们的内置函数
   defineNative("clock", clockNative);
+  defineNative("snapshot", snapshotNative);
+  defineNative("flush", flushNative);
+  defineNative("StringBuilder", stringBuilderNative);
+  defineNative("append", appendNative);
+  defineNative("appendNumber", appendNumberNative);
+  defineNative("length", lengthNative);
+  defineNative("toString", toStringNative);
+  defineNative("substring", substringNative);
+  defineNative("indexOf", indexOfNative);
+  defineNative("startsWith", startsWithNative);
+  defineNative("charAt", charAtNative);
+  defineNative("split", splitNative);
 }
 
 void freeVM() {
+  #ifdef DEBUG_PROFILE_OPCODES
+    writeOpcodeProfile();
+  #endif
+
+  freeOutput(&vm.output);
   freeTable(&vm.strings);
   freeTable(&vm.globals);
+  freeTable(&vm.natives);
+  freeTable(&vm.modules);
   vm.initString = NULL;
+  vm.scriptDirectory = NULL;
   freeObjects();
+  // 对象中的指令可能指向镜像映射的内存，因此在释放所有对象之后再解除映射
+  freeImages();
 }
 
 // 执行源码
 InterpretResult interpret(const char* source) {
   // 将源码编译成字节码
-  ObjFunction* function = compile(source);
+  ObjFunction* function = compile(source, false);
   if (function == NULL)  {
     return INTERPRET_COMPILE_ERROR;
   }
 
+  return interpretFunction(function);
+}
+
+// 执行已经编译好的顶级函数(来自编译器或者字节码缓存)
+InterpretResult interpretFunction(ObjFunction* function) {
   /* 
     Note: 我们的局部变量都是通过该偏移量去获取的，因此locals的位置和stack中的位置必须保持一致
     因为在编译时已经将该函数名推入了locals中。所以这里必须将函数的值也推入stack中，以保持两个数组的偏移量一致
@@ -728,7 +1335,7 @@ InterpretResult interpret(const char* source) {
   // 将顶级匿名闭包函数入栈
   push(OBJ_VAL(closure));
   // 调用（也就是将其插入调用帧）
-  callValue(OBJ_VAL(closure), 0);
+  if (!callValue(OBJ_VAL(closure), 0)) return INTERPRET_RUNTIME_ERROR;
 
   // CallFrame* frame = &vm.frames[vm.frameCount++];
   // frame->function = function;
@@ -738,6 +1345,13 @@ InterpretResult interpret(const char* source) {
 
   // 执行字节码
   InterpretResult result = run();
+  flushOutput(&vm.output);
+  return result;
+}
+
+InterpretResult resume() {
+  InterpretResult result = run();
+  flushOutput(&vm.output);
   return result;
 }
 
@@ -3,10 +3,14 @@
 
 #include "chunk.h"
 #include "object.h"
+#include "output.h"
 #include "table.h"
 
 #define FRAMES_MAX 64                       
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// 一个函数最多的局部变量个数：栈中还要放下调用者压入的函数本身以及运算的临时值(见vm.c中的call)，
+// 超过这个数量的函数在编译时报错，否则编译之后总是无法执行
+#define LOCALS_MAX (STACK_MAX - UINT8_COUNT - 1)
 
 typedef enum {
   INTERPRET_OK,
@@ -27,6 +31,10 @@ typedef struct {
     此后函数内部的变量都根据slots这个位置来计算偏移量，这样才能保证取到正确的对应变量
    */
   Value* slots;
+  // 该调用帧中还未close的闭包变量(双向链表)
+  ObjUpvalue* openUpvalues;
+  // 函数所在模块的全局变量表(见object.h中的ObjModule)
+  Table* globals;
 } CallFrame;
 
 typedef struct {
@@ -41,20 +49,33 @@ typedef struct {
   Value* stackTop;
   // 堆内存，用于内存回收
   Obj* objects; 
-  // openUpvalues链表的head, 用于追踪upValues，来确保唯一性
-  ObjUpvalue* openUpvalues;
+  // 按栈中的位置索引的还未close的闭包变量，用于确保每个栈中的值只对应一个ObjUpvalue
+  // 查找和close都只需要O(1)，而不需要遍历所有的闭包变量
+  ObjUpvalue* openUpvalues[STACK_MAX];
   // 用于存储用户所定义的字符串
   Table strings;
   // 用于类的构造函数的名称的常量
   ObjString* initString;
-  // 全局变量
+  // 全局变量(主脚本的全局变量，模块的全局变量保存在各自的ObjModule中)
   Table globals;
+  // 内置函数，每个模块的全局变量表在创建时都会复制一份
+  Table natives;
+  // 已经导入的模块：解析之后的绝对路径 -> ObjModule，每个文件在进程中只编译执行一次
+  Table modules;
+  // 主脚本所在的目录，主脚本中相对路径的import相对于这个目录解析，NULL(REPL)时相对于当前工作目录
+  ObjString* scriptDirectory;
 
   // 垃圾回收的灰色对象栈，见memory.c
   int grayCount;
   int grayCapacity;
   Obj** grayStack;
 
+  // print语句的输出缓冲区(见output.h)
+  Output output;
+
+  // --snapshot模式下快照的输出路径，调用snapshot()时写入(见snapshot.c)
+  const char* snapshotPath;
+
   // vm总共分配的堆内存
   size_t bytesAllocated;
   //
@@ -64,6 +85,11 @@ typedef struct {
 void initVM();
 void freeVM();
 InterpretResult interpret(const char* source);
+InterpretResult interpretFunction(ObjFunction* function);
+// 记录主脚本的路径，用于解析主脚本中import的相对路径
+void setScriptPath(const char* path);
+// 从快照恢复的调用帧处继续执行
+InterpretResult resume();
 
 extern VM vm;
 